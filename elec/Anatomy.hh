@@ -16,12 +16,14 @@ class Anatomy
  public:
 
    Anatomy()
-   : i2t_(0, 0, 0), nRemote_(0){};
+   : i2t_(0, 0, 0), nRemote_(0), haloDepth_(1){};
 
    unsigned size() const;
    unsigned nLocal() const;
    unsigned nRemote() const;
    unsigned& nRemote();
+   unsigned haloDepth() const;
+   unsigned& haloDepth();
    unsigned nGlobal() const;
    unsigned& nGlobal();
 
@@ -63,6 +65,7 @@ class Anatomy
    double dx_, dy_, dz_;
    double offset_x_, offset_y_, offset_z_;
    unsigned nRemote_;
+   unsigned haloDepth_; // stencil steps from a local cell to the outermost remote cell
    unsigned nGlobal_;
    IndexToTuple i2t_;
 
@@ -74,6 +77,8 @@ inline unsigned  Anatomy::size() const { return cell_.size();}
 inline unsigned  Anatomy::nLocal() const { return cell_.size()-nRemote_;}
 inline unsigned  Anatomy::nRemote() const { return nRemote_;}
 inline unsigned& Anatomy::nRemote()       { return nRemote_;}
+inline unsigned  Anatomy::haloDepth() const { return haloDepth_;}
+inline unsigned& Anatomy::haloDepth()       { return haloDepth_;}
 inline unsigned  Anatomy::nGlobal() const { return nGlobal_;}
 inline unsigned& Anatomy::nGlobal()       { return nGlobal_;}
 
@@ -14,8 +14,11 @@
 #include "BetterTT06.hh"
 #include "object_cc.hh"
 #include "mpiUtils.h"
+#include "reactionJit.hh"
+#include <algorithm>
 #include <cmath>
 #include <cassert>
+#include <cstddef>
 #include <fstream>
 #include <iostream>
 
@@ -195,6 +198,25 @@ static const char* interpName[] = {
       }
 #ifdef USE_CUDA
       reaction->constructKernel();
+#else
+      int jit;
+      objectGet(obj, "jit", jit, "0");
+      if (jit)
+      {
+         string jitCacheDir;
+         objectGet(obj, "jitCacheDir", jitCacheDir, "jitCache");
+         // the compile command is a list of words, e.g. jitCompiler = g++ -O3 -shared -fPIC;
+         vector<string> words;
+         objectGet(obj, "jitCompiler", words);
+         string jitCompiler = ReactionJit::defaultCompiler();
+         if (!words.empty())
+         {
+            jitCompiler = words[0];
+            for (unsigned ii=1; ii<words.size(); ++ii)
+               jitCompiler += " " + words[ii];
+         }
+         reaction->constructJitKernel(jitCacheDir, jitCompiler);
+      }
 #endif
       return reaction;
    }
@@ -1001,8 +1023,6 @@ void ThisReaction::createInterpolants(const double _dt) {
    }
 }
 
-#ifdef USE_CUDA
-
 void generateInterpString(stringstream& ss, const Interpolation& interp, const char* interpVar)
 {
    ss <<
@@ -1043,11 +1063,18 @@ void generateInterpString(stringstream& ss, const Interpolation& interp, const c
       ;
 }
 
-void ThisReaction::constructKernel()
+/** Source for one cell update of the model with the interpolants,
+ *  dt and parameters baked in as constants.  The caller supplies the
+ *  function signature, the expression that locates state _off of
+ *  cell _ii and the code that opens and closes the loop over cells
+ *  (which must define _ii). */
+string ThisReaction::kernelSource(const string& signature,
+                                  const string& stateIndex,
+                                  const string& cellLoopOpen,
+                                  const string& cellLoopClose) const
 {
-
    stringstream ss;
-   ss.precision(16);
+   ss.precision(17);
    ss <<
    "enum StateOffset {\n"
 
@@ -1071,10 +1098,10 @@ void ThisReaction::constructKernel()
    "   s_off,\n"
    "   NUMSTATES\n"
    "};\n"
+   "#define _STATE(_off) (" << stateIndex << ")\n"
    "extern \"C\"\n"
-   "__global__ void BetterTT06_kernel(const int* _indexArray, const double* _Vm, const double* _iStim, double* _dVm, double* _state) {\n"
+   << signature << " {\n"
    "const double _dt = " << __cachedDt << ";\n"
-   "const int _nCells = " << nCells_ << ";\n"
 
    "const double celltype = " << celltype << ";\n"
    "const double g_CaL = " << g_CaL << ";\n"
@@ -1087,29 +1114,28 @@ void ThisReaction::constructKernel()
    "const double g_pCa = " << g_pCa << ";\n"
    "const double g_pK = " << g_pK << ";\n"
    "const double g_to = " << g_to << ";\n"
-   "const int _ii = threadIdx.x + blockIdx.x*blockDim.x;\n"
-   "if (_ii >= _nCells) { return; }\n"
+   << cellLoopOpen <<
    "const double V = _Vm[_indexArray[_ii]];\n"
    "double _ratPoly;\n"
 
-   "const double Ca_SR = _state[_ii+Ca_SR_off*_nCells];\n"
-   "const double Ca_i = _state[_ii+Ca_i_off*_nCells];\n"
-   "const double Ca_ss = _state[_ii+Ca_ss_off*_nCells];\n"
-   "const double K_i = _state[_ii+K_i_off*_nCells];\n"
-   "const double Na_i = _state[_ii+Na_i_off*_nCells];\n"
-   "const double R_prime = _state[_ii+R_prime_off*_nCells];\n"
-   "const double Xr1 = _state[_ii+Xr1_off*_nCells];\n"
-   "const double Xr2 = _state[_ii+Xr2_off*_nCells];\n"
-   "const double Xs = _state[_ii+Xs_off*_nCells];\n"
-   "const double d = _state[_ii+d_off*_nCells];\n"
-   "const double f = _state[_ii+f_off*_nCells];\n"
-   "const double f2 = _state[_ii+f2_off*_nCells];\n"
-   "const double fCass = _state[_ii+fCass_off*_nCells];\n"
-   "const double h = _state[_ii+h_off*_nCells];\n"
-   "const double j = _state[_ii+j_off*_nCells];\n"
-   "const double m = _state[_ii+m_off*_nCells];\n"
-   "const double r = _state[_ii+r_off*_nCells];\n"
-   "const double s = _state[_ii+s_off*_nCells];\n"
+   "const double Ca_SR = _state[_STATE(Ca_SR_off)];\n"
+   "const double Ca_i = _state[_STATE(Ca_i_off)];\n"
+   "const double Ca_ss = _state[_STATE(Ca_ss_off)];\n"
+   "const double K_i = _state[_STATE(K_i_off)];\n"
+   "const double Na_i = _state[_STATE(Na_i_off)];\n"
+   "const double R_prime = _state[_STATE(R_prime_off)];\n"
+   "const double Xr1 = _state[_STATE(Xr1_off)];\n"
+   "const double Xr2 = _state[_STATE(Xr2_off)];\n"
+   "const double Xs = _state[_STATE(Xs_off)];\n"
+   "const double d = _state[_STATE(d_off)];\n"
+   "const double f = _state[_STATE(f_off)];\n"
+   "const double f2 = _state[_STATE(f2_off)];\n"
+   "const double fCass = _state[_STATE(fCass_off)];\n"
+   "const double h = _state[_STATE(h_off)];\n"
+   "const double j = _state[_STATE(j_off)];\n"
+   "const double m = _state[_STATE(m_off)];\n"
+   "const double r = _state[_STATE(r_off)];\n"
+   "const double s = _state[_STATE(s_off)];\n"
    "//get the gate updates (diagonalized exponential integrator)\n"
    "double fCass_inf = 0.4 + 0.6/(400.0*(Ca_ss*Ca_ss) + 1);\n"
    ""; generateInterpString(ss,_interpolant[1], "V"); ss << "\n"
@@ -1276,28 +1302,43 @@ void ThisReaction::constructKernel()
    "   _count++;\n"
    "} while (_count<50);\n"
    "//EDIT_STATE\n"
-   "_state[_ii+Ca_SR_off*_nCells] += _dt*Ca_SR_diff;\n"
-   "_state[_ii+Ca_i_off*_nCells] += _dt*Ca_i_diff;\n"
-   "_state[_ii+Ca_ss_off*_nCells] += _dt*Ca_ss_diff;\n"
-   "_state[_ii+K_i_off*_nCells] += _dt*K_i_diff;\n"
-   "_state[_ii+Na_i_off*_nCells] += _dt*Na_i_diff;\n"
-   "_state[_ii+R_prime_off*_nCells] += _dt*R_prime_diff;\n"
-   "_state[_ii+Xr1_off*_nCells] += _Xr1_RLA*(Xr1+_Xr1_RLB);\n"
-   "_state[_ii+Xr2_off*_nCells] += _Xr2_RLA*(Xr2+_Xr2_RLB);\n"
-   "_state[_ii+Xs_off*_nCells] += _Xs_RLA*(Xs+_Xs_RLB);\n"
-   "_state[_ii+d_off*_nCells] += _d_RLA*(d+_d_RLB);\n"
-   "_state[_ii+f_off*_nCells] += _f_RLA*(f+_f_RLB);\n"
-   "_state[_ii+f2_off*_nCells] += _f2_RLA*(f2+_f2_RLB);\n"
-   "_state[_ii+fCass_off*_nCells] += _fCass_RLA*(fCass+_fCass_RLB);\n"
-   "_state[_ii+h_off*_nCells] += _h_RLA*(h+_h_RLB);\n"
-   "_state[_ii+j_off*_nCells] += _j_RLA*(j+_j_RLB);\n"
-   "_state[_ii+m_off*_nCells] += _m_RLA*(m+_m_RLB);\n"
-   "_state[_ii+r_off*_nCells] += _r_RLA*(r+_r_RLB);\n"
-   "_state[_ii+s_off*_nCells] += _s_RLA*(s+_s_RLB);\n"
+   "_state[_STATE(Ca_SR_off)] += _dt*Ca_SR_diff;\n"
+   "_state[_STATE(Ca_i_off)] += _dt*Ca_i_diff;\n"
+   "_state[_STATE(Ca_ss_off)] += _dt*Ca_ss_diff;\n"
+   "_state[_STATE(K_i_off)] += _dt*K_i_diff;\n"
+   "_state[_STATE(Na_i_off)] += _dt*Na_i_diff;\n"
+   "_state[_STATE(R_prime_off)] += _dt*R_prime_diff;\n"
+   "_state[_STATE(Xr1_off)] += _Xr1_RLA*(Xr1+_Xr1_RLB);\n"
+   "_state[_STATE(Xr2_off)] += _Xr2_RLA*(Xr2+_Xr2_RLB);\n"
+   "_state[_STATE(Xs_off)] += _Xs_RLA*(Xs+_Xs_RLB);\n"
+   "_state[_STATE(d_off)] += _d_RLA*(d+_d_RLB);\n"
+   "_state[_STATE(f_off)] += _f_RLA*(f+_f_RLB);\n"
+   "_state[_STATE(f2_off)] += _f2_RLA*(f2+_f2_RLB);\n"
+   "_state[_STATE(fCass_off)] += _fCass_RLA*(fCass+_fCass_RLB);\n"
+   "_state[_STATE(h_off)] += _h_RLA*(h+_h_RLB);\n"
+   "_state[_STATE(j_off)] += _j_RLA*(j+_j_RLB);\n"
+   "_state[_STATE(m_off)] += _m_RLA*(m+_m_RLB);\n"
+   "_state[_STATE(r_off)] += _r_RLA*(r+_r_RLB);\n"
+   "_state[_STATE(s_off)] += _s_RLA*(s+_s_RLB);\n"
    "_dVm[_indexArray[_ii]] = -Iion_001;\n"
+   << cellLoopClose <<
    "}\n";
 
-   _program_code = ss.str();
+   return ss.str();
+}
+
+#ifdef USE_CUDA
+
+void ThisReaction::constructKernel()
+{
+   stringstream loopOpen;
+   loopOpen <<
+   "const int _nCells = " << nCells_ << ";\n"
+   "const int _ii = threadIdx.x + blockIdx.x*blockDim.x;\n"
+   "if (_ii >= _nCells) { return; }\n";
+   _program_code = kernelSource(
+      "__global__ void BetterTT06_kernel(const int* _indexArray, const double* _Vm, const double* _iStim, double* _dVm, double* _state)",
+      "_ii+_off*_nCells", loopOpen.str(), "");
    //cout << ss.str();
    nvrtcCreateProgram(&_program,
                       _program_code.c_str(),
@@ -1414,24 +1455,129 @@ ThisReaction::~ThisReaction() {
 #define real simdops::float64v
 #define load simdops::load
 
+/** Rush-Larsen factor for nSteps steps.  One step is
+ *  x += A*(x+B) with A = exp(-dt/tau)-1, so nSteps of them with the
+ *  same tau and B give (1+A)^nSteps - 1. */
+static inline real rushLarsenSteps(const real A, int nSteps)
+{
+   real base = 1 + A;
+   real power(1.0);
+   for (; nSteps; nSteps >>= 1)
+   {
+      if (nSteps & 1) { power = power*base; }
+      base = base*base;
+   }
+   return power - 1;
+}
+
 ThisReaction::ThisReaction(const int numPoints, const double __dt)
 : nCells_(numPoints)
 {
    state_.resize((nCells_+width-1)/width);
    __cachedDt = __dt;
+   jitKernel_ = 0;
+   jitHandle_ = 0;
 }
 
-ThisReaction::~ThisReaction() {}
+ThisReaction::~ThisReaction()
+{
+   reactionModuleClose(jitHandle_);
+}
+
+/** Compiles the generated kernel for this host.  The kernel reads the
+ *  state_ array in place, so the state index follows the State struct:
+ *  blocks of width cells with the variables in StateOffset order. */
+void ThisReaction::constructJitKernel(const string& cacheDir, const string& compiler)
+{
+   stringstream stateIndex;
+   stateIndex << "((_ii/" << width << ")*NUMSTATES + _off)*" << width
+              << " + _ii%" << width;
+   string source = "#include <math.h>\n" + kernelSource(
+      "void BetterTT06_cpu(int _begin, int _end, const int* _indexArray, const double* _Vm, const double* _iStim, double* _dVm, double* _state)",
+      stateIndex.str(),
+      "for (int _ii=_begin; _ii<_end; _ii++) {\n",
+      "}\n");
+   jitKernel_ = (JitKernel) ReactionJit::loadKernel(
+      "BetterTT06", source, "BetterTT06_cpu", cacheDir, compiler, jitHandle_);
+   if (jitKernel_ == 0 && getRank(0) == 0)
+      cout << "BetterTT06: using the precompiled kernel" << endl;
+}
 
 void ThisReaction::calc(double _dt,
                 ro_mgarray_ptr<int> ___indexArray,
                 ro_mgarray_ptr<double> ___Vm,
-                ro_mgarray_ptr<double>,
+                ro_mgarray_ptr<double> ___iStim,
                 wo_mgarray_ptr<double> ___dVm)
 {
-   ro_array_ptr<int>    __indexArray = ___indexArray.useOn(CPU);
-   ro_array_ptr<double> __Vm = ___Vm.useOn(CPU);
-   wo_array_ptr<double> __dVm = ___dVm.useOn(CPU);
+   ro_array_ptr<int>    indexArray = ___indexArray.useOn(CPU);
+   ro_array_ptr<double> Vm = ___Vm.useOn(CPU);
+   wo_array_ptr<double> dVm = ___dVm.useOn(CPU);
+   calcTile(_dt, 0, nCells_, indexArray.raw(), Vm.raw(), 0, dVm.raw());
+}
+
+/** The gates, Xr1 through s, are the last variables of State, so
+ *  those of a block are contiguous. */
+static const int nGateValues = (sizeof(State) - offsetof(State, Xr1))/sizeof(double);
+
+void ThisReaction::trackGateRates(bool on)
+{
+   gateRate_.assign(on ? state_.size() : 0, 0.0);
+}
+
+double ThisReaction::maxGateRate(int begin, int end) const
+{
+   double rate = 0;
+   for (int jj=begin/width; jj<(end+width-1)/width; ++jj)
+      rate = std::max(rate, gateRate_[jj]);
+   return rate;
+}
+
+void ThisReaction::calcTile(double _dt, int __begin, int __end,
+                const int* __indexArray,
+                const double* __Vm,
+                const double* __iStim,
+                double* __dVm)
+{
+   if (gateRate_.empty())
+   {
+      integrateTile(_dt, __begin, __end, __indexArray, __Vm, __iStim, __dVm);
+      return;
+   }
+   const int firstBlock = __begin/width;
+   const int endBlock = (__end+width-1)/width;
+   vector<double> oldGates((endBlock-firstBlock)*nGateValues);
+   for (int jj=firstBlock; jj<endBlock; ++jj)
+      copy(state_[jj].Xr1, state_[jj].Xr1+nGateValues,
+           oldGates.begin()+(jj-firstBlock)*nGateValues);
+   integrateTile(_dt, __begin, __end, __indexArray, __Vm, __iStim, __dVm);
+   for (int jj=firstBlock; jj<endBlock; ++jj)
+   {
+      const double* now = state_[jj].Xr1;
+      const double* old = &oldGates[(jj-firstBlock)*nGateValues];
+      double step = 0;
+      for (int kk=0; kk<nGateValues; ++kk)
+         step = std::max(step, std::abs(now[kk]-old[kk]));
+      gateRate_[jj] = step/_dt;
+   }
+}
+
+void ThisReaction::integrateTile(double _dt, int __begin, int __end,
+                const int* __indexArray,
+                const double* __Vm,
+                const double*,
+                double* __dVm)
+{
+
+   // multirate callers pass a whole number of steps; the gate
+   // interpolants (and the JIT kernel) are fitted for one
+   const int __nSteps = int(_dt/__cachedDt + 0.5);
+   assert(__nSteps >= 1 && std::abs(_dt - __nSteps*__cachedDt) <= 1e-9*_dt);
+   if (jitKernel_ && __nSteps == 1)
+   {
+      jitKernel_(__begin, std::min(__end, int(nCells_)), __indexArray,
+                 __Vm, 0, __dVm, (double*) &state_[0]);
+      return;
+   }
 
    //define the constants
    double Cm = 0.185000000000000;
@@ -1472,7 +1618,7 @@ void ThisReaction::calc(double _dt,
    double Na_o = 140;
    double K_mNa = 40;
    double _expensive_functions_040 = sqrt(K_o);
-   for (unsigned __jj=0; __jj<(nCells_+width-1)/width; __jj++)
+   for (unsigned __jj=__begin/width; __jj<(__end+width-1)/width; __jj++)
    {
       const int __ii = __jj*width;
       //set Vm
@@ -1482,7 +1628,7 @@ void ThisReaction::calc(double _dt,
          for (int __kk=0; __kk<width; __kk++)
          {
             __Vm_local[__kk] = __Vm[__indexArray[__ii+cursor]];
-            if (__ii+__kk < nCells_) { cursor++; }
+            if (__ii+__kk+1 < nCells_) { cursor++; }
          }
       }
       const real V = load(&__Vm_local[0]);
@@ -1598,6 +1744,21 @@ void ThisReaction::calc(double _dt,
       real Iion = i_Caitot_001 + i_Kitot_001 + i_Naitot_001;
       real Iion_001 = Iion;
       //Do the markov update (1 step rosenbrock with gauss siedel)
+      if (__nSteps != 1)
+      {
+         _Xr1_RLA = rushLarsenSteps(_Xr1_RLA, __nSteps);
+         _Xr2_RLA = rushLarsenSteps(_Xr2_RLA, __nSteps);
+         _Xs_RLA = rushLarsenSteps(_Xs_RLA, __nSteps);
+         _d_RLA = rushLarsenSteps(_d_RLA, __nSteps);
+         _f_RLA = rushLarsenSteps(_f_RLA, __nSteps);
+         _f2_RLA = rushLarsenSteps(_f2_RLA, __nSteps);
+         _fCass_RLA = rushLarsenSteps(_fCass_RLA, __nSteps);
+         _h_RLA = rushLarsenSteps(_h_RLA, __nSteps);
+         _j_RLA = rushLarsenSteps(_j_RLA, __nSteps);
+         _m_RLA = rushLarsenSteps(_m_RLA, __nSteps);
+         _r_RLA = rushLarsenSteps(_r_RLA, __nSteps);
+         _s_RLA = rushLarsenSteps(_s_RLA, __nSteps);
+      }
       //EDIT_STATE
       Ca_SR += _dt*Ca_SR_diff;
       Ca_i += _dt*Ca_i_diff;
@@ -3,6 +3,7 @@
 #include "object.h"
 #include "reactionFactory.hh"
 #include <vector>
+#include <string>
 #include <sstream>
 
 #ifdef USE_CUDA
@@ -87,8 +88,24 @@ namespace BetterTT06
                 ro_mgarray_ptr<double> Vm_m,
                 ro_mgarray_ptr<double> iStim_m,
                 wo_mgarray_ptr<double> dVm_m);
+#ifndef USE_CUDA
+      bool supportsTiles() const { return true; }
+      int tileAlignment() const { return SIMDOPS_FLOAT64V_WIDTH; }
+      bool supportsMultirate() const { return true; }
+      void trackGateRates(bool on);
+      double maxGateRate(int begin, int end) const;
+      void calcTile(double dt, int begin, int end,
+                    const int* indexArray,
+                    const double* Vm,
+                    const double* iStim,
+                    double* dVm);
+#endif //USE_CUDA
       void initializeMembraneVoltage(ro_mgarray_ptr<int> indexArray, wo_mgarray_ptr<double> Vm);
       virtual ~ThisReaction();
+      std::string kernelSource(const std::string& signature,
+                               const std::string& stateIndex,
+                               const std::string& cellLoopOpen,
+                               const std::string& cellLoopClose) const;
 #ifdef USE_CUDA
       void constructKernel();
 
@@ -100,7 +117,22 @@ namespace BetterTT06
       CUfunction _kernel;
       int blockSize_;
 #else //USE_CUDA
+      void constructJitKernel(const std::string& cacheDir, const std::string& compiler);
+
+      typedef void (*JitKernel)(int begin, int end, const int* indexArray,
+                                const double* Vm, const double* iStim,
+                                double* dVm, double* state);
+      JitKernel jitKernel_;
+      void* jitHandle_; // the object jitKernel_ is in
       std::vector<State, AlignedAllocator<State> > state_;
+      // per block of state_, the gate rate of the last calcTile
+      std::vector<double> gateRate_;
+
+      void integrateTile(double dt, int begin, int end,
+                         const int* indexArray,
+                         const double* Vm,
+                         const double* iStim,
+                         double* dVm);
 #endif
 
       //BGQ_HACKFIX, compiler bug with zero length arrays
@@ -14,6 +14,7 @@
 #include "mpiUtils.h"
 #include "GridPoint.hh"
 #include "AnatomyCell.hh"
+#include "ReactionCost.hh"
 using namespace std;
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -30,7 +31,8 @@ BlockLoadBalancer::~BlockLoadBalancer()
 {
 }
 ////////////////////////////////////////////////////////////////////////////////
-int BlockLoadBalancer::block(vector<AnatomyCell>& cells, double diffCost, int nCols, vector<int>& myCols)
+int BlockLoadBalancer::block(vector<AnatomyCell>& cells, double diffCost, int nCols, vector<int>& myCols,
+                             const ReactionCost& cellCost)
 {
    // cells should contain only the cells with non-zero type indices, distributed
    // in columns of grid points as follows:
@@ -70,13 +72,13 @@ int BlockLoadBalancer::block(vector<AnatomyCell>& cells, double diffCost, int nC
          {
             sort(cells.begin(),cells.end(),AnatomyCell::indLessThan);
 
-            int addcnt = 0;
+            double addcnt = 0;
             GridPoint first(cells[nLocal-nfound].gid_,nx_,ny_,nz_);
             int zmin = first.z;
             int zmax = zmin + zlen;
             for (unsigned ii=nLocal-nfound; ii<nLocal; ++ii)
             {
-               addcnt++;
+               addcnt += cellCost(cells[ii].cellType_);
                GridPoint gpt(cells[ii].gid_,nx_,ny_,nz_);
                if (gpt.z < zmax)
                   cells[ii].dest_ = npes;
@@ -89,7 +91,7 @@ int BlockLoadBalancer::block(vector<AnatomyCell>& cells, double diffCost, int nC
                      zmin = gpt.z;
                      zmax = zmin + zlen;
                      npes++;
-                     addcnt = 1;
+                     addcnt = cellCost(cells[ii].cellType_);
                   }
                   cells[ii].dest_ = npes;
                }
@@ -101,7 +103,7 @@ int BlockLoadBalancer::block(vector<AnatomyCell>& cells, double diffCost, int nC
    return npes;
 }    
 ////////////////////////////////////////////////////////////////////////////////
-double BlockLoadBalancer::costFunction(int nTissue, int height, double a)
+double BlockLoadBalancer::costFunction(double nTissue, int height, double a)
 {
    int dz4 = (height+2)   ;
    if (dz4 % 4  != 0) dz4 += (4-dz4%4);
@@ -6,6 +6,7 @@
 using std::vector;
 
 class AnatomyCell;
+class ReactionCost;
 
 class BlockLoadBalancer {
 
@@ -20,8 +21,9 @@ class BlockLoadBalancer {
 
     BlockLoadBalancer(MPI_Comm comm, int nx, int ny, int nz, int bx, int by, int bz);
     ~BlockLoadBalancer();
-    int block(vector<AnatomyCell>& cells, double diffCost, int nCols, vector<int>& myCols);
-    double costFunction(int nTissue, int height, double a);
+    int block(vector<AnatomyCell>& cells, double diffCost, int nCols, vector<int>& myCols,
+              const ReactionCost& cellCost);
+    double costFunction(double nTissue, int height, double a);
 };
 
 #endif
@@ -83,7 +83,6 @@ CommTable::CommTable(
       _recvIdx[ii] = recvBuf[3*ii+2];
    }
 
-   #ifdef SPI
    //send out the recv offset so that each node knows where to put data 
    for (unsigned ii=0; ii<_sendTask.size(); ++ii)
    {
@@ -123,7 +122,6 @@ CommTable::CommTable(
       _putCntOffset[ii] = sendBuf[4*ii+2];
       _putIdx[ii] = sendBuf[4*ii+3];
    }
-   #endif
 
    MPI_Barrier(_comm);
 
@@ -144,6 +142,32 @@ CommTable::CommTable(
 
 }
 
+CommTable::CommTable(const CommTable& base, int width)
+: _comm(base._comm),
+  _sendTask(base._sendTask), _recvTask(base._recvTask),
+  _putTask(base._putTask),
+  _sendOffset(base._sendOffset), _recvOffset(base._recvOffset),
+  _putOffset(base._putOffset), _putCntOffset(base._putCntOffset),
+  _putIdx(base._putIdx), _recvIdx(base._recvIdx)
+{
+   for (unsigned ii=0; ii<_sendOffset.size(); ++ii)
+      _sendOffset[ii] *= width;
+   for (unsigned ii=0; ii<_recvOffset.size(); ++ii)
+      _recvOffset[ii] *= width;
+   for (unsigned ii=0; ii<_putOffset.size(); ++ii)
+      _putOffset[ii] *= width;
+
+   _offsets = 0;
+   #ifdef SPI
+   _offsets = new int*[5];
+   _offsets[0]=&(_sendOffset[0]);
+   _offsets[1]=&(_putOffset[0]);
+   _offsets[2]=&(_putCntOffset[0]);
+   _offsets[3]=&(_recvOffset[0]);
+   _offsets[4]=&(_recvTask[0]);
+   #endif
+}
+
 void CommTable::dump_put()
 {
   for(int ii=0 ; ii < _putTask.size() ; ++ii )
@@ -173,3 +197,17 @@ vector<int> CommTable::msgSize()
       tmp[ii-1] = _sendOffset[ii] - _sendOffset[ii-1];
    return tmp;
 }
+
+vector<int> CommTable::nodeRanks(MPI_Comm nodeComm) const
+{
+   int nTasks, myRank, nNode;
+   MPI_Comm_size(_comm, &nTasks);
+   MPI_Comm_rank(_comm, &myRank);
+   MPI_Comm_size(nodeComm, &nNode);
+   vector<int> member(nNode);
+   MPI_Allgather(&myRank, 1, MPI_INT, &member[0], 1, MPI_INT, nodeComm);
+   vector<int> rank(nTasks, -1);
+   for (int ii=0; ii<nNode; ++ii)
+      rank[member[ii]] = ii;
+   return rank;
+}
@@ -29,6 +29,16 @@
  *  recv at a time to reduce intermediate storage space.
  */
 
+/** How HaloExchange moves the messages described by a CommTable.
+ *  haloIrecv posts fresh Irecv/Isend pairs every exchange,
+ *  haloPersistent starts requests that are set up once,
+ *  haloNeighbor uses a neighborhood collective on a distributed graph
+ *  communicator, haloRma puts directly into the receive buffers
+ *  of the neighbors through an MPI window, and haloShm copies the
+ *  messages to neighbors on the same node through a shared memory
+ *  window and sends only the rest. */
+enum HaloExchangeMode {haloIrecv, haloPersistent, haloNeighbor, haloRma, haloShm};
+
 class CommTable
 {
   public:
@@ -36,6 +46,9 @@ class CommTable
    CommTable(const std::vector<int>& sendTask,
              const std::vector<int>& sendOffset,
              MPI_Comm comm);
+   /** Same messages, in the same order, as base with every item
+    *  replaced by width items.  Not collective. */
+   CommTable(const CommTable& base, int width);
    ~CommTable();
 
    void dump_put();
@@ -45,6 +58,10 @@ class CommTable
    unsigned nRemote();
    unsigned nNbrs();
    std::vector<int> msgSize(); // nItems in each msg that will be sent
+   /** Rank in nodeComm of every task of _comm, -1 for the tasks that
+    *  aren't in nodeComm.  Splits the neighbors into the ones on the
+    *  node and the rest.  Collective over nodeComm. */
+   std::vector<int> nodeRanks(MPI_Comm nodeComm) const;
 
 
   MPI_Comm  _comm;
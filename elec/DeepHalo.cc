@@ -0,0 +1,148 @@
+#include "DeepHalo.hh"
+
+#include <cassert>
+#include "Simulate.hh"
+#include "Anatomy.hh"
+#include "ReactionManager.hh"
+#include "Diffusion.hh"
+#include "Stimulus.hh"
+#include "stimulusFactory.hh"
+
+using namespace std;
+
+DeepHalo::DeepHalo(Simulate& sim,
+                   const vector<string>& reactionNames,
+                   const vector<string>& stimulusNames)
+: sim_(sim),
+  nLocal_(sim.anatomy_.nLocal()),
+  nRemote_(sim.anatomy_.nRemote())
+{
+   interval_ = sim.anatomy_.haloDepth();
+   assert(interval_ > 1);
+
+   // Every reaction is created even when no ghost uses it so that the
+   // ghost manager knows the same state variables as sim.reaction_.
+   ghostReaction_ = new ReactionManager;
+   for (unsigned ii=0; ii<reactionNames.size(); ++ii)
+      ghostReaction_->addReaction(reactionNames[ii]);
+   vector<int> cellTypes(nRemote_);
+   for (unsigned ii=0; ii<nRemote_; ++ii)
+      cellTypes[ii] = sim.anatomy_.cellType(nLocal_+ii);
+   ghostReaction_->create(sim.dt_, cellTypes, sim.reactionThreads_);
+
+   vector<string> fieldNames;
+   vector<string> fieldUnits;
+   sim.reaction_->getCheckpointInfo(fieldNames, fieldUnits);
+   localHandle_ = sim.reaction_->getVarHandle(fieldNames);
+   ghostHandle_ = ghostReaction_->getVarHandle(fieldNames);
+   recordSize_ = 1 + fieldNames.size();
+
+   // The stimuli only look at the local cells of an anatomy so give
+   // them one where the ghosts are local.
+   {
+      Anatomy ghostAnatomy(sim.anatomy_);
+      vector<AnatomyCell>& cells = ghostAnatomy.cellArray();
+      cells.erase(cells.begin(), cells.begin()+nLocal_);
+      ghostAnatomy.nRemote() = 0;
+      for (unsigned ii=0; ii<stimulusNames.size(); ++ii)
+      {
+         Stimulus* stim = stimulusFactory(stimulusNames[ii], ghostAnatomy);
+         if (stim->nStim() > 0)
+            ghostStimulus_.push_back(stim);
+         else
+            delete stim;
+      }
+   }
+
+   // Same messages as the voltage halo with a whole record per cell,
+   // so record ii of the receive buffer is remote cell ii.
+   commTable_ = new CommTable(*sim.commTable_, recordSize_);
+   assert(commTable_->recvSize() == nRemote_*recordSize_);
+
+   vector<int> sendMap(sim.sendMap_.size()*recordSize_);
+   for (unsigned ii=0; ii<sim.sendMap_.size(); ++ii)
+      for (unsigned jj=0; jj<recordSize_; ++jj)
+         sendMap[ii*recordSize_+jj] = sim.sendMap_[ii]*recordSize_ + jj;
+   exchange_ = new HaloExchange<double>(sendMap, commTable_, sim.haloExchangeMode_);
+
+   iStim_.resize(nRemote_);
+   dVmReaction_.resize(nRemote_);
+   dVmDiffusion_.resize(nRemote_);
+}
+
+DeepHalo::~DeepHalo()
+{
+   delete exchange_;
+   delete commTable_;
+   for (unsigned ii=0; ii<ghostStimulus_.size(); ++ii)
+      delete ghostStimulus_[ii];
+   delete ghostReaction_;
+}
+
+/** Packs Vm and the reaction state of the cells in sim.sendMap_
+ *  straight into the send buffer and starts the exchange. */
+void DeepHalo::startRefresh(ro_mgarray_ptr<double> Vm_managed)
+{
+   ro_array_ptr<double> Vm = Vm_managed.useOn(CPU);
+   rw_array_ptr<double> sendBuf = exchange_->getSendBuf().useOn(CPU);
+   const vector<int>& sendMap = sim_.sendMap_;
+   const ReactionManager& reaction = *sim_.reaction_;
+   const int nSend = sendMap.size();
+   #pragma omp parallel for
+   for (int ii=0; ii<nSend; ++ii)
+   {
+      sendBuf[ii*recordSize_] = Vm[sendMap[ii]];
+      for (unsigned jj=1; jj<recordSize_; ++jj)
+         sendBuf[ii*recordSize_+jj] = reaction.getValue(sendMap[ii], localHandle_[jj-1]);
+   }
+   exchange_->startComm();
+}
+
+void DeepHalo::finishRefresh(rw_mgarray_ptr<double> Vm_managed)
+{
+   exchange_->wait();
+   ro_array_ptr<double> recvBuf = exchange_->getRecvBuf().useOn(CPU);
+   rw_array_ptr<double> Vm = Vm_managed.useOn(CPU);
+   #pragma omp parallel for
+   for (int ii=0; ii<int(nRemote_); ++ii)
+   {
+      Vm[nLocal_+ii] = recvBuf[ii*recordSize_];
+      // Variables the reaction of the cell doesn't have come as NaN
+      // and are ignored by setValue.
+      for (unsigned jj=1; jj<recordSize_; ++jj)
+         ghostReaction_->setValue(ii, ghostHandle_[jj-1], recvBuf[ii*recordSize_+jj]);
+   }
+}
+
+void DeepHalo::stim(double time)
+{
+   {
+      wo_array_ptr<double> iStim = iStim_.writeonly(CPU);
+      for (unsigned ii=0; ii<iStim.size(); ++ii)
+         iStim[ii] = 0;
+   }
+   for (unsigned ii=0; ii<ghostStimulus_.size(); ++ii)
+      ghostStimulus_[ii]->stim(time, iStim_);
+}
+
+void DeepHalo::calcReaction(double dt, ro_mgarray_ptr<double> Vm)
+{
+   ghostReaction_->calc(dt, Vm.slice(nLocal_, nLocal_+nRemote_), iStim_, dVmReaction_);
+}
+
+/** Call after the diffusion has the voltage of the ghosts. */
+void DeepHalo::calcDiffusion()
+{
+   sim_.diffusion_->calcRemote(dVmDiffusion_);
+}
+
+void DeepHalo::integrate(double dt, rw_mgarray_ptr<double> Vm_managed)
+{
+   rw_array_ptr<double> Vm = Vm_managed.useOn(CPU);
+   ro_array_ptr<double> dVmR = dVmReaction_.readonly(CPU);
+   ro_array_ptr<double> dVmD = dVmDiffusion_.readonly(CPU);
+   ro_array_ptr<double> iStim = iStim_.readonly(CPU);
+   #pragma omp parallel for
+   for (int ii=0; ii<int(nRemote_); ++ii)
+      Vm[nLocal_+ii] += dt*(dVmR[ii]+dVmD[ii]+iStim[ii]);
+}
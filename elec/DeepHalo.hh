@@ -0,0 +1,60 @@
+#ifndef DEEP_HALO_HH
+#define DEEP_HALO_HH
+
+#include <string>
+#include <vector>
+#include "lazy_array.hh"
+#include "CommTable.hh"
+#include "HaloExchange.hh"
+
+class Simulate;
+class ReactionManager;
+class Stimulus;
+
+/** Communication avoiding halo for the omp loop.
+ *
+ *  The halo is haloInterval cells deep and the remote (ghost) cells
+ *  are computed redundantly: they have their own reaction state,
+ *  stimulus, diffusion and integration.  Every haloInterval steps the
+ *  owners send the voltage and the full reaction state of the ghosts
+ *  in one exchange.  Each step in between the outermost valid layer
+ *  is lost, so after haloInterval steps only the local cells are
+ *  still exact and the halo has to be refreshed.
+ *
+ *  The refresh sends the state at the start of the step, so start it
+ *  before the local reaction and finish it before the ghost
+ *  reaction. */
+class DeepHalo
+{
+ public:
+   DeepHalo(Simulate& sim,
+            const std::vector<std::string>& reactionNames,
+            const std::vector<std::string>& stimulusNames);
+   ~DeepHalo();
+
+   int interval() const {return interval_;}
+   void startRefresh(ro_mgarray_ptr<double> Vm);
+   void finishRefresh(rw_mgarray_ptr<double> Vm);
+   void stim(double time);
+   void calcReaction(double dt, ro_mgarray_ptr<double> Vm);
+   void calcDiffusion();
+   void integrate(double dt, rw_mgarray_ptr<double> Vm);
+
+ private:
+   Simulate& sim_;
+   int interval_;
+   unsigned nLocal_;
+   unsigned nRemote_;
+   unsigned recordSize_; // Vm and the state variables of one cell
+   ReactionManager* ghostReaction_;
+   std::vector<Stimulus*> ghostStimulus_;
+   std::vector<int> localHandle_;
+   std::vector<int> ghostHandle_;
+   CommTable* commTable_;
+   HaloExchange<double>* exchange_;
+   lazy_array<double> iStim_;
+   lazy_array<double> dVmReaction_;
+   lazy_array<double> dVmDiffusion_;
+};
+
+#endif
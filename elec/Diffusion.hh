@@ -1,6 +1,7 @@
 #ifndef DIFFUSION_HH
 #define DIFFUSION_HH
 
+#include <cassert>
 #include "lazy_array.hh"
 
 /**
@@ -25,6 +26,33 @@ class Diffusion
    virtual void updateRemoteVoltage(ro_mgarray_ptr<double> VmRemote) = 0;
    virtual void calc(rw_mgarray_ptr<double> dVm) = 0;
    virtual void calc_overlap(rw_mgarray_ptr<double> dVm) {};
+   /** calc in two parts so that the omp loop can overlap the first
+    *  with the halo exchange.  calcInterior sets dVm for the local
+    *  cells whose stencil has no remote cell and needs only
+    *  updateLocalVoltage, calcBoundary the rest after
+    *  updateRemoteVoltage.  By default everything is done in
+    *  calcBoundary. */
+   virtual void calcInterior(rw_mgarray_ptr<double> dVm) {}
+   virtual void calcBoundary(rw_mgarray_ptr<double> dVm) {calc(dVm);}
+   /** Advances pure diffusion nSubsteps steps of dt/nSubsteps from the
+    *  current voltage and sets dVm to the effective derivative over dt.
+    *  Needs a halo at least nSubsteps deep.  Only for the omp loop.
+    *  Diffusions that don't return true from supportsSubsteps() only
+    *  take nSubsteps = 1. */
+   virtual bool supportsSubsteps() const { return false; }
+   virtual void calcSubsteps(int nSubsteps, double dt, rw_mgarray_ptr<double> dVm)
+   {
+      assert(nSubsteps == 1);
+      calc(dVm);
+   }
+   /** Sets dVmRemote for the remote cells that have a full stencil
+    *  in a deep halo (the rest to zero), from the voltages of the last
+    *  updateLocalVoltage and updateRemoteVoltage.  Only for the omp
+    *  loop. */
+   virtual void calcRemote(rw_mgarray_ptr<double> dVmRemote)
+   {
+      assert(false);
+   }
    virtual unsigned* blockIndex(){return 0;}
    virtual double* VmBlock(){return 0;}
    virtual double* dVmBlock(){return 0;}
@@ -14,7 +14,8 @@ using namespace std;
  *  may be local cells that are on the outer or inner walls of the
  *  heart.  Such cells will have no remote cells to satisfy their
  *  stencil.  Therefore, the safe bet is to iterate the local cells and
- *  add the stencil size in each direction.
+ *  add the stencil size in each direction.  When the halo is more than
+ *  one layer deep the box must hold haloDepth stencil widths.
  */
 LocalGrid DiffusionUtils::findBoundingBox(const Anatomy& anatomy, bool verbose)
 {
@@ -44,7 +45,7 @@ LocalGrid DiffusionUtils::findBoundingBox(const Anatomy& anatomy, bool verbose)
          zMax = max(zMax, globalTuple.z());
       }
       
-      int stencilSize = 1;
+      int stencilSize = anatomy.haloDepth();
    
       int nx = 2*stencilSize + xMax - xMin + 1;
       int ny = 2*stencilSize + yMax - yMin + 1;
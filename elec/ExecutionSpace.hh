@@ -8,6 +8,11 @@ typedef int ExecutionSpace;
 # define GPU (1)
 # define NUMSPACES (2)
 # define DEFAULT_COMPUTE_SPACE GPU
+#elif defined(USE_HOST_DEVICE)
+// The "GPU" is a separate allocation in host memory.
+# define GPU (1)
+# define NUMSPACES (2)
+# define DEFAULT_COMPUTE_SPACE GPU
 #else
 # define NUMSPACES (1)
 # define DEFAULT_COMPUTE_SPACE CPU
@@ -16,10 +16,11 @@ using namespace std;
 using namespace FGRUtils;
 
 
-FGRDiffusion::FGRDiffusion(const FGRDiffusionParms& parms,
-                           const Anatomy& anatomy,
-                           const ThreadTeam& threadInfo,
-                           const ThreadTeam& reactionThreadInfo)
+template <class WeightType>
+FGRDiffusion<WeightType>::FGRDiffusion(const FGRDiffusionParms& parms,
+                                       const Anatomy& anatomy,
+                                       const ThreadTeam& threadInfo,
+                                       const ThreadTeam& reactionThreadInfo)
 : Diffusion(parms.diffusionScale_),
   nLocal_(anatomy.nLocal()),
   localGrid_(DiffusionUtils::findBoundingBox_simd(anatomy, parms.printBBox_)),
@@ -125,6 +126,8 @@ FGRDiffusion::FGRDiffusion(const FGRDiffusionParms& parms,
 
 //   offsetsTest();
    precomputeCoefficients(anatomy);
+   if (sizeof(WeightType) < sizeof(double) && parms.checkWeightPrecision_)
+      checkWeightPrecision(weight_, blockIndex_, nLocal_, offset_);
    reorder_Coeff();
 
    assert(nz%4 == 0);
@@ -147,7 +150,8 @@ FGRDiffusion::FGRDiffusion(const FGRDiffusionParms& parms,
 
 }
 
-void FGRDiffusion::updateLocalVoltage(ro_mgarray_ptr<double> VmLocal_managed)
+template <class WeightType>
+void FGRDiffusion<WeightType>::updateLocalVoltage(ro_mgarray_ptr<double> VmLocal_managed)
 {
    startTimer(FGR_ArrayLocal2MatrixTimer);
    ro_array_ptr<double> VmLocal = VmLocal_managed.useOn(CPU);
@@ -162,7 +166,8 @@ void FGRDiffusion::updateLocalVoltage(ro_mgarray_ptr<double> VmLocal_managed)
    stopTimer(FGR_ArrayLocal2MatrixTimer);
 }
 
-void FGRDiffusion::updateRemoteVoltage(ro_mgarray_ptr<double> VmRemote_managed)
+template <class WeightType>
+void FGRDiffusion<WeightType>::updateRemoteVoltage(ro_mgarray_ptr<double> VmRemote_managed)
 {
    startTimer(FGR_ArrayRemote2MatrixTimer);
    ro_array_ptr<double> VmRemote = VmRemote_managed.useOn(CPU);
@@ -179,7 +184,8 @@ void FGRDiffusion::updateRemoteVoltage(ro_mgarray_ptr<double> VmRemote_managed)
 }
 
 /** threaded simd version */
-void FGRDiffusion::calc(rw_mgarray_ptr<double> /*dVm_managed*/)
+template <class WeightType>
+void FGRDiffusion<WeightType>::calc(rw_mgarray_ptr<double> /*dVm_managed*/)
 {
    int tid = threadInfo_.teamRank();
 
@@ -202,7 +208,8 @@ void FGRDiffusion::calc(rw_mgarray_ptr<double> /*dVm_managed*/)
  * do stencil operations on remote particles so we shouldn't need
  * tuples.  We can use block indices instead.
  */
-void FGRDiffusion::buildTupleArray(const Anatomy& anatomy)
+template <class WeightType>
+void FGRDiffusion<WeightType>::buildTupleArray(const Anatomy& anatomy)
 {
    localTuple_.resize(anatomy.nLocal(), Tuple(0,0,0));
    for (unsigned ii=0; ii<anatomy.nLocal(); ++ii)
@@ -218,7 +225,8 @@ void FGRDiffusion::buildTupleArray(const Anatomy& anatomy)
    }
 }
 
-void FGRDiffusion::buildBlockIndex(const Anatomy& anatomy)
+template <class WeightType>
+void FGRDiffusion<WeightType>::buildBlockIndex(const Anatomy& anatomy)
 {
    blockIndex_.resize(anatomy.size());
    for (unsigned ii=0; ii<anatomy.size(); ++ii)
@@ -325,7 +333,8 @@ void FGRDiffusion::buildBlockIndex(const Anatomy& anatomy)
 //}
 
 
-void FGRDiffusion::precomputeCoefficients(const Anatomy& anatomy)
+template <class WeightType>
+void FGRDiffusion<WeightType>::precomputeCoefficients(const Anatomy& anatomy)
 {
    unsigned nx = localGrid_.nx();
    unsigned ny = localGrid_.ny();
@@ -378,14 +387,15 @@ void FGRDiffusion::precomputeCoefficients(const Anatomy& anatomy)
       for (unsigned ii=1; ii<19; ++ii)
       {
          sum += weight_(ib).A[ii];
-         A0_(ib) -= weight_(ib).A[ii];
+         A0_(ib) -= WeightType(weight_(ib).A[ii]); // keep the stored row sum zero
       }
       assert(abs(sum) < weightSumTolerance);
    }
 //   printAllWeights(tissueBlk);
 }
 
-void FGRDiffusion::mkTissueArray(
+template <class WeightType>
+void FGRDiffusion<WeightType>::mkTissueArray(
    const Array3d<int>& tissueBlk, int ib, int* tissue)
 {
    for (unsigned ii=0; ii<19; ++ii)
@@ -393,8 +403,9 @@ void FGRDiffusion::mkTissueArray(
 }
 
 
-Vector FGRDiffusion::f1(int ib, int iFace, const Vector& h,
-                        const Array3d<SymmetricTensor>& sigmaBlk)
+template <class WeightType>
+Vector FGRDiffusion<WeightType>::f1(int ib, int iFace, const Vector& h,
+                                    const Array3d<SymmetricTensor>& sigmaBlk)
 {
    SymmetricTensor
       sigma = (sigmaBlk(ib) + sigmaBlk(ib+faceNbrOffset_[iFace])) / 2.0;
@@ -427,7 +438,8 @@ Vector FGRDiffusion::f1(int ib, int iFace, const Vector& h,
 }
 
 
-void FGRDiffusion::printAllWeights(const Array3d<int>& tissue)
+template <class WeightType>
+void FGRDiffusion<WeightType>::printAllWeights(const Array3d<int>& tissue)
 {
    for (unsigned ii=0; ii<localTuple_.size(); ++ii)
    {
@@ -465,7 +477,8 @@ void FGRDiffusion::printAllWeights(const Array3d<int>& tissue)
    }
 }
 
-void FGRDiffusion::reorder_Coeff()
+template <class WeightType>
+void FGRDiffusion<WeightType>::reorder_Coeff()
 {
   uint32_t idx=0,ll,ii,jj,kk;
   const uint32_t Nx2 = localGrid_.nx();
@@ -496,7 +509,7 @@ void FGRDiffusion::reorder_Coeff()
     diffCoefT2_(xx,yy,4*20*zp4 + 4* 3 + zp%4 ) =weight_(xx,yy,zz).A[ZPP];
     diffCoefT2_(xx,yy,4*20*zp4 + 4* 6 + zp%4 ) =weight_(xx,yy,zz).A[PZP];
                                  
-    *((double*)&(diffCoefT2_(xx,yy,4*20*zz4 + 4* 4 + (zz%4)*2))) = A0_(xx,yy,zz);
+    *((double*)&(diffCoefT2_(xx,yy,4*20*zz4 + 4* 4 + (zz%4)*sizeof(double)/sizeof(WeightType)))) = A0_(xx,yy,zz);
 //    diffCoefT2_(xx,yy,4*20*zz4 + 4* 5 + zz%4 ) =weight_(xx,yy,zz).A[ZZZ];
     diffCoefT2_(xx,yy,4*20*zz4 + 4* 7 + zz%4 ) =weight_(xx,yy,zz).A[PMZ];
     diffCoefT2_(xx,yy,4*20*zz4 + 4* 8 + zz%4 ) =weight_(xx,yy,zz).A[MMZ];
@@ -520,8 +533,9 @@ void FGRDiffusion::reorder_Coeff()
 
 // simdiazed version
 // 'start' cannot be in the middle. 'start' must point to (n,m,0). 
+template <class WeightType>
 void
-FGRDiffusion::FGRDiff_simd_thread(const uint32_t bx,const int32_t ex, Array3d<double>* VmTmp, double* out0)
+FGRDiffusion<WeightType>::FGRDiff_simd_thread(const uint32_t bx,const int32_t ex, Array3d<double>* VmTmp, double* out0)
 {
   int ii;
 
@@ -599,32 +613,32 @@ FGRDiffusion::FGRDiff_simd_thread(const uint32_t bx,const int32_t ex, Array3d<do
         my_xp1_ym1_z  =vec_ld(0,    phi_xp1_ym1_z );
  
     #define calc_zp(x) \
-        x =  vec_madd(vec_ld(4*6*WTSZ,simd_diff_)  , my_xp1_y_z, \
-             vec_madd(vec_ld(4*3*WTSZ,simd_diff_)  , my_x_yp1_z, \
-             vec_madd(vec_ld(4*2*WTSZ,simd_diff_)  , my_xm1_y_z, \
-             vec_madd(vec_ld(4*1*WTSZ,simd_diff_)  , my_x_ym1_z, \
-             vec_mul( vec_ld(4*0*WTSZ,simd_diff_)  , my_x_y_z)))));
+        x =  vec_madd(vec_ld(4*6*sizeof(WeightType),simd_diff_)  , my_xp1_y_z, \
+             vec_madd(vec_ld(4*3*sizeof(WeightType),simd_diff_)  , my_x_yp1_z, \
+             vec_madd(vec_ld(4*2*sizeof(WeightType),simd_diff_)  , my_xm1_y_z, \
+             vec_madd(vec_ld(4*1*sizeof(WeightType),simd_diff_)  , my_x_ym1_z, \
+             vec_mul( vec_ld(4*0*sizeof(WeightType),simd_diff_)  , my_x_y_z)))));
  
     #define calc_zz(x) \
-        double_vec = vec_ld(4*4*WTSZ,(double*)simd_diff_); \
-        x = vec_madd( vec_ld(4*14*WTSZ,simd_diff_)  , my_xp1_y_z, \
-            vec_madd( vec_ld(4*13*WTSZ,simd_diff_)  , my_x_yp1_z, \
-            vec_madd( vec_ld(4*12*WTSZ,simd_diff_)  , my_xm1_y_z, \
-            vec_madd( vec_ld(4*11*WTSZ,simd_diff_)  , my_x_ym1_z, \
-            vec_madd( vec_ld(4*10*WTSZ,simd_diff_)  , my_xp1_yp1_z, \
-            vec_madd( vec_ld(4*9*WTSZ,simd_diff_)  , my_xm1_yp1_z, \
-            vec_madd( vec_ld(4*8*WTSZ,simd_diff_)  , my_xm1_ym1_z, \
-            vec_madd( vec_ld(4*7*WTSZ,simd_diff_)  , my_xp1_ym1_z, \
+        double_vec = vec_ld(4*4*sizeof(WeightType),(double*)simd_diff_); \
+        x = vec_madd( vec_ld(4*14*sizeof(WeightType),simd_diff_)  , my_xp1_y_z, \
+            vec_madd( vec_ld(4*13*sizeof(WeightType),simd_diff_)  , my_x_yp1_z, \
+            vec_madd( vec_ld(4*12*sizeof(WeightType),simd_diff_)  , my_xm1_y_z, \
+            vec_madd( vec_ld(4*11*sizeof(WeightType),simd_diff_)  , my_x_ym1_z, \
+            vec_madd( vec_ld(4*10*sizeof(WeightType),simd_diff_)  , my_xp1_yp1_z, \
+            vec_madd( vec_ld(4*9*sizeof(WeightType),simd_diff_)  , my_xm1_yp1_z, \
+            vec_madd( vec_ld(4*8*sizeof(WeightType),simd_diff_)  , my_xm1_ym1_z, \
+            vec_madd( vec_ld(4*7*sizeof(WeightType),simd_diff_)  , my_xp1_ym1_z, \
             vec_mul (double_vec  , my_x_y_z)))))))));
-//            vec_mul ( vec_ld(4*5*WTSZ,(double*)simd_diff_)  , my_x_y_z)))))))));
-            //vec_mul ( vec_ld(4*5*WTSZ,simd_diff_)  , my_x_y_z)))))))));
+//            vec_mul ( vec_ld(4*5*sizeof(WeightType),(double*)simd_diff_)  , my_x_y_z)))))))));
+            //vec_mul ( vec_ld(4*5*sizeof(WeightType),simd_diff_)  , my_x_y_z)))))))));
  
     #define calc_zm(x) \
-        x = vec_madd( vec_ld(4*19*WTSZ,simd_diff_)  , my_xp1_y_z, \
-            vec_madd( vec_ld(4*18*WTSZ,simd_diff_)  , my_x_yp1_z, \
-            vec_madd( vec_ld(4*17*WTSZ,simd_diff_)  , my_xm1_y_z, \
-            vec_madd( vec_ld(4*16*WTSZ,simd_diff_)  , my_x_ym1_z, \
-            vec_mul ( vec_ld(4*15*WTSZ,simd_diff_)  , my_x_y_z)))));
+        x = vec_madd( vec_ld(4*19*sizeof(WeightType),simd_diff_)  , my_xp1_y_z, \
+            vec_madd( vec_ld(4*18*sizeof(WeightType),simd_diff_)  , my_x_yp1_z, \
+            vec_madd( vec_ld(4*17*sizeof(WeightType),simd_diff_)  , my_xm1_y_z, \
+            vec_madd( vec_ld(4*16*sizeof(WeightType),simd_diff_)  , my_x_ym1_z, \
+            vec_mul ( vec_ld(4*15*sizeof(WeightType),simd_diff_)  , my_x_y_z)))));
  
     #define shift_pointers \
             phi_xp1_y_z   +=4; \
@@ -680,4 +694,5 @@ FGRDiffusion::FGRDiff_simd_thread(const uint32_t bx,const int32_t ex, Array3d<do
   }
 }
 
-
+template class FGRDiffusion<float>;
+template class FGRDiffusion<double>;
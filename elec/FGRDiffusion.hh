@@ -13,6 +13,7 @@ class ThreadTeam;
 class L2_Barrier_t;
 class L2_BarrierHandle_t;
 
+template <class WeightType>
 class FGRDiffusion : public Diffusion
 {
  public:
@@ -5,17 +5,27 @@
 #include "Vector.hh"
 #include <algorithm>
 #include <cstdio>
+#include <map>
 #include "PerformanceTimers.hh"
 
 using namespace PerformanceTimers;
 using namespace std;
 using namespace FGRUtils;
 
-FGRDiffusionOMP::FGRDiffusionOMP(const FGRDiffusionParms& parms,
-                                 const Anatomy& anatomy)
+namespace
+{
+   // The neighbor across each face in the order used by f1 and f2.
+   const int faceNbr[6] = {MZZ, ZMZ, PZZ, ZPZ, ZZM, ZZP};
+}
+
+template <class WeightType>
+FGRDiffusionOMP<WeightType>::FGRDiffusionOMP(const FGRDiffusionParms& parms,
+                                             const Anatomy& anatomy)
 : Diffusion(parms.diffusionScale_),
   nLocal_(anatomy.nLocal()),
   nRemote_(anatomy.nRemote()),
+  haloDepth_(anatomy.haloDepth()),
+  bricks_(parms.sparseBricks_),
   localGrid_(DiffusionUtils::findBoundingBox(anatomy, parms.printBBox_))
 {
 
@@ -33,8 +43,14 @@ FGRDiffusionOMP::FGRDiffusionOMP(const FGRDiffusionParms& parms,
    }
    // This has been a test
 
+   if (bricks_)
+   {
+      buildBricks(anatomy);
+      nx = nBrickSlots_;
+      ny = 1;
+      nz = 64;
+   }
    A0_.resize(nx, ny, nz);
-   weight_.resize(nx, ny, nz);
    VmBlock_.resize(nx, ny, nz);
 
    buildTupleArray(anatomy);
@@ -61,18 +77,16 @@ FGRDiffusionOMP::FGRDiffusionOMP(const FGRDiffusionParms& parms,
    offset_[MZM] = VmBlock_.tupleToIndex(0, 1, 0) - base;
    offset_[PZM] = VmBlock_.tupleToIndex(2, 1, 0) - base;
 
-   faceNbrOffset_[0] = offset_[MZZ];
-   faceNbrOffset_[1] = offset_[ZMZ];
-   faceNbrOffset_[2] = offset_[PZZ];
-   faceNbrOffset_[3] = offset_[ZPZ];
-   faceNbrOffset_[4] = offset_[ZZM];
-   faceNbrOffset_[5] = offset_[ZZP];
-
-   precomputeCoefficients(anatomy);
+   buildHaloLevel(anatomy);
+   buildBoundaryCells();
+   precomputeCoefficients(anatomy, parms);
+   if (haloDepth_ > 1)
+      buildTemporalTiles(anatomy, parms.temporalTileWidth_);
 }
 
 
-void FGRDiffusionOMP::updateLocalVoltage(ro_mgarray_ptr<double> VmLocal_managed)
+template <class WeightType>
+void FGRDiffusionOMP<WeightType>::updateLocalVoltage(ro_mgarray_ptr<double> VmLocal_managed)
 {
    ro_array_ptr<double> VmLocal = VmLocal_managed.useOn(CPU);
 #pragma omp parallel
@@ -88,7 +102,8 @@ void FGRDiffusionOMP::updateLocalVoltage(ro_mgarray_ptr<double> VmLocal_managed)
    }
 }
 
-void FGRDiffusionOMP::updateRemoteVoltage(ro_mgarray_ptr<double> VmRemote_managed)
+template <class WeightType>
+void FGRDiffusionOMP<WeightType>::updateRemoteVoltage(ro_mgarray_ptr<double> VmRemote_managed)
 {
    ro_array_ptr<double> VmRemote = VmRemote_managed.useOn(CPU);
 #pragma omp parallel
@@ -106,16 +121,46 @@ void FGRDiffusionOMP::updateRemoteVoltage(ro_mgarray_ptr<double> VmRemote_manage
 }
 
 
-void FGRDiffusionOMP::calc(rw_mgarray_ptr<double> dVm_managed)
+template <class WeightType>
+void FGRDiffusionOMP<WeightType>::calc(rw_mgarray_ptr<double> dVm_managed)
 {
    rw_array_ptr<double> dVm = dVm_managed.useOn(CPU);
-   int nCells = dVm.size();
+   calcCells(dVm, 0, dVm.size());
+}
+
+template <class WeightType>
+void FGRDiffusionOMP<WeightType>::calcInterior(rw_mgarray_ptr<double> dVm_managed)
+{
+   rw_array_ptr<double> dVm = dVm_managed.useOn(CPU);
+   assert(dVm.size() == nLocal_);
+   calcCells(dVm, interiorCell_.data(), interiorCell_.size());
+}
+
+template <class WeightType>
+void FGRDiffusionOMP<WeightType>::calcBoundary(rw_mgarray_ptr<double> dVm_managed)
+{
+   rw_array_ptr<double> dVm = dVm_managed.useOn(CPU);
+   assert(dVm.size() == nLocal_);
+   calcCells(dVm, boundaryCell_.data(), boundaryCell_.size());
+}
+
+/** Sets dVm of cell[0] to cell[nCells-1], or of cells 0 to nCells-1
+ *  when cell is null. */
+template <class WeightType>
+void FGRDiffusionOMP<WeightType>::calcCells(rw_array_ptr<double> dVm, const int* cell, int nCells)
+{
+   if (bricks_ || ! stencilTable_.empty())
+   {
+      calcSparse(dVm, cell, nCells);
+      return;
+   }
 #pragma omp parallel
    {// parallel section to contain timer start/stop
       startTimer(FGR_StencilTimer);
       # pragma omp for nowait
-      for (int iCell=0; iCell<nCells; ++iCell)
+      for (int kk=0; kk<nCells; ++kk)
       {
+         int iCell = cell ? cell[kk] : kk;
          int ib = blockIndex_[iCell];
          
          double* phi = & (VmBlock_(ib));
@@ -130,13 +175,294 @@ void FGRDiffusionOMP::calc(rw_mgarray_ptr<double> dVm_managed)
    } // parallel section
 }
 
+/** Same as calc for compressed weights and/or sparse bricks.  With
+ *  compressed weights cells with the common stencil (index 0) don't
+ *  load any weights. */
+template <class WeightType>
+void FGRDiffusionOMP<WeightType>::calcSparse(rw_array_ptr<double> dVm, const int* cell, int nCells)
+{
+   const bool compressed = ! stencilTable_.empty();
+   const double* Vm = VmBlock_.cBlock();
+#pragma omp parallel
+   {// parallel section to contain timer start/stop
+      startTimer(FGR_StencilTimer);
+      DiffWeightT<WeightType> common;
+      double commonA0 = 0.0;
+      if (compressed)
+      {
+         common = stencilTable_[0];
+         commonA0 = stencilA0_[0];
+      }
+      # pragma omp for nowait
+      for (int kk=0; kk<nCells; ++kk)
+      {
+         int iCell = cell ? cell[kk] : kk;
+         int ib = blockIndex_[iCell];
+         const WeightType* A;
+         double A0;
+         if (! compressed)
+         {
+            A = weight_(ib).A;
+            A0 = A0_(ib);
+         }
+         else if (stencilIndex_(ib) == 0)
+         {
+            A = common.A;
+            A0 = commonA0;
+         }
+         else
+         {
+            A = stencilTable_[stencilIndex_(ib)].A;
+            A0 = stencilA0_[stencilIndex_(ib)];
+         }
+         double tmp;
+         if (bricks_)
+            tmp = stencilBrick(Vm, ib, A0, A);
+         else
+            tmp = stencil(Vm+ib, A0, A);
+         dVm[iCell] = tmp*diffusionScale_;
+      }
+      stopTimer(FGR_StencilTimer);
+   } // parallel section
+}
+
+/** Same stencil as calc for the remote cells of a deep halo.  The
+ *  outermost layer has no weights and gets zero. */
+template <class WeightType>
+void FGRDiffusionOMP<WeightType>::calcRemote(rw_mgarray_ptr<double> dVm_managed)
+{
+   rw_array_ptr<double> dVm = dVm_managed.useOn(CPU);
+   assert(dVm.size() == nRemote_);
+   const bool compressed = ! stencilTable_.empty();
+   const double* Vm = VmBlock_.cBlock();
+#pragma omp parallel
+   {// parallel section to contain timer start/stop
+      startTimer(FGR_StencilTimer);
+      # pragma omp for nowait
+      for (int ii=0; ii<nRemote_; ++ii)
+      {
+         int iCell = nLocal_ + ii;
+         if (haloLevel_[iCell] >= haloDepth_)
+         {
+            dVm[ii] = 0;
+            continue;
+         }
+         int ib = blockIndex_[iCell];
+         const WeightType* A;
+         double A0;
+         if (! compressed)
+         {
+            A = weight_(ib).A;
+            A0 = A0_(ib);
+         }
+         else
+         {
+            A = stencilTable_[stencilIndex_(ib)].A;
+            A0 = stencilA0_[stencilIndex_(ib)];
+         }
+         double tmp;
+         if (bricks_)
+            tmp = stencilBrick(Vm, ib, A0, A);
+         else
+            tmp = stencil(Vm+ib, A0, A);
+         dVm[ii] = tmp*diffusionScale_;
+      }
+      stopTimer(FGR_StencilTimer);
+   } // parallel section
+}
+
+
+
+/** Temporally tiled diffusion substeps.  The block is cut into tiles
+ *  of x-planes.  Substep s of tile t is computed in wave t+s-1 so all
+ *  substeps of a tile are done while its planes are still in cache.
+ *  Substep s reads from the buffer written by substep s-1.  Since tile
+ *  t+1 has already reached substep s-1 when tile t is at substep s it
+ *  is safe to ping-pong between two scratch buffers.
+ *
+ *  Each substep consumes one layer of the halo.  At substep s only the
+ *  cells within nSubsteps-s stencil steps of a local cell are updated.
+ *  Their neighbors were all updated in substep s-1.
+ */
+template <class WeightType>
+void FGRDiffusionOMP<WeightType>::calcSubsteps(int nSubsteps, double dt, rw_mgarray_ptr<double> dVm_managed)
+{
+   if (nSubsteps == 1)
+   {
+      calc(dVm_managed);
+      return;
+   }
+   assert(nSubsteps <= haloDepth_);
+   rw_array_ptr<double> dVm = dVm_managed.useOn(CPU);
+   const double scale = diffusionScale_*dt/nSubsteps;
+   const int nTiles = tileBegin_.size()-1;
+   const double* Vm0 = VmBlock_.cBlock();
+   double* scratch[2] = {VmSubstep_[0].cBlock(), VmSubstep_[1].cBlock()};
+   const double* VmFinal = scratch[nSubsteps%2];
+#pragma omp parallel
+   {// parallel section to contain timer start/stop
+      startTimer(FGR_StencilTimer);
+      const bool compressed = ! stencilTable_.empty();
+      DiffWeightT<WeightType> common;
+      double commonA0 = 0.0;
+      if (compressed)
+      {
+         common = stencilTable_[0];
+         commonA0 = stencilA0_[0];
+      }
+      for (int iWave=0; iWave<nTiles+nSubsteps-1; ++iWave)
+      {
+         for (int iStep=1; iStep<=nSubsteps; ++iStep)
+         {
+            int iTile = iWave - (iStep-1);
+            if (iTile < 0 || iTile >= nTiles)
+               continue;
+            const double* in = (iStep == 1) ? Vm0 : scratch[(iStep-1)%2];
+            double* out = scratch[iStep%2];
+            int begin = tileBegin_[iTile];
+            int end = tileLevelEnd_[iTile*haloDepth_ + nSubsteps-iStep];
+            #pragma omp for
+            for (int ii=begin; ii<end; ++ii)
+            {
+               int ib = tileCell_[ii];
+               const WeightType* A;
+               double A0;
+               if (! compressed)
+               {
+                  A = weight_(ib).A;
+                  A0 = A0_(ib);
+               }
+               else if (stencilIndex_(ib) == 0)
+               {
+                  A = common.A;
+                  A0 = commonA0;
+               }
+               else
+               {
+                  A = stencilTable_[stencilIndex_(ib)].A;
+                  A0 = stencilA0_[stencilIndex_(ib)];
+               }
+               double tmp;
+               if (bricks_)
+                  tmp = stencilBrick(in, ib, A0, A);
+               else
+                  tmp = stencil(in+ib, A0, A);
+               out[ib] = in[ib] + scale*tmp;
+            }
+         }
+      }
+      #pragma omp for nowait
+      for (int iCell=0; iCell<nLocal_; ++iCell)
+      {
+         int ib = blockIndex_[iCell];
+         dVm[iCell] = (VmFinal[ib] - Vm0[ib])/dt;
+      }
+      stopTimer(FGR_StencilTimer);
+   } // parallel section
+}
+
+/** haloLevel_ is the number of stencil steps from the nearest local
+ *  cell: 0 for local cells, 1 for the usual one cell halo and up to
+ *  haloDepth_ for a deep halo. */
+template <class WeightType>
+void FGRDiffusionOMP<WeightType>::buildHaloLevel(const Anatomy& anatomy)
+{
+   const int notACell = -1;
+   Array3d<int> levelBlk(VmBlock_.nx(), VmBlock_.ny(), VmBlock_.nz(), notACell);
+   for (unsigned ii=0; ii<anatomy.size(); ++ii)
+      levelBlk(blockIndex_[ii]) = (ii < nLocal_) ? 0 : haloDepth_;
+
+   // Only cells inside the outermost layer have a full stencil in the
+   // block, so stop one layer short.  Whatever is left is the outer
+   // layer.
+   for (int level=1; level<haloDepth_; ++level)
+   {
+      for (unsigned ii=0; ii<anatomy.size(); ++ii)
+      {
+         unsigned ib = blockIndex_[ii];
+         if (levelBlk(ib) != level-1)
+            continue;
+         for (unsigned jj=1; jj<19; ++jj)
+         {
+            int& nbrLevel = levelBlk(nbrIndex(ib, jj));
+            if (nbrLevel > level)
+               nbrLevel = level;
+         }
+      }
+   }
+
+   haloLevel_.resize(anatomy.size());
+   for (unsigned ii=0; ii<anatomy.size(); ++ii)
+      haloLevel_[ii] = levelBlk(blockIndex_[ii]);
+}
+
+/** Splits the local cells for calcInterior and calcBoundary, like the
+ *  slabIndex of FGRDiffusionOverlap but for any shape of domain: a
+ *  cell is on the boundary when any of its 18 neighbors is remote. */
+template <class WeightType>
+void FGRDiffusionOMP<WeightType>::buildBoundaryCells()
+{
+   Array3d<char> remoteBlk(VmBlock_.nx(), VmBlock_.ny(), VmBlock_.nz(), 0);
+   for (unsigned ii=nLocal_; ii<blockIndex_.size(); ++ii)
+      remoteBlk(blockIndex_[ii]) = 1;
+
+   interiorCell_.clear();
+   boundaryCell_.clear();
+   for (int ii=0; ii<nLocal_; ++ii)
+   {
+      bool boundary = false;
+      for (unsigned jj=1; jj<19 && !boundary; ++jj)
+         boundary = remoteBlk(nbrIndex(blockIndex_[ii], jj));
+      if (boundary)
+         boundaryCell_.push_back(ii);
+      else
+         interiorCell_.push_back(ii);
+   }
+}
+
+/** Groups the cells that are ever stepped (haloLevel_ < haloDepth_)
+ *  by tile and then by level so that the cells to update at any
+ *  substep are a contiguous range of each tile.  Within a level cells
+ *  are in block order. */
+template <class WeightType>
+void FGRDiffusionOMP<WeightType>::buildTemporalTiles(const Anatomy& anatomy, int tileWidth)
+{
+   assert(tileWidth > 0);
+   int nTiles = (localGrid_.nx() + tileWidth - 1) / tileWidth;
+   vector<vector<unsigned> > bucket(nTiles*haloDepth_);
+   for (unsigned ii=0; ii<anatomy.size(); ++ii)
+   {
+      if (haloLevel_[ii] >= haloDepth_)
+         continue;
+      int iTile = localGrid_.localTuple(anatomy.globalTuple(ii)).x() / tileWidth;
+      bucket[iTile*haloDepth_ + haloLevel_[ii]].push_back(blockIndex_[ii]);
+   }
 
+   tileCell_.clear();
+   tileBegin_.assign(1, 0);
+   tileLevelEnd_.resize(bucket.size());
+   for (unsigned ii=0; ii<bucket.size(); ++ii)
+   {
+      sort(bucket[ii].begin(), bucket[ii].end());
+      tileCell_.insert(tileCell_.end(), bucket[ii].begin(), bucket[ii].end());
+      tileLevelEnd_[ii] = tileCell_.size();
+      if ((ii+1) % haloDepth_ == 0)
+         tileBegin_.push_back(tileCell_.size());
+   }
+
+   unsigned nx = VmBlock_.nx();
+   unsigned ny = VmBlock_.ny();
+   unsigned nz = VmBlock_.nz();
+   VmSubstep_[0].resize(nx, ny, nz, 0.0);
+   VmSubstep_[1].resize(nx, ny, nz, 0.0);
+}
 
 /** We're building the localTuple array only for local cells.  We can't
  * do stencil operations on remote particles so we shouldn't need
  * tuples.  We can use block indices instead.
  */
-void FGRDiffusionOMP::buildTupleArray(const Anatomy& anatomy)
+template <class WeightType>
+void FGRDiffusionOMP<WeightType>::buildTupleArray(const Anatomy& anatomy)
 {
    localTuple_.resize(anatomy.nLocal(), Tuple(0,0,0));
    for (unsigned ii=0; ii<anatomy.nLocal(); ++ii)
@@ -152,22 +478,98 @@ void FGRDiffusionOMP::buildTupleArray(const Anatomy& anatomy)
    }
 }
 
-void FGRDiffusionOMP::buildBlockIndex(const Anatomy& anatomy)
+template <class WeightType>
+void FGRDiffusionOMP<WeightType>::buildBlockIndex(const Anatomy& anatomy)
 {
    blockIndex_.resize(anatomy.size());
    for (unsigned ii=0; ii<anatomy.size(); ++ii)
    {
       Tuple globalTuple = anatomy.globalTuple(ii);
       Tuple ll = localGrid_.localTuple(globalTuple);
-      blockIndex_[ii] = VmBlock_.tupleToIndex(ll.x(), ll.y(), ll.z());
+      if (bricks_)
+         blockIndex_[ii] = brickIndex(ll.x(), ll.y(), ll.z());
+      else
+         blockIndex_[ii] = VmBlock_.tupleToIndex(ll.x(), ll.y(), ll.z());
    }
 }
 
-void FGRDiffusionOMP::precomputeCoefficients(const Anatomy& anatomy)
+/** Sparse brick layout (sparseBricks = 1).  The bounding box is cut
+ *  into 4x4x4 bricks and only the bricks that hold anatomy cells are
+ *  stored, in brick order.  Slot 0 is a brick of zeros that stands in
+ *  for every empty brick, so stencils never need to test for one.
+ *  The block index of a cell is 64*slot + 16*x + 4*y + z with x, y, z
+ *  its position within the brick.  brickNbr_ holds the base index of
+ *  the 27 bricks around each slot.  brickStencil_ resolves neighbor
+ *  iNbr of each of the 64 cells of a brick once, as 64 times the
+ *  entry of brickNbr_ that holds it plus its position in that brick,
+ *  so the stencil only adds a row of brickNbr_ to it. */
+template <class WeightType>
+void FGRDiffusionOMP<WeightType>::buildBricks(const Anatomy& anatomy)
 {
-   unsigned nx = localGrid_.nx();
-   unsigned ny = localGrid_.ny();
-   unsigned nz = localGrid_.nz();
+   nBricks_[0] = (localGrid_.nx()+3)/4;
+   nBricks_[1] = (localGrid_.ny()+3)/4;
+   nBricks_[2] = (localGrid_.nz()+3)/4;
+   brickSlot_.assign(nBricks_[0]*nBricks_[1]*nBricks_[2], 0);
+   for (unsigned ii=0; ii<anatomy.size(); ++ii)
+   {
+      Tuple ll = localGrid_.localTuple(anatomy.globalTuple(ii));
+      brickSlot_[(ll.x()/4*nBricks_[1] + ll.y()/4)*nBricks_[2] + ll.z()/4] = 1;
+   }
+   nBrickSlots_ = 1;
+   for (unsigned ii=0; ii<brickSlot_.size(); ++ii)
+      if (brickSlot_[ii] != 0)
+         brickSlot_[ii] = nBrickSlots_++;
+
+   brickNbr_.assign(27*nBrickSlots_, 0);
+   for (int bx=0; bx<nBricks_[0]; ++bx)
+      for (int by=0; by<nBricks_[1]; ++by)
+         for (int bz=0; bz<nBricks_[2]; ++bz)
+         {
+            int slot = brickSlot_[(bx*nBricks_[1] + by)*nBricks_[2] + bz];
+            if (slot == 0)
+               continue;
+            for (int dx=-1; dx<=1; ++dx)
+               for (int dy=-1; dy<=1; ++dy)
+                  for (int dz=-1; dz<=1; ++dz)
+                  {
+                     int nx = bx+dx, ny = by+dy, nz = bz+dz;
+                     if (nx < 0 || nx >= nBricks_[0] ||
+                         ny < 0 || ny >= nBricks_[1] ||
+                         nz < 0 || nz >= nBricks_[2])
+                        continue;
+                     int nbrSlot = brickSlot_[(nx*nBricks_[1] + ny)*nBricks_[2] + nz];
+                     brickNbr_[27*slot + 9*(dx+1) + 3*(dy+1) + dz+1] = 64*nbrSlot;
+                  }
+         }
+
+   brickStencil_.resize(64*19);
+   for (unsigned ib=0; ib<64; ++ib)
+      for (unsigned iNbr=0; iNbr<19; ++iNbr)
+      {
+         const int* dd = FGRUtils::nodeDelta[iNbr];
+         int xx = ((ib>>4) & 3) + dd[0];
+         int yy = ((ib>>2) & 3) + dd[1];
+         int zz = (ib & 3) + dd[2];
+         // xx>>2 is -1, 0 or 1 for the brick that holds the neighbor
+         int nbr = 9*((xx>>2)+1) + 3*((yy>>2)+1) + (zz>>2)+1;
+         brickStencil_[19*ib + iNbr] = 64*nbr + 16*(xx&3) + 4*(yy&3) + (zz&3);
+      }
+}
+
+template <class WeightType>
+unsigned FGRDiffusionOMP<WeightType>::brickIndex(int xx, int yy, int zz) const
+{
+   int slot = brickSlot_[(xx/4*nBricks_[1] + yy/4)*nBricks_[2] + zz/4];
+   return 64*slot + 16*(xx%4) + 4*(yy%4) + zz%4;
+}
+
+template <class WeightType>
+void FGRDiffusionOMP<WeightType>::precomputeCoefficients(const Anatomy& anatomy,
+                                                         const FGRDiffusionParms& parms)
+{
+   unsigned nx = VmBlock_.nx();
+   unsigned ny = VmBlock_.ny();
+   unsigned nz = VmBlock_.nz();
    unsigned nxGlobal = anatomy.nx();
    unsigned nyGlobal = anatomy.ny();
    unsigned nzGlobal = anatomy.nz();
@@ -187,19 +589,26 @@ void FGRDiffusionOMP::precomputeCoefficients(const Anatomy& anatomy)
       tissueBlk(ib) = isTissue(anatomy.cellType(ii));
    }
 
-   for (unsigned ii=0; ii<weight_.size(); ++ii)
+   // The weights are always computed in double precision and only
+   // stored as WeightType.
+   Array3d<DiffWeight> weight(nx, ny, nz);
+   for (unsigned ii=0; ii<weight.size(); ++ii)
       for (unsigned jj=0; jj<19; ++jj)
-         weight_(ii).A[jj] = 0.0;
+         weight(ii).A[jj] = 0.0;
 
-   for (unsigned iCell=0; iCell<anatomy.nLocal(); ++iCell)
+   // With a deep halo the remote cells are stepped too (except for the
+   // outermost layer) so they need weights.
+   for (unsigned iCell=0; iCell<anatomy.size(); ++iCell)
    {
+      if (haloLevel_[iCell] >= haloDepth_)
+         continue;
       unsigned ib = blockIndex_[iCell];
       int tissue[19] = {0};
       mkTissueArray(tissueBlk, ib, tissue);
       
       for (unsigned iFace=0; iFace<6; ++iFace)
       {
-         unsigned faceNbrIndex = ib+faceNbrOffset_[iFace];
+         unsigned faceNbrIndex = nbrIndex(ib, faceNbr[iFace]);
          if (tissueBlk(faceNbrIndex) == 0)
             continue;
 
@@ -209,33 +618,112 @@ void FGRDiffusionOMP::precomputeCoefficients(const Anatomy& anatomy)
          
          for (unsigned ii=0; ii<19; ++ii)
             for (unsigned jj=0; jj<3; ++jj)
-               weight_(ib).A[ii] += sigmaTimesS[jj] * gradPhi[jj][ii] * hInv[jj];
+               weight(ib).A[ii] += sigmaTimesS[jj] * gradPhi[jj][ii] * hInv[jj];
       }
-      double sum = weight_(ib).A[0];
+      double sum = weight(ib).A[0];
       for (unsigned ii=1; ii<19; ++ii)
       {
-         sum += weight_(ib).A[ii];
-         A0_(ib) -= weight_(ib).A[ii];
+         sum += weight(ib).A[ii];
+         A0_(ib) -= WeightType(weight(ib).A[ii]); // keep the stored row sum zero
       }
       assert(abs(sum) < weightSumTolerance);
    }
+   if (sizeof(WeightType) < sizeof(double) && parms.checkWeightPrecision_)
+   {
+      if (bricks_)
+         checkWeightPrecision(weight, blockIndex_, localTuple_);
+      else
+         checkWeightPrecision(weight, blockIndex_, nLocal_, offset_);
+   }
+
+   if (parms.compressWeights_)
+   {
+      compressWeights(weight);
+      return;
+   }
+   weight_.resize(nx, ny, nz);
+   for (unsigned ii=0; ii<weight.size(); ++ii)
+      for (unsigned jj=0; jj<19; ++jj)
+         weight_(ii).A[jj] = weight(ii).A[jj];
 //   printAllWeights(tissueBlk);
 }
 
+/** Replaces the per-cell weights and A0 by a table of the distinct
+ *  stencils and a 16 bit table index per block cell.  In homogeneous
+ *  tissue every interior cell has the same stencil (bitwise, since the
+ *  same operations produce it) so the table is small.  The stencils
+ *  are numbered by decreasing use so that index 0 is the common
+ *  interior stencil.  The kernels keep that one in registers. */
+template <class WeightType>
+void FGRDiffusionOMP<WeightType>::compressWeights(const Array3d<DiffWeight>& weight)
+{
+   typedef vector<double> Key; // stored A[1..18], then A0
+   map<Key, unsigned> stencilMap;
+   Key key(19);
+   for (unsigned iCell=0; iCell<blockIndex_.size(); ++iCell)
+   {
+      if (haloLevel_[iCell] >= haloDepth_)
+         continue;
+      unsigned ib = blockIndex_[iCell];
+      for (unsigned ii=1; ii<19; ++ii)
+         key[ii-1] = WeightType(weight(ib).A[ii]);
+      key[18] = A0_(ib);
+      ++stencilMap[key];
+   }
+   // 16 bit index.  A grid with more distinct stencils than this
+   // should not use compressWeights.
+   assert(stencilMap.size() <= 65536);
+
+   vector<pair<unsigned, const Key*> > byUse;
+   for (typename map<Key, unsigned>::const_iterator iter=stencilMap.begin();
+        iter!=stencilMap.end(); ++iter)
+      byUse.push_back(make_pair(iter->second, &iter->first));
+   sort(byUse.rbegin(), byUse.rend());
+
+   stencilTable_.resize(max<size_t>(byUse.size(), 1));
+   stencilA0_.resize(stencilTable_.size(), 0.0);
+   for (unsigned ii=0; ii<stencilTable_.size(); ++ii)
+      for (unsigned jj=0; jj<19; ++jj)
+         stencilTable_[ii].A[jj] = 0.0;
+   for (unsigned iStencil=0; iStencil<byUse.size(); ++iStencil)
+   {
+      const Key& kk = *byUse[iStencil].second;
+      for (unsigned ii=1; ii<19; ++ii)
+         stencilTable_[iStencil].A[ii] = kk[ii-1];
+      stencilA0_[iStencil] = kk[18];
+      stencilMap[kk] = iStencil;
+   }
+
+   stencilIndex_.resize(weight.nx(), weight.ny(), weight.nz(), 0);
+   for (unsigned iCell=0; iCell<blockIndex_.size(); ++iCell)
+   {
+      if (haloLevel_[iCell] >= haloDepth_)
+         continue;
+      unsigned ib = blockIndex_[iCell];
+      for (unsigned ii=1; ii<19; ++ii)
+         key[ii-1] = WeightType(weight(ib).A[ii]);
+      key[18] = A0_(ib);
+      stencilIndex_(ib) = stencilMap[key];
+   }
+   A0_ = Array3d<double>();
+}
+
 
-void FGRDiffusionOMP::mkTissueArray(
+template <class WeightType>
+void FGRDiffusionOMP<WeightType>::mkTissueArray(
    const Array3d<int>& tissueBlk, int ib, int* tissue)
 {
    for (unsigned ii=0; ii<19; ++ii)
-      tissue[ii] = tissueBlk(ib + offset_[ii]);
+      tissue[ii] = tissueBlk(nbrIndex(ib, ii));
 }
 
 
-Vector FGRDiffusionOMP::f1(int ib, int iFace, const Vector& h,
-                        const Array3d<SymmetricTensor>& sigmaBlk)
+template <class WeightType>
+Vector FGRDiffusionOMP<WeightType>::f1(int ib, int iFace, const Vector& h,
+                                    const Array3d<SymmetricTensor>& sigmaBlk)
 {
    SymmetricTensor
-      sigma = (sigmaBlk(ib) + sigmaBlk(ib+faceNbrOffset_[iFace])) / 2.0;
+      sigma = (sigmaBlk(ib) + sigmaBlk(nbrIndex(ib, faceNbr[iFace]))) / 2.0;
    Vector S(0, 0, 0);
    switch (iFace)
    {
@@ -265,7 +753,8 @@ Vector FGRDiffusionOMP::f1(int ib, int iFace, const Vector& h,
 }
 
 
-void FGRDiffusionOMP::printAllWeights(const Array3d<int>& tissue)
+template <class WeightType>
+void FGRDiffusionOMP<WeightType>::printAllWeights(const Array3d<int>& tissue)
 {
    for (unsigned ii=0; ii<localTuple_.size(); ++ii)
    {
@@ -303,5 +792,5 @@ void FGRDiffusionOMP::printAllWeights(const Array3d<int>& tissue)
    }
 }
 
-
-
+template class FGRDiffusionOMP<float>;
+template class FGRDiffusionOMP<double>;
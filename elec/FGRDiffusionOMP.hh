@@ -10,6 +10,7 @@ class Anatomy;
 class Vector;
 class SymmetricTensor;
 
+template <class WeightType>
 class FGRDiffusionOMP : public Diffusion
 {
  public:
@@ -20,11 +21,30 @@ class FGRDiffusionOMP : public Diffusion
    void updateLocalVoltage(ro_mgarray_ptr<double> VmLocal);
    void updateRemoteVoltage(ro_mgarray_ptr<double> VmRemote);
    void calc(rw_mgarray_ptr<double> dVm);
+   void calcInterior(rw_mgarray_ptr<double> dVm);
+   void calcBoundary(rw_mgarray_ptr<double> dVm);
+   bool supportsSubsteps() const {return true;}
+   void calcSubsteps(int nSubsteps, double dt, rw_mgarray_ptr<double> dVm);
+   void calcRemote(rw_mgarray_ptr<double> dVmRemote);
+   unsigned* blockIndex() {return &blockIndex_[0];}
+   double* VmBlock() {return VmBlock_.cBlock();}
 
  private:
    void buildTupleArray(const Anatomy& anatomy);
    void buildBlockIndex(const Anatomy& anatomy);
-   void precomputeCoefficients(const Anatomy& anatomy);
+   void buildHaloLevel(const Anatomy& anatomy);
+   void buildBoundaryCells();
+   void buildBricks(const Anatomy& anatomy);
+   unsigned brickIndex(int xx, int yy, int zz) const;
+   unsigned nbrIndex(unsigned ib, int iNbr) const;
+   void buildTemporalTiles(const Anatomy& anatomy, int tileWidth);
+   void precomputeCoefficients(const Anatomy& anatomy,
+                               const FGRUtils::FGRDiffusionParms& parms);
+   void compressWeights(const Array3d<FGRUtils::DiffWeight>& weight);
+   void calcCells(rw_array_ptr<double> dVm, const int* cell, int nCells);
+   void calcSparse(rw_array_ptr<double> dVm, const int* cell, int nCells);
+   double stencil(const double* phi, double A0, const WeightType* A) const;
+   double stencilBrick(const double* Vm, unsigned ib, double A0, const WeightType* A) const;
 
    void mkTissueArray(const Array3d<int>& tissueBlk, int ib, int* tissue);
    Vector f1(int ib, int iFace, const Vector& h,
@@ -33,14 +53,63 @@ class FGRDiffusionOMP : public Diffusion
 
    int                             nLocal_;
    int                             nRemote_;
+   int                             haloDepth_;
+   bool                            bricks_;
    int                             offset_[19];
-   int                             faceNbrOffset_[6];
    LocalGrid                       localGrid_;
    std::vector<unsigned>           blockIndex_; // for local and remote cells
    std::vector<Tuple>              localTuple_; // only for local cells
+   int                             nBricks_[3];   // sparseBricks only
+   int                             nBrickSlots_;
+   std::vector<int>                brickSlot_;    // brick -> slot, 0 if empty
+   std::vector<unsigned>           brickNbr_;     // [27*slot + nbr]
+   std::vector<uint16_t>           brickStencil_; // [19*cell + iNbr]
+   std::vector<int>                haloLevel_;  // stencil steps from a local cell
+   std::vector<int>                interiorCell_; // local cells without remote nbrs
+   std::vector<int>                boundaryCell_; // the other local cells
+   std::vector<unsigned>           tileCell_;   // block index, by tile then level
+   std::vector<int>                tileBegin_;
+   std::vector<int>                tileLevelEnd_; // [tile*haloDepth_ + level]
    Array3d<double>                 A0_;
-   Array3d<FGRUtils::DiffWeight>   weight_;
+   Array3d<FGRUtils::DiffWeightT<WeightType> > weight_;
+   std::vector<FGRUtils::DiffWeightT<WeightType> > stencilTable_; // compressWeights only
+   std::vector<double>             stencilA0_;
+   Array3d<uint16_t>               stencilIndex_;
    Array3d<double>                 VmBlock_;
+   Array3d<double>                 VmSubstep_[2];
 };
 
+template <class WeightType>
+inline double FGRDiffusionOMP<WeightType>::stencil(
+   const double* phi, double A0, const WeightType* A) const
+{
+   double tmp = A0 * (*phi);
+   for (unsigned ii=1; ii<19; ++ii)
+      tmp += A[ii] * ( *(phi+offset_[ii]));
+   return tmp;
+}
+
+/** Block index of neighbor iNbr (a FGRUtils::NodeLocation) of block
+ *  index ib. */
+template <class WeightType>
+inline unsigned FGRDiffusionOMP<WeightType>::nbrIndex(unsigned ib, int iNbr) const
+{
+   if (! bricks_)
+      return ib + offset_[iNbr];
+   unsigned code = brickStencil_[19*(ib&63) + iNbr];
+   return brickNbr_[27*(ib>>6) + (code>>6)] + (code&63);
+}
+
+template <class WeightType>
+inline double FGRDiffusionOMP<WeightType>::stencilBrick(
+   const double* Vm, unsigned ib, double A0, const WeightType* A) const
+{
+   const unsigned* base = &brickNbr_[27*(ib>>6)];
+   const uint16_t* code = &brickStencil_[19*(ib&63)];
+   double tmp = A0 * Vm[ib];
+   for (unsigned ii=1; ii<19; ++ii)
+      tmp += A[ii] * Vm[base[code[ii]>>6] + (code[ii]&63)];
+   return tmp;
+}
+
 #endif
@@ -6,6 +6,7 @@
 #include "fastBarrier.hh"
 #include <algorithm>
 #include <cstdio>
+#include <cstdlib>
 #include "ibmIntrinsics.hh"
 #include "ThreadServer.hh"
 #include "ThreadUtils.hh"
@@ -17,10 +18,11 @@ using namespace FGRUtils;
 
 //#define DIFF_TEST
 
-FGRDiffusionOverlap::FGRDiffusionOverlap(const FGRDiffusionParms& parms,
-                           const Anatomy& anatomy,
-                           const ThreadTeam& threadInfo,
-                           const ThreadTeam& reactionThreadInfo)
+template <class WeightType>
+FGRDiffusionOverlap<WeightType>::FGRDiffusionOverlap(const FGRDiffusionParms& parms,
+                                       const Anatomy& anatomy,
+                                       const ThreadTeam& threadInfo,
+                                       const ThreadTeam& reactionThreadInfo)
 : Diffusion(parms.diffusionScale_),
   nLocal_(anatomy.nLocal()),nRemote_(anatomy.nRemote()),
   localGrid_(DiffusionUtils::findBoundingBox_simd(anatomy, parms.printBBox_)),
@@ -99,7 +101,8 @@ FGRDiffusionOverlap::FGRDiffusionOverlap(const FGRDiffusionParms& parms,
 
    uint32_t ny4=((int)(ny+3)/4)*4;
    uint32_t totalSizeOfVmSlab = ny*nz*2 + nx*nz*2 + nx*ny4*2;
-   VmSlabT_ = new double[totalSizeOfVmSlab ];
+   int rc = posix_memalign((void**)&VmSlabT_, 32, totalSizeOfVmSlab*sizeof(double));
+   assert(rc == 0);
    VmSlab_[0] = VmSlabT_;
    VmSlab_[1] = VmSlab_[0] + ny*nz;
    VmSlab_[2] = VmSlab_[1] + ny*nz;
@@ -197,6 +200,8 @@ FGRDiffusionOverlap::FGRDiffusionOverlap(const FGRDiffusionParms& parms,
 
 //   offsetsTest();
    precomputeCoefficients(anatomy);
+   if (sizeof(WeightType) < sizeof(double) && parms.checkWeightPrecision_)
+      checkWeightPrecision(weight_, blockIndex_, nLocal_, offset_);
    reorder_Coeff();
 
 #define STRIP_DIFFUSION_DEBUG 0
@@ -379,7 +384,8 @@ FGRDiffusionOverlap::FGRDiffusionOverlap(const FGRDiffusionParms& parms,
   
 }
 
-void FGRDiffusionOverlap::test()
+template <class WeightType>
+void FGRDiffusionOverlap<WeightType>::test()
 {
    /*
   int tid = threadInfo_.teamRank();
@@ -426,7 +432,8 @@ void FGRDiffusionOverlap::test()
    */
 }
 
-void FGRDiffusionOverlap::updateLocalVoltage(ro_mgarray_ptr<double> VmLocal_managed)
+template <class WeightType>
+void FGRDiffusionOverlap<WeightType>::updateLocalVoltage(ro_mgarray_ptr<double> VmLocal_managed)
 {
    startTimer(FGR_ArrayLocal2MatrixTimer);
    ro_array_ptr<double> VmLocal = VmLocal_managed.useOn(CPU);
@@ -468,7 +475,8 @@ void FGRDiffusionOverlap::updateLocalVoltage(ro_mgarray_ptr<double> VmLocal_mana
 //
 //}
 
-void FGRDiffusionOverlap::updateRemoteVoltage(ro_mgarray_ptr<double> VmRemote_managed)
+template <class WeightType>
+void FGRDiffusionOverlap<WeightType>::updateRemoteVoltage(ro_mgarray_ptr<double> VmRemote_managed)
 {
    startTimer(FGR_ArrayRemote2MatrixTimer);
    ro_array_ptr<double> VmRemote = VmRemote_managed.useOn(CPU);
@@ -483,7 +491,8 @@ void FGRDiffusionOverlap::updateRemoteVoltage(ro_mgarray_ptr<double> VmRemote_ma
    stopTimer(FGR_ArrayRemote2MatrixTimer);
 }
 
-void FGRDiffusionOverlap::buildSlabIndex(const Anatomy& anatomy)
+template <class WeightType>
+void FGRDiffusionOverlap<WeightType>::buildSlabIndex(const Anatomy& anatomy)
 {
    slabIndex_.resize(anatomy.size(),0);
    int nx = localGrid_.nx();
@@ -509,7 +518,8 @@ void FGRDiffusionOverlap::buildSlabIndex(const Anatomy& anatomy)
 
 
 /*
-void FGRDiffusionOverlap::updateRemoteVoltageOld(const double* VmRemote)
+template <class WeightType>
+void FGRDiffusionOverlap<WeightType>::updateRemoteVoltageOld(const double* VmRemote)
 {
    startTimer(FGR_ArrayRemote2MatrixTimer);
    int tid = threadInfo_.teamRank();
@@ -526,7 +536,8 @@ void FGRDiffusionOverlap::updateRemoteVoltageOld(const double* VmRemote)
 */
 
 //stencil on boundary
-void FGRDiffusionOverlap::calc(rw_mgarray_ptr<double> /*dVm_managed*/)
+template <class WeightType>
+void FGRDiffusionOverlap<WeightType>::calc(rw_mgarray_ptr<double> /*dVm_managed*/)
 {
    int tid = threadInfo_.teamRank();
    int tid2 = threadInfo_.teamRank()/2;
@@ -596,7 +607,8 @@ void FGRDiffusionOverlap::calc(rw_mgarray_ptr<double> /*dVm_managed*/)
 }
 
 /** threaded simd version */
-void FGRDiffusionOverlap::calc_overlap(rw_mgarray_ptr<double> /*dVm_managed*/)
+template <class WeightType>
+void FGRDiffusionOverlap<WeightType>::calc_overlap(rw_mgarray_ptr<double> /*dVm_managed*/)
 {
    int tid = threadInfo_.teamRank();
 
@@ -620,7 +632,8 @@ void FGRDiffusionOverlap::calc_overlap(rw_mgarray_ptr<double> /*dVm_managed*/)
 }
 
 //We're building the localTuple array.
-void FGRDiffusionOverlap::buildTupleArray(const Anatomy& anatomy)
+template <class WeightType>
+void FGRDiffusionOverlap<WeightType>::buildTupleArray(const Anatomy& anatomy)
 {
    localTuple_.resize(anatomy.size(), Tuple(0,0,0));
    BBzb=-1; //hope that it roles properly
@@ -635,7 +648,8 @@ void FGRDiffusionOverlap::buildTupleArray(const Anatomy& anatomy)
    //printf("BBzb=%d BBze=%d\n",BBzb,BBze);
 }
 
-void FGRDiffusionOverlap::buildBlockIndex(const Anatomy& anatomy)
+template <class WeightType>
+void FGRDiffusionOverlap<WeightType>::buildBlockIndex(const Anatomy& anatomy)
 {
    blockIndex_.resize(anatomy.size());
    for (unsigned ii=0; ii<anatomy.size(); ++ii)
@@ -742,7 +756,8 @@ void FGRDiffusionOverlap::buildBlockIndex(const Anatomy& anatomy)
 //}
 
 
-void FGRDiffusionOverlap::precomputeCoefficients(const Anatomy& anatomy)
+template <class WeightType>
+void FGRDiffusionOverlap<WeightType>::precomputeCoefficients(const Anatomy& anatomy)
 {
    unsigned nx = localGrid_.nx();
    unsigned ny = localGrid_.ny();
@@ -795,14 +810,15 @@ void FGRDiffusionOverlap::precomputeCoefficients(const Anatomy& anatomy)
       for (unsigned ii=1; ii<19; ++ii)
       {
          sum += weight_(ib).A[ii];
-         A0_(ib) -= weight_(ib).A[ii];
+         A0_(ib) -= WeightType(weight_(ib).A[ii]); // keep the stored row sum zero
       }
       assert(abs(sum) < weightSumTolerance);
    }
    //printAllWeights(tissueBlk);
 }
 
-void FGRDiffusionOverlap::mkTissueArray(
+template <class WeightType>
+void FGRDiffusionOverlap<WeightType>::mkTissueArray(
    const Array3d<int>& tissueBlk, int ib, int* tissue)
 {
    for (unsigned ii=0; ii<19; ++ii)
@@ -810,8 +826,9 @@ void FGRDiffusionOverlap::mkTissueArray(
 }
 
 
-Vector FGRDiffusionOverlap::f1(int ib, int iFace, const Vector& h,
-                        const Array3d<SymmetricTensor>& sigmaBlk)
+template <class WeightType>
+Vector FGRDiffusionOverlap<WeightType>::f1(int ib, int iFace, const Vector& h,
+                                    const Array3d<SymmetricTensor>& sigmaBlk)
 {
    SymmetricTensor
       sigma = (sigmaBlk(ib) + sigmaBlk(ib+faceNbrOffset_[iFace])) / 2.0;
@@ -844,7 +861,8 @@ Vector FGRDiffusionOverlap::f1(int ib, int iFace, const Vector& h,
 }
 
 
-void FGRDiffusionOverlap::printAllWeights(const Array3d<int>& tissue)
+template <class WeightType>
+void FGRDiffusionOverlap<WeightType>::printAllWeights(const Array3d<int>& tissue)
 {
    for (unsigned ii=0; ii<localTuple_.size(); ++ii)
    {
@@ -882,7 +900,8 @@ void FGRDiffusionOverlap::printAllWeights(const Array3d<int>& tissue)
    }
 }
 
-void FGRDiffusionOverlap::printAllVoltage(Array3d<double>& Voltage,int map)
+template <class WeightType>
+void FGRDiffusionOverlap<WeightType>::printAllVoltage(Array3d<double>& Voltage,int map)
 {
    unsigned int ll[3]={Voltage.nx(),Voltage.ny(),Voltage.nz()};
    int xi[3];
@@ -895,7 +914,8 @@ void FGRDiffusionOverlap::printAllVoltage(Array3d<double>& Voltage,int map)
    }
 }
 
-void FGRDiffusionOverlap::setAllVoltage(Array3d<double>& Voltage, int cut)
+template <class WeightType>
+void FGRDiffusionOverlap<WeightType>::setAllVoltage(Array3d<double>& Voltage, int cut)
 {
    for(int xx=0;xx<Voltage.nx();xx++)
    for(int yy=0;yy<Voltage.ny();yy++)
@@ -915,7 +935,8 @@ void FGRDiffusionOverlap::setAllVoltage(Array3d<double>& Voltage, int cut)
    }
 }
 
-void FGRDiffusionOverlap::reorder_Coeff()
+template <class WeightType>
+void FGRDiffusionOverlap<WeightType>::reorder_Coeff()
 {
   uint32_t idx=0,ll,ii,jj,kk;
   const uint32_t Nx2 = localGrid_.nx();
@@ -962,7 +983,7 @@ void FGRDiffusionOverlap::reorder_Coeff()
     diffCoefT2_(xx,yy,4*20*zp4 + 4* 3 + zp%4 ) =weight_(xx,yy,zz).A[ZPP];
     diffCoefT2_(xx,yy,4*20*zp4 + 4* 6 + zp%4 ) =weight_(xx,yy,zz).A[PZP];
                                  
-    *((double*)&(diffCoefT2_(xx,yy,4*20*zz4 + 4* 4 + (zz%4)*2))) = A0_(xx,yy,zz);
+    *((double*)&(diffCoefT2_(xx,yy,4*20*zz4 + 4* 4 + (zz%4)*sizeof(double)/sizeof(WeightType)))) = A0_(xx,yy,zz);
 //    diffCoefT2_(xx,yy,4*20*zz4 + 4* 5 + zz%4 ) =weight_(xx,yy,zz).A[ZZZ]=0;
     diffCoefT2_(xx,yy,4*20*zz4 + 4* 7 + zz%4 ) =weight_(xx,yy,zz).A[PMZ];
     diffCoefT2_(xx,yy,4*20*zz4 + 4* 8 + zz%4 ) =weight_(xx,yy,zz).A[MMZ];
@@ -1030,7 +1051,8 @@ void FGRDiffusionOverlap::reorder_Coeff()
   }
 }
 
-void FGRDiffusionOverlap::reset_Coeff()
+template <class WeightType>
+void FGRDiffusionOverlap<WeightType>::reset_Coeff()
 {
   uint32_t idx=0,ll,ii,jj,kk;
   const uint32_t Nx2 = localGrid_.nx();
@@ -1067,7 +1089,7 @@ void FGRDiffusionOverlap::reset_Coeff()
     diffCoefT2_(xx,yy,4*20*zp4 + 4* 3 + zp%4 ) =weight_(xx,yy,zz).A[ZPP]=1;
     diffCoefT2_(xx,yy,4*20*zp4 + 4* 6 + zp%4 ) =weight_(xx,yy,zz).A[PZP]=1;
                                  
-    *((double*)&(diffCoefT2_(xx,yy,4*20*zz4 + 4* 4 + (zz%4)*2))) = A0_(xx,yy,zz)=1;
+    *((double*)&(diffCoefT2_(xx,yy,4*20*zz4 + 4* 4 + (zz%4)*sizeof(double)/sizeof(WeightType)))) = A0_(xx,yy,zz)=1;
 //    diffCoefT2_(xx,yy,4*20*zz4 + 4* 5 + zz%4 ) =weight_(xx,yy,zz).A[ZZZ]=0=1;
     diffCoefT2_(xx,yy,4*20*zz4 + 4* 7 + zz%4 ) =weight_(xx,yy,zz).A[PMZ]=1;
     diffCoefT2_(xx,yy,4*20*zz4 + 4* 8 + zz%4 ) =weight_(xx,yy,zz).A[MMZ]=1;
@@ -1136,8 +1158,9 @@ void FGRDiffusionOverlap::reset_Coeff()
 }
 // simdiazed version
 // 'start' cannot be in the middle. 'start' must point to (n,m,0). 
+template <class WeightType>
 void
-FGRDiffusionOverlap::FGRDiff_simd_thread(const uint32_t bx,const int32_t ex, Array3d<double>* VmTmp, double* out0)
+FGRDiffusionOverlap<WeightType>::FGRDiff_simd_thread(const uint32_t bx,const int32_t ex, Array3d<double>* VmTmp, double* out0)
 {
   int ii;
 
@@ -1215,32 +1238,32 @@ FGRDiffusionOverlap::FGRDiff_simd_thread(const uint32_t bx,const int32_t ex, Arr
         my_xp1_ym1_z  =vec_ld(0,    phi_xp1_ym1_z );
  
     #define calc_zp(x) \
-        x =  vec_madd(vec_ld(4*6*WTSZ,simd_diff_)  , my_xp1_y_z, \
-             vec_madd(vec_ld(4*3*WTSZ,simd_diff_)  , my_x_yp1_z, \
-             vec_madd(vec_ld(4*2*WTSZ,simd_diff_)  , my_xm1_y_z, \
-             vec_madd(vec_ld(4*1*WTSZ,simd_diff_)  , my_x_ym1_z, \
-             vec_mul( vec_ld(4*0*WTSZ,simd_diff_)  , my_x_y_z)))));
+        x =  vec_madd(vec_ld(4*6*sizeof(WeightType),simd_diff_)  , my_xp1_y_z, \
+             vec_madd(vec_ld(4*3*sizeof(WeightType),simd_diff_)  , my_x_yp1_z, \
+             vec_madd(vec_ld(4*2*sizeof(WeightType),simd_diff_)  , my_xm1_y_z, \
+             vec_madd(vec_ld(4*1*sizeof(WeightType),simd_diff_)  , my_x_ym1_z, \
+             vec_mul( vec_ld(4*0*sizeof(WeightType),simd_diff_)  , my_x_y_z)))));
  
     #define calc_zz(x) \
-        double_vec = vec_ld(4*4*WTSZ,(double*)simd_diff_); \
-        x = vec_madd( vec_ld(4*14*WTSZ,simd_diff_)  , my_xp1_y_z, \
-            vec_madd( vec_ld(4*13*WTSZ,simd_diff_)  , my_x_yp1_z, \
-            vec_madd( vec_ld(4*12*WTSZ,simd_diff_)  , my_xm1_y_z, \
-            vec_madd( vec_ld(4*11*WTSZ,simd_diff_)  , my_x_ym1_z, \
-            vec_madd( vec_ld(4*10*WTSZ,simd_diff_)  , my_xp1_yp1_z, \
-            vec_madd( vec_ld(4*9*WTSZ,simd_diff_)  , my_xm1_yp1_z, \
-            vec_madd( vec_ld(4*8*WTSZ,simd_diff_)  , my_xm1_ym1_z, \
-            vec_madd( vec_ld(4*7*WTSZ,simd_diff_)  , my_xp1_ym1_z, \
+        double_vec = vec_ld(4*4*sizeof(WeightType),(double*)simd_diff_); \
+        x = vec_madd( vec_ld(4*14*sizeof(WeightType),simd_diff_)  , my_xp1_y_z, \
+            vec_madd( vec_ld(4*13*sizeof(WeightType),simd_diff_)  , my_x_yp1_z, \
+            vec_madd( vec_ld(4*12*sizeof(WeightType),simd_diff_)  , my_xm1_y_z, \
+            vec_madd( vec_ld(4*11*sizeof(WeightType),simd_diff_)  , my_x_ym1_z, \
+            vec_madd( vec_ld(4*10*sizeof(WeightType),simd_diff_)  , my_xp1_yp1_z, \
+            vec_madd( vec_ld(4*9*sizeof(WeightType),simd_diff_)  , my_xm1_yp1_z, \
+            vec_madd( vec_ld(4*8*sizeof(WeightType),simd_diff_)  , my_xm1_ym1_z, \
+            vec_madd( vec_ld(4*7*sizeof(WeightType),simd_diff_)  , my_xp1_ym1_z, \
             vec_mul (double_vec  , my_x_y_z)))))))));
-//            vec_mul ( vec_ld(4*5*WTSZ,(double*)simd_diff_)  , my_x_y_z)))))))));
-            //vec_mul ( vec_ld(4*5*WTSZ,simd_diff_)  , my_x_y_z)))))))));
+//            vec_mul ( vec_ld(4*5*sizeof(WeightType),(double*)simd_diff_)  , my_x_y_z)))))))));
+            //vec_mul ( vec_ld(4*5*sizeof(WeightType),simd_diff_)  , my_x_y_z)))))))));
  
     #define calc_zm(x) \
-        x = vec_madd( vec_ld(4*19*WTSZ,simd_diff_)  , my_xp1_y_z, \
-            vec_madd( vec_ld(4*18*WTSZ,simd_diff_)  , my_x_yp1_z, \
-            vec_madd( vec_ld(4*17*WTSZ,simd_diff_)  , my_xm1_y_z, \
-            vec_madd( vec_ld(4*16*WTSZ,simd_diff_)  , my_x_ym1_z, \
-            vec_mul ( vec_ld(4*15*WTSZ,simd_diff_)  , my_x_y_z)))));
+        x = vec_madd( vec_ld(4*19*sizeof(WeightType),simd_diff_)  , my_xp1_y_z, \
+            vec_madd( vec_ld(4*18*sizeof(WeightType),simd_diff_)  , my_x_yp1_z, \
+            vec_madd( vec_ld(4*17*sizeof(WeightType),simd_diff_)  , my_xm1_y_z, \
+            vec_madd( vec_ld(4*16*sizeof(WeightType),simd_diff_)  , my_x_ym1_z, \
+            vec_mul ( vec_ld(4*15*sizeof(WeightType),simd_diff_)  , my_x_y_z)))));
  
     #define shift_pointers \
             phi_xp1_y_z   +=4; \
@@ -1296,8 +1319,9 @@ FGRDiffusionOverlap::FGRDiff_simd_thread(const uint32_t bx,const int32_t ex, Arr
   }
 };
 
+template <class WeightType>
 void
-FGRDiffusionOverlap::FGRDiff_strip(const uint32_t bx,const int32_t ex, Array3d<double>* VmTmp, double* out0)
+FGRDiffusionOverlap<WeightType>::FGRDiff_strip(const uint32_t bx,const int32_t ex, Array3d<double>* VmTmp, double* out0)
 {
   int ii;
 
@@ -1394,32 +1418,32 @@ FGRDiffusionOverlap::FGRDiff_strip(const uint32_t bx,const int32_t ex, Array3d<d
         my_xp1_ym1_z  =vec_ld(0,    phi_xp1_ym1_z );
  
     #define calc_zp(x) \
-        x =  vec_madd(vec_ld(4*6*WTSZ,simd_diff_)  , my_xp1_y_z, \
-             vec_madd(vec_ld(4*3*WTSZ,simd_diff_)  , my_x_yp1_z, \
-             vec_madd(vec_ld(4*2*WTSZ,simd_diff_)  , my_xm1_y_z, \
-             vec_madd(vec_ld(4*1*WTSZ,simd_diff_)  , my_x_ym1_z, \
-             vec_mul( vec_ld(4*0*WTSZ,simd_diff_)  , my_x_y_z)))));
+        x =  vec_madd(vec_ld(4*6*sizeof(WeightType),simd_diff_)  , my_xp1_y_z, \
+             vec_madd(vec_ld(4*3*sizeof(WeightType),simd_diff_)  , my_x_yp1_z, \
+             vec_madd(vec_ld(4*2*sizeof(WeightType),simd_diff_)  , my_xm1_y_z, \
+             vec_madd(vec_ld(4*1*sizeof(WeightType),simd_diff_)  , my_x_ym1_z, \
+             vec_mul( vec_ld(4*0*sizeof(WeightType),simd_diff_)  , my_x_y_z)))));
  
     #define calc_zz(x) \
-        double_vec = vec_ld(4*4*WTSZ,(double*)simd_diff_); \
-        x = vec_madd( vec_ld(4*14*WTSZ,simd_diff_)  , my_xp1_y_z, \
-            vec_madd( vec_ld(4*13*WTSZ,simd_diff_)  , my_x_yp1_z, \
-            vec_madd( vec_ld(4*12*WTSZ,simd_diff_)  , my_xm1_y_z, \
-            vec_madd( vec_ld(4*11*WTSZ,simd_diff_)  , my_x_ym1_z, \
-            vec_madd( vec_ld(4*10*WTSZ,simd_diff_)  , my_xp1_yp1_z, \
-            vec_madd( vec_ld(4*9*WTSZ,simd_diff_)  , my_xm1_yp1_z, \
-            vec_madd( vec_ld(4*8*WTSZ,simd_diff_)  , my_xm1_ym1_z, \
-            vec_madd( vec_ld(4*7*WTSZ,simd_diff_)  , my_xp1_ym1_z, \
+        double_vec = vec_ld(4*4*sizeof(WeightType),(double*)simd_diff_); \
+        x = vec_madd( vec_ld(4*14*sizeof(WeightType),simd_diff_)  , my_xp1_y_z, \
+            vec_madd( vec_ld(4*13*sizeof(WeightType),simd_diff_)  , my_x_yp1_z, \
+            vec_madd( vec_ld(4*12*sizeof(WeightType),simd_diff_)  , my_xm1_y_z, \
+            vec_madd( vec_ld(4*11*sizeof(WeightType),simd_diff_)  , my_x_ym1_z, \
+            vec_madd( vec_ld(4*10*sizeof(WeightType),simd_diff_)  , my_xp1_yp1_z, \
+            vec_madd( vec_ld(4*9*sizeof(WeightType),simd_diff_)  , my_xm1_yp1_z, \
+            vec_madd( vec_ld(4*8*sizeof(WeightType),simd_diff_)  , my_xm1_ym1_z, \
+            vec_madd( vec_ld(4*7*sizeof(WeightType),simd_diff_)  , my_xp1_ym1_z, \
             vec_mul (double_vec  , my_x_y_z)))))))));
-//            vec_mul ( vec_ld(4*5*WTSZ,(double*)simd_diff_)  , my_x_y_z)))))))));
-            //vec_mul ( vec_ld(4*5*WTSZ,simd_diff_)  , my_x_y_z)))))))));
+//            vec_mul ( vec_ld(4*5*sizeof(WeightType),(double*)simd_diff_)  , my_x_y_z)))))))));
+            //vec_mul ( vec_ld(4*5*sizeof(WeightType),simd_diff_)  , my_x_y_z)))))))));
  
     #define calc_zm(x) \
-        x = vec_madd( vec_ld(4*19*WTSZ,simd_diff_)  , my_xp1_y_z, \
-            vec_madd( vec_ld(4*18*WTSZ,simd_diff_)  , my_x_yp1_z, \
-            vec_madd( vec_ld(4*17*WTSZ,simd_diff_)  , my_xm1_y_z, \
-            vec_madd( vec_ld(4*16*WTSZ,simd_diff_)  , my_x_ym1_z, \
-            vec_mul ( vec_ld(4*15*WTSZ,simd_diff_)  , my_x_y_z)))));
+        x = vec_madd( vec_ld(4*19*sizeof(WeightType),simd_diff_)  , my_xp1_y_z, \
+            vec_madd( vec_ld(4*18*sizeof(WeightType),simd_diff_)  , my_x_yp1_z, \
+            vec_madd( vec_ld(4*17*sizeof(WeightType),simd_diff_)  , my_xm1_y_z, \
+            vec_madd( vec_ld(4*16*sizeof(WeightType),simd_diff_)  , my_x_ym1_z, \
+            vec_mul ( vec_ld(4*15*sizeof(WeightType),simd_diff_)  , my_x_y_z)))));
  
     #define shift_pointers \
             phi_xp1_y_z   +=4; \
@@ -1476,8 +1500,9 @@ FGRDiffusionOverlap::FGRDiff_strip(const uint32_t bx,const int32_t ex, Array3d<d
 }
 
 
+template <class WeightType>
 void
-FGRDiffusionOverlap::FGRDiff_2D_xy(uint32_t slabID, const uint32_t by,const int32_t ey)
+FGRDiffusionOverlap<WeightType>::FGRDiff_2D_xy(uint32_t slabID, const uint32_t by,const int32_t ey)
 {
 #if 0
    int ii;
@@ -1556,15 +1581,15 @@ FGRDiffusionOverlap::FGRDiff_2D_xy(uint32_t slabID, const uint32_t by,const int3
         my_x_ym1_z    =vec_ld(0,      phi_x_ym1_z );
  
     #define calc_zp_2D(x) \
-        x = vec_mul( vec_ld(4*3*WTSZ,simd_diff_)  , my_x_y_z);
+        x = vec_mul( vec_ld(4*3*sizeof(WeightType),simd_diff_)  , my_x_y_z);
  
     #define calc_zz_2D(x) \
-        x = vec_madd( vec_ld(4*2*WTSZ,simd_diff_)  , my_x_ym1_z, \
-            vec_madd( vec_ld(4*1*WTSZ,simd_diff_)  , my_x_yp1_z, \
-            vec_madd( vec_ld(4*0*WTSZ,simd_diff_)  , my_x_y_z, my_0))); \
+        x = vec_madd( vec_ld(4*2*sizeof(WeightType),simd_diff_)  , my_x_ym1_z, \
+            vec_madd( vec_ld(4*1*sizeof(WeightType),simd_diff_)  , my_x_yp1_z, \
+            vec_madd( vec_ld(4*0*sizeof(WeightType),simd_diff_)  , my_x_y_z, my_0))); \
  
     #define calc_zm_2D(x) \
-        x = vec_mul( vec_ld(4*4*WTSZ,simd_diff_), my_x_y_z);
+        x = vec_mul( vec_ld(4*4*sizeof(WeightType),simd_diff_), my_x_y_z);
  
     #define shift_pointers_2D \
             phi_x_yp1_z   +=4; \
@@ -1618,8 +1643,9 @@ FGRDiffusionOverlap::FGRDiff_2D_xy(uint32_t slabID, const uint32_t by,const int3
   #endif
 }
 
+template <class WeightType>
 void
-FGRDiffusionOverlap::FGRDiff_2D_z(uint32_t slabID, const uint32_t by,const int32_t ey, double* out0)
+FGRDiffusionOverlap<WeightType>::FGRDiff_2D_z(uint32_t slabID, const uint32_t by,const int32_t ey, double* out0)
 {
   int ii;
 
@@ -1662,15 +1688,15 @@ FGRDiffusionOverlap::FGRDiff_2D_z(uint32_t slabID, const uint32_t by,const int32
         my_x_ym1_z    =vec_ld(0,      phi_x_ym1_z );
  
     #define calc_zp_2D(x) \
-        x = vec_mul( vec_ld(4*3*WTSZ,simd_diff_)  , my_x_y_z);
+        x = vec_mul( vec_ld(4*3*sizeof(WeightType),simd_diff_)  , my_x_y_z);
  
     #define calc_zz_2D(x) \
-        x = vec_madd( vec_ld(4*2*WTSZ,simd_diff_)  , my_x_ym1_z, \
-            vec_madd( vec_ld(4*1*WTSZ,simd_diff_)  , my_x_yp1_z, \
-            vec_madd( vec_ld(4*0*WTSZ,simd_diff_)  , my_x_y_z, my_0))); \
+        x = vec_madd( vec_ld(4*2*sizeof(WeightType),simd_diff_)  , my_x_ym1_z, \
+            vec_madd( vec_ld(4*1*sizeof(WeightType),simd_diff_)  , my_x_yp1_z, \
+            vec_madd( vec_ld(4*0*sizeof(WeightType),simd_diff_)  , my_x_y_z, my_0))); \
  
     #define calc_zm_2D(x) \
-        x = vec_mul( vec_ld(4*4*WTSZ,simd_diff_), my_x_y_z);
+        x = vec_mul( vec_ld(4*4*sizeof(WeightType),simd_diff_), my_x_y_z);
  
     #define shift_pointers_2D \
             phi_x_yp1_z   +=4; \
@@ -1721,8 +1747,9 @@ FGRDiffusionOverlap::FGRDiff_2D_z(uint32_t slabID, const uint32_t by,const int32
   }
 }
 
+template <class WeightType>
 void
-FGRDiffusionOverlap::compareVoltage(Array3d<double>& A, Array3d<double>& B)
+FGRDiffusionOverlap<WeightType>::compareVoltage(Array3d<double>& A, Array3d<double>& B)
 {
    for(int x=0;x<VmBlock_.nx();x++)
    for(int y=0;y<VmBlock_.ny();y++)
@@ -1733,8 +1760,9 @@ FGRDiffusionOverlap::compareVoltage(Array3d<double>& A, Array3d<double>& B)
 }
 
 
+template <class WeightType>
 void
-FGRDiffusionOverlap::copySlabToBlock()
+FGRDiffusionOverlap<WeightType>::copySlabToBlock()
 {
    for(int x=0;x<VmBlock_.nx();x++)
    for(int y=0;y<VmBlock_.ny();y++)
@@ -1750,8 +1778,9 @@ FGRDiffusionOverlap::copySlabToBlock()
 }
 
 
+template <class WeightType>
 void
-FGRDiffusionOverlap::clearBlockBD()
+FGRDiffusionOverlap<WeightType>::clearBlockBD()
 {
    for(int x=0;x<VmBlock_.nx();x++)
    for(int y=0;y<VmBlock_.ny();y++)
@@ -1765,3 +1794,6 @@ FGRDiffusionOverlap::clearBlockBD()
       else if( z == VmBlock_.nz()-1 ) VmBlock_(x,y,z)=0;
    }
 }
+
+template class FGRDiffusionOverlap<float>;
+template class FGRDiffusionOverlap<double>;
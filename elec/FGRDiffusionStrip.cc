@@ -16,10 +16,11 @@ using namespace std;
 using namespace FGRUtils;
 
 
-FGRDiffusionStrip::FGRDiffusionStrip(const FGRDiffusionParms& parms,
-                           const Anatomy& anatomy,
-                           const ThreadTeam& threadInfo,
-                           const ThreadTeam& reactionThreadInfo)
+template <class WeightType>
+FGRDiffusionStrip<WeightType>::FGRDiffusionStrip(const FGRDiffusionParms& parms,
+                                       const Anatomy& anatomy,
+                                       const ThreadTeam& threadInfo,
+                                       const ThreadTeam& reactionThreadInfo)
 : Diffusion(parms.diffusionScale_),
   nLocal_(anatomy.nLocal()),
   localGrid_(DiffusionUtils::findBoundingBox_simd(anatomy, parms.printBBox_)),
@@ -125,6 +126,8 @@ FGRDiffusionStrip::FGRDiffusionStrip(const FGRDiffusionParms& parms,
 
 //   offsetsTest();
    precomputeCoefficients(anatomy);
+   if (sizeof(WeightType) < sizeof(double) && parms.checkWeightPrecision_)
+      checkWeightPrecision(weight_, blockIndex_, nLocal_, offset_);
    reorder_Coeff();
 
    assert(nz%4 == 0);
@@ -312,7 +315,8 @@ FGRDiffusionStrip::FGRDiffusionStrip(const FGRDiffusionParms& parms,
 
 }
 
-void FGRDiffusionStrip::updateLocalVoltage(ro_mgarray_ptr<double> VmLocal_managed)
+template <class WeightType>
+void FGRDiffusionStrip<WeightType>::updateLocalVoltage(ro_mgarray_ptr<double> VmLocal_managed)
 {
    startTimer(FGR_ArrayLocal2MatrixTimer);
    ro_array_ptr<double> VmLocal = VmLocal_managed.useOn(CPU);
@@ -327,7 +331,8 @@ void FGRDiffusionStrip::updateLocalVoltage(ro_mgarray_ptr<double> VmLocal_manage
    stopTimer(FGR_ArrayLocal2MatrixTimer);
 }
 
-void FGRDiffusionStrip::updateRemoteVoltage(ro_mgarray_ptr<double> VmRemote_managed)
+template <class WeightType>
+void FGRDiffusionStrip<WeightType>::updateRemoteVoltage(ro_mgarray_ptr<double> VmRemote_managed)
 {
    startTimer(FGR_ArrayRemote2MatrixTimer);
    ro_array_ptr<double> VmRemote = VmRemote_managed.useOn(CPU);
@@ -344,7 +349,8 @@ void FGRDiffusionStrip::updateRemoteVoltage(ro_mgarray_ptr<double> VmRemote_mana
 }
 
 /** threaded simd version */
-void FGRDiffusionStrip::calc(rw_mgarray_ptr<double> dVm_managed)
+template <class WeightType>
+void FGRDiffusionStrip<WeightType>::calc(rw_mgarray_ptr<double> dVm_managed)
 {
    rw_array_ptr<double> dVm = dVm_managed.useOn(CPU);
    int tid = threadInfo_.teamRank();
@@ -407,7 +413,8 @@ void FGRDiffusionStrip::calc(rw_mgarray_ptr<double> dVm_managed)
  * do stencil operations on remote particles so we shouldn't need
  * tuples.  We can use block indices instead.
  */
-void FGRDiffusionStrip::buildTupleArray(const Anatomy& anatomy)
+template <class WeightType>
+void FGRDiffusionStrip<WeightType>::buildTupleArray(const Anatomy& anatomy)
 {
    localTuple_.resize(anatomy.nLocal(), Tuple(0,0,0));
    for (unsigned ii=0; ii<anatomy.nLocal(); ++ii)
@@ -423,7 +430,8 @@ void FGRDiffusionStrip::buildTupleArray(const Anatomy& anatomy)
    }
 }
 
-void FGRDiffusionStrip::buildBlockIndex(const Anatomy& anatomy)
+template <class WeightType>
+void FGRDiffusionStrip<WeightType>::buildBlockIndex(const Anatomy& anatomy)
 {
    blockIndex_.resize(anatomy.size());
    for (unsigned ii=0; ii<anatomy.size(); ++ii)
@@ -530,7 +538,8 @@ void FGRDiffusionStrip::buildBlockIndex(const Anatomy& anatomy)
 //}
 
 
-void FGRDiffusionStrip::precomputeCoefficients(const Anatomy& anatomy)
+template <class WeightType>
+void FGRDiffusionStrip<WeightType>::precomputeCoefficients(const Anatomy& anatomy)
 {
    unsigned nx = localGrid_.nx();
    unsigned ny = localGrid_.ny();
@@ -583,14 +592,15 @@ void FGRDiffusionStrip::precomputeCoefficients(const Anatomy& anatomy)
       for (unsigned ii=1; ii<19; ++ii)
       {
          sum += weight_(ib).A[ii];
-         A0_(ib) -= weight_(ib).A[ii];
+         A0_(ib) -= WeightType(weight_(ib).A[ii]); // keep the stored row sum zero
       }
       assert(abs(sum) < weightSumTolerance);
    }
 //   printAllWeights(tissueBlk);
 }
 
-void FGRDiffusionStrip::mkTissueArray(
+template <class WeightType>
+void FGRDiffusionStrip<WeightType>::mkTissueArray(
    const Array3d<int>& tissueBlk, int ib, int* tissue)
 {
    for (unsigned ii=0; ii<19; ++ii)
@@ -598,8 +608,9 @@ void FGRDiffusionStrip::mkTissueArray(
 }
 
 
-Vector FGRDiffusionStrip::f1(int ib, int iFace, const Vector& h,
-                        const Array3d<SymmetricTensor>& sigmaBlk)
+template <class WeightType>
+Vector FGRDiffusionStrip<WeightType>::f1(int ib, int iFace, const Vector& h,
+                                    const Array3d<SymmetricTensor>& sigmaBlk)
 {
    SymmetricTensor
       sigma = (sigmaBlk(ib) + sigmaBlk(ib+faceNbrOffset_[iFace])) / 2.0;
@@ -632,7 +643,8 @@ Vector FGRDiffusionStrip::f1(int ib, int iFace, const Vector& h,
 }
 
 
-void FGRDiffusionStrip::printAllWeights(const Array3d<int>& tissue)
+template <class WeightType>
+void FGRDiffusionStrip<WeightType>::printAllWeights(const Array3d<int>& tissue)
 {
    for (unsigned ii=0; ii<localTuple_.size(); ++ii)
    {
@@ -670,7 +682,8 @@ void FGRDiffusionStrip::printAllWeights(const Array3d<int>& tissue)
    }
 }
 
-void FGRDiffusionStrip::reorder_Coeff()
+template <class WeightType>
+void FGRDiffusionStrip<WeightType>::reorder_Coeff()
 {
   uint32_t idx=0,ll,ii,jj,kk;
   const uint32_t Nx2 = localGrid_.nx();
@@ -701,7 +714,7 @@ void FGRDiffusionStrip::reorder_Coeff()
     diffCoefT2_(xx,yy,4*20*zp4 + 4* 3 + zp%4 ) =weight_(xx,yy,zz).A[ZPP];
     diffCoefT2_(xx,yy,4*20*zp4 + 4* 6 + zp%4 ) =weight_(xx,yy,zz).A[PZP];
                                  
-    *((double*)&(diffCoefT2_(xx,yy,4*20*zz4 + 4* 4 + (zz%4)*2))) = A0_(xx,yy,zz);
+    *((double*)&(diffCoefT2_(xx,yy,4*20*zz4 + 4* 4 + (zz%4)*sizeof(double)/sizeof(WeightType)))) = A0_(xx,yy,zz);
 //    diffCoefT2_(xx,yy,4*20*zz4 + 4* 5 + zz%4 ) =weight_(xx,yy,zz).A[ZZZ];
     diffCoefT2_(xx,yy,4*20*zz4 + 4* 7 + zz%4 ) =weight_(xx,yy,zz).A[PMZ];
     diffCoefT2_(xx,yy,4*20*zz4 + 4* 8 + zz%4 ) =weight_(xx,yy,zz).A[MMZ];
@@ -725,8 +738,9 @@ void FGRDiffusionStrip::reorder_Coeff()
 
 // simdiazed version
 // 'start' cannot be in the middle. 'start' must point to (n,m,0). 
+template <class WeightType>
 void
-FGRDiffusionStrip::FGRDiff_simd_thread(const uint32_t bx,const int32_t ex, Array3d<double>* VmTmp, double* out0)
+FGRDiffusionStrip<WeightType>::FGRDiff_simd_thread(const uint32_t bx,const int32_t ex, Array3d<double>* VmTmp, double* out0)
 {
   int ii;
 
@@ -823,32 +837,32 @@ FGRDiffusionStrip::FGRDiff_simd_thread(const uint32_t bx,const int32_t ex, Array
         my_xp1_ym1_z  =vec_ld(0,    phi_xp1_ym1_z );
  
     #define calc_zp(x) \
-        x =  vec_madd(vec_ld(4*6*WTSZ,simd_diff_)  , my_xp1_y_z, \
-             vec_madd(vec_ld(4*3*WTSZ,simd_diff_)  , my_x_yp1_z, \
-             vec_madd(vec_ld(4*2*WTSZ,simd_diff_)  , my_xm1_y_z, \
-             vec_madd(vec_ld(4*1*WTSZ,simd_diff_)  , my_x_ym1_z, \
-             vec_mul( vec_ld(4*0*WTSZ,simd_diff_)  , my_x_y_z)))));
+        x =  vec_madd(vec_ld(4*6*sizeof(WeightType),simd_diff_)  , my_xp1_y_z, \
+             vec_madd(vec_ld(4*3*sizeof(WeightType),simd_diff_)  , my_x_yp1_z, \
+             vec_madd(vec_ld(4*2*sizeof(WeightType),simd_diff_)  , my_xm1_y_z, \
+             vec_madd(vec_ld(4*1*sizeof(WeightType),simd_diff_)  , my_x_ym1_z, \
+             vec_mul( vec_ld(4*0*sizeof(WeightType),simd_diff_)  , my_x_y_z)))));
  
     #define calc_zz(x) \
-        double_vec = vec_ld(4*4*WTSZ,(double*)simd_diff_); \
-        x = vec_madd( vec_ld(4*14*WTSZ,simd_diff_)  , my_xp1_y_z, \
-            vec_madd( vec_ld(4*13*WTSZ,simd_diff_)  , my_x_yp1_z, \
-            vec_madd( vec_ld(4*12*WTSZ,simd_diff_)  , my_xm1_y_z, \
-            vec_madd( vec_ld(4*11*WTSZ,simd_diff_)  , my_x_ym1_z, \
-            vec_madd( vec_ld(4*10*WTSZ,simd_diff_)  , my_xp1_yp1_z, \
-            vec_madd( vec_ld(4*9*WTSZ,simd_diff_)  , my_xm1_yp1_z, \
-            vec_madd( vec_ld(4*8*WTSZ,simd_diff_)  , my_xm1_ym1_z, \
-            vec_madd( vec_ld(4*7*WTSZ,simd_diff_)  , my_xp1_ym1_z, \
+        double_vec = vec_ld(4*4*sizeof(WeightType),(double*)simd_diff_); \
+        x = vec_madd( vec_ld(4*14*sizeof(WeightType),simd_diff_)  , my_xp1_y_z, \
+            vec_madd( vec_ld(4*13*sizeof(WeightType),simd_diff_)  , my_x_yp1_z, \
+            vec_madd( vec_ld(4*12*sizeof(WeightType),simd_diff_)  , my_xm1_y_z, \
+            vec_madd( vec_ld(4*11*sizeof(WeightType),simd_diff_)  , my_x_ym1_z, \
+            vec_madd( vec_ld(4*10*sizeof(WeightType),simd_diff_)  , my_xp1_yp1_z, \
+            vec_madd( vec_ld(4*9*sizeof(WeightType),simd_diff_)  , my_xm1_yp1_z, \
+            vec_madd( vec_ld(4*8*sizeof(WeightType),simd_diff_)  , my_xm1_ym1_z, \
+            vec_madd( vec_ld(4*7*sizeof(WeightType),simd_diff_)  , my_xp1_ym1_z, \
             vec_mul (double_vec  , my_x_y_z)))))))));
-//            vec_mul ( vec_ld(4*5*WTSZ,(double*)simd_diff_)  , my_x_y_z)))))))));
-            //vec_mul ( vec_ld(4*5*WTSZ,simd_diff_)  , my_x_y_z)))))))));
+//            vec_mul ( vec_ld(4*5*sizeof(WeightType),(double*)simd_diff_)  , my_x_y_z)))))))));
+            //vec_mul ( vec_ld(4*5*sizeof(WeightType),simd_diff_)  , my_x_y_z)))))))));
  
     #define calc_zm(x) \
-        x = vec_madd( vec_ld(4*19*WTSZ,simd_diff_)  , my_xp1_y_z, \
-            vec_madd( vec_ld(4*18*WTSZ,simd_diff_)  , my_x_yp1_z, \
-            vec_madd( vec_ld(4*17*WTSZ,simd_diff_)  , my_xm1_y_z, \
-            vec_madd( vec_ld(4*16*WTSZ,simd_diff_)  , my_x_ym1_z, \
-            vec_mul ( vec_ld(4*15*WTSZ,simd_diff_)  , my_x_y_z)))));
+        x = vec_madd( vec_ld(4*19*sizeof(WeightType),simd_diff_)  , my_xp1_y_z, \
+            vec_madd( vec_ld(4*18*sizeof(WeightType),simd_diff_)  , my_x_yp1_z, \
+            vec_madd( vec_ld(4*17*sizeof(WeightType),simd_diff_)  , my_xm1_y_z, \
+            vec_madd( vec_ld(4*16*sizeof(WeightType),simd_diff_)  , my_x_ym1_z, \
+            vec_mul ( vec_ld(4*15*sizeof(WeightType),simd_diff_)  , my_x_y_z)))));
  
     #define shift_pointers \
             phi_xp1_y_z   +=4; \
@@ -904,4 +918,5 @@ FGRDiffusionStrip::FGRDiff_simd_thread(const uint32_t bx,const int32_t ex, Array
   }
 }
 
-
+template class FGRDiffusionStrip<float>;
+template class FGRDiffusionStrip<double>;
@@ -133,7 +133,7 @@ void FGRDiffusionThreads::calc(rw_mgarray_ptr<double> /*dVm_managed*/)
       int ib = blockIndex_[iCell];
       
       double* phi = & (VmBlock_(ib));
-      const WeightType *A = weight_(ib).A;
+      const double *A = weight_(ib).A;
       dVmBlock_(ib) = A0_(ib) * (*(phi+offset_[0]));
       for (unsigned ii=1; ii<19; ++ii)
          dVmBlock_(ib) += A[ii] * ( *(phi+offset_[ii]));
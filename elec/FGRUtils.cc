@@ -1,5 +1,9 @@
 #include "FGRUtils.hh"
 #include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <algorithm>
+#include <mpi.h>
 
 using namespace std;
 
@@ -146,4 +150,92 @@ namespace FGRUtils
          assert(false);
       }
    }
+
+   namespace
+   {
+      /** Smooth test field for checkWeightPrecision, in block or local
+       *  grid coordinates. */
+      double testField(int xx, int yy, int zz)
+      {
+         const double waveLength = 16.0; // in cells
+         const double kk = 2.0*M_PI/waveLength;
+         return -40.0 + 45.0*sin(kk*xx)*cos(kk*yy)*sin(kk*zz+0.5);
+      }
+
+      /** err is {max abs difference, max abs reference}. */
+      void reportWeightError(const double err[2])
+      {
+         double errMax[2];
+         MPI_Allreduce(const_cast<double*>(err), errMax, 2, MPI_DOUBLE, MPI_MAX, MPI_COMM_WORLD);
+         int myRank;
+         MPI_Comm_rank(MPI_COMM_WORLD, &myRank);
+         if (myRank == 0)
+            printf("Diffusion weightPrecision = float: max stencil error %e"
+                   " (relative %e)\n",
+                   errMax[0], (errMax[1] > 0 ? errMax[0]/errMax[1] : 0.0));
+      }
+   }
+
+   /** Built in accuracy check for weightPrecision = float.  The stencil
+    *  of every local cell is applied to a smooth test field once with
+    *  the double precision weights and once with the weights rounded to
+    *  float.  As in the diffusion classes the center weight is minus
+    *  the sum of the others.  Rank 0 reports the largest difference
+    *  relative to the largest double precision result. */
+   void checkWeightPrecision(const Array3d<DiffWeight>& weight,
+                             const vector<unsigned>& blockIndex,
+                             unsigned nLocal, const int offset[19])
+   {
+      const unsigned ny = weight.ny();
+      const unsigned nz = weight.nz();
+      vector<double> phi(weight.size());
+      for (unsigned ib=0; ib<phi.size(); ++ib)
+         phi[ib] = testField(ib/(ny*nz), (ib/nz)%ny, ib%nz);
+
+      double err[2] = {0.0, 0.0};
+      for (unsigned ii=0; ii<nLocal; ++ii)
+      {
+         unsigned ib = blockIndex[ii];
+         const double* A = weight(ib).A;
+         double ref = 0.0;
+         double rounded = 0.0;
+         for (unsigned jj=1; jj<19; ++jj)
+         {
+            double dPhi = phi[ib+offset[jj]] - phi[ib];
+            ref += A[jj]*dPhi;
+            rounded += double(float(A[jj]))*dPhi;
+         }
+         err[0] = max(err[0], fabs(rounded-ref));
+         err[1] = max(err[1], fabs(ref));
+      }
+      reportWeightError(err);
+   }
+
+   /** Same check for layouts where the neighbors are not at fixed
+    *  offsets in the block (sparse bricks).  The test field is
+    *  evaluated at the local grid tuple of each cell. */
+   void checkWeightPrecision(const Array3d<DiffWeight>& weight,
+                             const vector<unsigned>& blockIndex,
+                             const vector<Tuple>& localTuple)
+   {
+      double err[2] = {0.0, 0.0};
+      for (unsigned ii=0; ii<localTuple.size(); ++ii)
+      {
+         const double* A = weight(blockIndex[ii]).A;
+         const Tuple& tt = localTuple[ii];
+         double phi0 = testField(tt.x(), tt.y(), tt.z());
+         double ref = 0.0;
+         double rounded = 0.0;
+         for (unsigned jj=1; jj<19; ++jj)
+         {
+            const int* dd = nodeDelta[jj];
+            double dPhi = testField(tt.x()+dd[0], tt.y()+dd[1], tt.z()+dd[2]) - phi0;
+            ref += A[jj]*dPhi;
+            rounded += double(float(A[jj]))*dPhi;
+         }
+         err[0] = max(err[0], fabs(rounded-ref));
+         err[1] = max(err[1], fabs(ref));
+      }
+      reportWeightError(err);
+   }
 }
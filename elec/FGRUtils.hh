@@ -2,18 +2,22 @@
 #define FGR_UTILS_HH
 
 #include <vector>
+#include <string>
+#include "Array3d.hh"
+#include "Tuple.hh"
 
-
+// The FGR diffusion classes are templated on the type used to store
+// the stencil weights (see the weightPrecision keyword).  This macro
+// only sets the default precision.
 #ifdef Diff_Weight_Type_Single
-#define WeightType float
-#define WTSZ 4
-const double weightSumTolerance = 1e-7;
+#define DEFAULT_WEIGHT_PRECISION "float"
 #else
-#define WeightType double
-#define WTSZ 8
-const double weightSumTolerance = 1e-14;
+#define DEFAULT_WEIGHT_PRECISION "double"
 #endif
 
+// Weights are always computed in double precision.
+const double weightSumTolerance = 1e-14;
+
 namespace FGRUtils
 {
    enum NodeLocation
@@ -21,17 +25,36 @@ namespace FGRUtils
      MPZ, MZM, ZMM, PZM, ZPM, MZP, ZMP, PZP, ZPP
    };
 
+   // (x, y, z) displacement of each NodeLocation
+   const int nodeDelta[19][3] =
+   { {0,0,0}, {-1,0,0}, {0,-1,0}, {1,0,0}, {0,1,0}, {0,0,-1}, {0,0,1},
+     {-1,-1,0}, {1,-1,0}, {1,1,0}, {-1,1,0}, {-1,0,-1}, {0,-1,-1},
+     {1,0,-1}, {0,1,-1}, {-1,0,1}, {0,-1,1}, {1,0,1}, {0,1,1}
+   };
+
    struct FGRDiffusionParms
    {
       bool   printBBox_;
       double diffusionScale_;
+      int    temporalTileWidth_; // x-planes per tile for substepping
+      bool   checkWeightPrecision_;
+      bool   compressWeights_;   // table of unique stencils (omp only)
+      bool   sparseBricks_;      // 4x4x4 brick storage (omp only)
    };
    
-   struct DiffWeight
+   template <class WeightType>
+   struct DiffWeightT
    {
       WeightType A[19];
    };
-   
+   typedef DiffWeightT<double> DiffWeight;
+
+   void checkWeightPrecision(const Array3d<DiffWeight>& weight,
+                             const std::vector<unsigned>& blockIndex,
+                             unsigned nLocal, const int offset[19]);
+   void checkWeightPrecision(const Array3d<DiffWeight>& weight,
+                             const std::vector<unsigned>& blockIndex,
+                             const std::vector<Tuple>& localTuple);
 
    void setGradientWeights(double* grad, int* tissue,
                            NodeLocation n3, NodeLocation n2, NodeLocation n1,
@@ -37,7 +37,8 @@ GDLoadBalancer::~GDLoadBalancer()
 {
 }
 ////////////////////////////////////////////////////////////////////////////////
-void GDLoadBalancer::initialDistByWorkFn(vector<AnatomyCell>& cells, int nx, int ny, int nz, double diffCost)
+void GDLoadBalancer::initialDistByWorkFn(vector<AnatomyCell>& cells, int nx, int ny, int nz, double diffCost,
+                                         const ReactionCost& cellCost)
 {
    // cells should contain only the cells with non-zero type indices, distributed
    // in x-y planes of grid points as follows:
@@ -45,6 +46,7 @@ void GDLoadBalancer::initialDistByWorkFn(vector<AnatomyCell>& cells, int nx, int
    //    else if (nTasks < nz) destRank = gid.z*nTasks/nz  (multiple planes per task)
    
    diffCost_ = diffCost;
+   cellCost_ = cellCost;
 
    nx_ = nx;
    ny_ = ny;
@@ -80,20 +82,20 @@ void GDLoadBalancer::initialDistByWorkFn(vector<AnatomyCell>& cells, int nx, int
       const int zlen = 4;
       int zmin_loc = nz_;
       int zmax_loc = 0;
-      vector<int> planecnt_loc(nz_,0);
-      vector<int> planecnt(nz_,0);
+      vector<double> planecnt_loc(nz_,0);
+      vector<double> planecnt(nz_,0);
       for (unsigned ii=0; ii<cells.size(); ++ii)
       {
          Long64 gid = cells[ii].gid_;
          GridPoint gpt(gid,nx_,ny_,nz_);
          if (gpt.z < zmin_loc) zmin_loc = gpt.z;
          if (gpt.z > zmax_loc) zmax_loc = gpt.z;
-         planecnt_loc[gpt.z]++;
+         planecnt_loc[gpt.z] += cellCost_(cells[ii].cellType_);
       }
       int zmin, zmax;
       MPI_Allreduce(&zmin_loc, &zmin, 1, MPI_INT, MPI_MIN, comm_);
       MPI_Allreduce(&zmax_loc, &zmax, 1, MPI_INT, MPI_MAX, comm_);
-      MPI_Allreduce(&planecnt_loc[0], &planecnt[0], nz_, MPI_INT, MPI_SUM, comm_);
+      MPI_Allreduce(&planecnt_loc[0], &planecnt[0], nz_, MPI_DOUBLE, MPI_SUM, comm_);
 
       // store min/max values for distributeBox functions
       kpmin_z[0] = zmin;
@@ -109,10 +111,10 @@ void GDLoadBalancer::initialDistByWorkFn(vector<AnatomyCell>& cells, int nx, int
          if (tkpmax > zmax) tkpmax = zmax;
 
          // initial work (under)estimate for process plane kp
-         int nkpcnt = 0;
+         double nkpcnt = 0;
          for (int iz=tkpmin; iz<=tkpmax; iz++)
             nkpcnt += planecnt[iz];         
-         int tkpzwork = nkpcnt;
+         double tkpzwork = nkpcnt;
 
          if (myRank_ == 0)
             cout << "Pre-distributing plane " << kp << ", tkpmin = " << tkpmin << ", tkpmax = " << tkpmax << ", tkpzwork = " << tkpzwork << endl;
@@ -454,14 +456,14 @@ double GDLoadBalancer::distributePlaneByWorkFn(vector<AnatomyCell>& cells, int z
                                                bool assignpes)
 {
    int kpdz = zmax - zmin + 1;
-   vector<int> kpxyloc(nx_*ny_,0);
+   vector<double> kpxyloc(nx_*ny_,0);
    int nloc = 0;
    for (unsigned ii=0; ii<cells.size(); ++ii)
    {
       GridPoint gpt(cells[ii].gid_,nx_,ny_,nz_);
       if (gpt.z >= zmin && gpt.z <= zmax)
       {
-         kpxyloc[nx_*gpt.y+gpt.x]++;
+         kpxyloc[nx_*gpt.y+gpt.x] += cellCost_(cells[ii].cellType_);
          nloc++;
       }
    }
@@ -478,16 +480,16 @@ double GDLoadBalancer::distributePlaneByWorkFn(vector<AnatomyCell>& cells, int z
    }
    int firstPe = ownsZData_[zmin];
    
-   vector<int> kpxycnt(nx_*ny_,0);
+   vector<double> kpxycnt(nx_*ny_,0);
    int nkpProcs = kpProcs.size();
    for (set<int>::iterator zpeit = kpProcs.begin(); zpeit != kpProcs.end(); ++zpeit)
    {
       int size = nx_*ny_;
-      vector<int> buf(size);
+      vector<double> buf(size);
       if (myRank_ != *zpeit)
       {
          MPI_Status status;
-         MPI_Recv(&buf[0],size,MPI_INT,*zpeit,myRank_,MPI_COMM_WORLD,&status);
+         MPI_Recv(&buf[0],size,MPI_DOUBLE,*zpeit,myRank_,MPI_COMM_WORLD,&status);
          for (int ii=0; ii<size; ii++)
             kpxycnt[ii] += buf[ii];
       }
@@ -496,7 +498,7 @@ double GDLoadBalancer::distributePlaneByWorkFn(vector<AnatomyCell>& cells, int z
          for (set<int>::iterator destpeit = kpProcs.begin(); destpeit != kpProcs.end(); ++destpeit)
          {
             if (*destpeit != *zpeit)
-               MPI_Send(&kpxyloc[0],size,MPI_INT,*destpeit,*destpeit,MPI_COMM_WORLD);
+               MPI_Send(&kpxyloc[0],size,MPI_DOUBLE,*destpeit,*destpeit,MPI_COMM_WORLD);
          }
          for (int ii=0; ii<size; ii++)
             kpxycnt[ii] += kpxyloc[ii];
@@ -582,7 +584,7 @@ double GDLoadBalancer::distributePlaneByWorkFn(vector<AnatomyCell>& cells, int z
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-double GDLoadBalancer::calcMaxWork(double targetWork, vector<int>& kpxycnt,int ymin,
+double GDLoadBalancer::calcMaxWork(double targetWork, vector<double>& kpxycnt,int ymin,
                                    int ymax, int kpdz, int kp, double& twksum, bool assignpes)
 {
    vector<int> trialmin_y(npey_,-1);
@@ -600,8 +602,8 @@ double GDLoadBalancer::calcMaxWork(double targetWork, vector<int>& kpxycnt,int y
    for (int iy=ymin; iy<=ymax; iy++)
    {
       // try adding this iy strip to current jpset process strip
-      vector<int> txcnt(nx_,0);
-      int xsum = 0;
+      vector<double> txcnt(nx_,0);
+      double xsum = 0;
       for (int ty=trialmin_y[jpset]; ty<=iy; ty++)
       {
          for (int ix=0; ix<nx_; ix++)
@@ -625,7 +627,7 @@ double GDLoadBalancer::calcMaxWork(double targetWork, vector<int>& kpxycnt,int y
          if (!(tmin_x[ip] < 0 || tmax_x[ip] < 0))
          {
             int area = (tmax_x[ip]-tmin_x[ip]+1)*(iy-trialmin_y[jpset]+1);
-            int tmpcnt = 0;
+            double tmpcnt = 0;
             for (int tx=tmin_x[ip]; tx<=tmax_x[ip]; tx++)
                tmpcnt += txcnt[tx];
             double twork = costFunction(tmpcnt, area, kpdz, diffCost_);
@@ -677,7 +679,7 @@ double GDLoadBalancer::calcMaxWork(double targetWork, vector<int>& kpxycnt,int y
          
          if (!(trialmin_x[jpind] < 0 || trialmax_x[jpind] < 0))
          {
-            int tmpcnt = 0;
+            double tmpcnt = 0;
             for (int ty=trialmin_y[npey_-1]; ty<=ymax; ty++)
                for (int tx=trialmin_x[jpind]; tx<=trialmax_x[jpind]; tx++)
                   tmpcnt += kpxycnt[nx_*ty+tx];
@@ -720,12 +722,12 @@ double GDLoadBalancer::calcMaxWork(double targetWork, vector<int>& kpxycnt,int y
 }
 
 ////////////////////////////////////////////////////////////////////////////////
-void GDLoadBalancer::xstripDistByWorkFn(vector<int>& xcnt, vector<int>& pexmin, vector<int>& pexmax,
+void GDLoadBalancer::xstripDistByWorkFn(vector<double>& xcnt, vector<int>& pexmin, vector<int>& pexmax,
                                 int dy, int dz, bool verbose)
 {
    int xmin = 999999999;
    int xmax = -999999999;
-   int xsum = 0;
+   double xsum = 0;
    for (int ix=0; ix<nx_; ix++)
    {
       if (xcnt[ix] > 0 && xmin == 999999999)
@@ -748,12 +750,12 @@ void GDLoadBalancer::xstripDistByWorkFn(vector<int>& xcnt, vector<int>& pexmin,
    
    int ngap = 0;
    int gapcnt = 0;
-   int isumgap = -1;
+   double isumgap = -1;
    vector<double> bwork;
    vector<int> gapii(1,xmin);
    vector<int> bstart(1,xmin);
    vector<int> bend(1,xmax);
-   vector<int> bcnt(1,0);
+   vector<double> bcnt(1,0);
    for (int ii=xmin; ii<=xmax; ii++) 
    {
       bcnt[ngap] += xcnt[ii];
@@ -835,7 +837,7 @@ void GDLoadBalancer::xstripDistByWorkFn(vector<int>& xcnt, vector<int>& pexmin,
       if (gavg < 1.01) gavg = 1.01;
       
       int gip = 0;
-      int thisxcnt = 0;
+      double thisxcnt = 0;
       double worksum = 0.0;
       for (int ii=bstart[ig]; ii<=bend[ig]; ii++) 
       {
@@ -1772,7 +1774,7 @@ int GDLoadBalancer::ipow(int a, int n)
    return b;
 }    
 ////////////////////////////////////////////////////////////////////////////////
-double GDLoadBalancer::costFunction(int nTissue, int area, int height, double a)
+double GDLoadBalancer::costFunction(double nTissue, int area, int height, double a)
 {
    int dz4 = (height+2);
    if (dz4 % 4  != 0) dz4 += (4-dz4%4);
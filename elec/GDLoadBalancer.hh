@@ -3,6 +3,7 @@
 
 #include <vector>
 #include <mpi.h> 
+#include "ReactionCost.hh"
 using std::vector;
 
 class AnatomyCell;
@@ -34,6 +35,7 @@ class GDLoadBalancer {
     MPI_Comm comm_;
     int nTasks_, myRank_;
     double diffCost_;
+    ReactionCost cellCost_;        // reaction work of each cell
     
     double distributePlaneByWorkFn(vector<AnatomyCell>& cells, int zmin, int zmax, double zwork,
                                    int kp, bool assignpes);
@@ -43,9 +45,9 @@ class GDLoadBalancer {
                               vector<int>& kpznum, vector<double>& kpzwork, vector<int>& pezind,
                               vector<double>& workDist);
     int distributePlaneByVol(vector<AnatomyCell>& cells, int zmin, int zmax, int zvol, int kp);
-    double calcMaxWork(double targetWork, vector<int>& kpxycnt,int ymin, int ymax, int kpdz,
+    double calcMaxWork(double targetWork, vector<double>& kpxycnt,int ymin, int ymax, int kpdz,
                        int kp, double& twksum, bool assignpes);
-    void xstripDistByWorkFn(vector<int>& xcnt, vector<int>& pexmin, vector<int>& pexmax, int dy,
+    void xstripDistByWorkFn(vector<double>& xcnt, vector<int>& pexmin, vector<int>& pexmax, int dy,
                             int dz, bool verbose);
     void xstripDistByVol(vector<int>& xcnt, vector<int>& pexmin, vector<int>& pexmax, bool verbose);
     void redistributeCells(vector<AnatomyCell>& cells);
@@ -56,10 +58,11 @@ class GDLoadBalancer {
 
     GDLoadBalancer(MPI_Comm comm, int npex, int npey, int npez);
     ~GDLoadBalancer();
-    void initialDistByWorkFn(vector<AnatomyCell>& cells, int nx, int ny, int nz, double diffCost);
+    void initialDistByWorkFn(vector<AnatomyCell>& cells, int nx, int ny, int nz, double diffCost,
+                             const ReactionCost& cellCost = ReactionCost());
     void initialDistByVol(vector<AnatomyCell>& cells, int nx, int ny, int nz);
     void setReducedProcGrid(int rnx, int rny, int rnz);
-    double costFunction(int nTissue, int area, int height, double a);
+    double costFunction(double nTissue, int area, int height, double a);
 };
 
 class GapSortDouble
@@ -0,0 +1,545 @@
+#include "GraphBalancer.hh"
+
+#include <algorithm>
+#include <cassert>
+#include <climits>
+#include <iostream>
+#include <utility>
+#include "Anatomy.hh"
+#include "GridPoint.hh"
+#include "mpiUtils.h"
+
+using namespace std;
+
+namespace
+{
+   struct Move
+   {
+      Move(int gain, Long64 gid, unsigned cell, int to)
+      : gain_(gain), gid_(gid), cell_(cell), to_(to) {}
+      // Largest gain first, ties by gid so the order doesn't depend on
+      // the order of the cells.
+      bool operator<(const Move& b) const
+      {
+         return gain_ > b.gain_ || (gain_ == b.gain_ && gid_ < b.gid_);
+      }
+      int gain_;
+      Long64 gid_;
+      unsigned cell_;
+      int to_;
+   };
+
+   void prefixSum(const vector<int>& count, vector<int>& offset)
+   {
+      offset.assign(count.size()+1, 0);
+      for (unsigned ii=0; ii<count.size(); ++ii)
+         offset[ii+1] = offset[ii] + count[ii];
+   }
+}
+
+
+GraphBalancer::GraphBalancer(Anatomy& anatomy, const GraphBalancerParms& parms,
+                             MPI_Comm comm)
+: verbose_(parms.verbose),
+  maxRefineSteps_(parms.maxRefineSteps),
+  tolerance_(parms.tolerance),
+  cost_(parms.cost),
+  comm_(comm),
+  nx_(anatomy.nx()),
+  ny_(anatomy.ny()),
+  nz_(anatomy.nz()),
+  cells_(anatomy.cellArray())
+{
+   MPI_Comm_size(comm_, &nTasks_);
+   MPI_Comm_rank(comm_, &myRank_);
+   nGrid_ = Long64(nx_)*ny_*nz_;
+
+   bisectGeometrically();
+   sendCellsToDestinations();
+   buildGraph();
+   if (verbose_)
+      printStatistics("geometric bisection");
+
+   int nIdle = 0;
+   for (int step=0; step<maxRefineSteps_ && nIdle<2; ++step)
+   {
+      int nMoved = refineStep(step%2 == 0 ? 1 : -1);
+      exchangeLabels();
+      nIdle = (nMoved == 0 ? nIdle+1 : 0);
+   }
+   if (verbose_)
+      printStatistics("refinement");
+
+   for (unsigned ii=0; ii<cells_.size(); ++ii)
+      cells_[ii].dest_ = label_[ii];
+   sendCellsToDestinations();
+}
+
+/** Cuts all domains of a level at once.  A domain is a range of tasks
+ *  [lo, hi) and its cells go to [lo, mid) and [mid, hi) in proportion
+ *  to the number of tasks.  The cut is the weighted median of the cells
+ *  ordered by their coordinate along the longest extent of the domain,
+ *  then along the next longest and so on, so that the halves balance
+ *  to within one cell.  One histogram per axis finds it. */
+void GraphBalancer::bisectGeometrically()
+{
+   unsigned nLocal = cells_.size();
+   vector<int> coord(3*nLocal+1);
+   vector<double> weight(nLocal+1);
+   for (unsigned ii=0; ii<nLocal; ++ii)
+   {
+      GridPoint gp(cells_[ii].gid_, nx_, ny_, nz_);
+      coord[3*ii+0] = gp.x;
+      coord[3*ii+1] = gp.y;
+      coord[3*ii+2] = gp.z;
+      weight[ii] = cost_(cells_[ii].cellType_);
+      cells_[ii].dest_ = 0;
+   }
+
+   vector<int> segLo(1, 0);
+   vector<int> segHi(1, nTasks_);
+   vector<int> seg(nLocal+1, 0);
+   if (nTasks_ == 1)
+      segLo.clear();
+   while (!segLo.empty())
+   {
+      int nSeg = segLo.size();
+
+      // The bounding box of each domain with the maxima negated so one
+      // MPI_MIN does both.
+      vector<int> box(6*nSeg, INT_MAX);
+      for (unsigned ii=0; ii<nLocal; ++ii)
+      {
+         if (seg[ii] < 0)
+            continue;
+         int* bb = &box[6*seg[ii]];
+         for (int jj=0; jj<3; ++jj)
+         {
+            bb[jj]   = min(bb[jj],    coord[3*ii+jj]);
+            bb[jj+3] = min(bb[jj+3], -coord[3*ii+jj]);
+         }
+      }
+      MPI_Allreduce(MPI_IN_PLACE, &box[0], 6*nSeg, MPI_INT, MPI_MIN, comm_);
+
+      // The axes of each domain from the longest extent to the shortest.
+      vector<int> axis(3*nSeg);
+      vector<int> low(3*nSeg);
+      vector<int> extent(3*nSeg);
+      for (int ss=0; ss<nSeg; ++ss)
+      {
+         for (int jj=0; jj<3; ++jj)
+         {
+            int lo = box[6*ss+jj];
+            int hi = -box[6*ss+jj+3];
+            if (lo > hi) // a domain without cells
+               lo = hi = 0;
+            low[3*ss+jj] = lo;
+            extent[3*ss+jj] = hi - lo + 1;
+            axis[3*ss+jj] = jj;
+         }
+         int* aa = &axis[3*ss];
+         const int* ee = &extent[3*ss];
+         for (int jj=1; jj<3; ++jj)
+            for (int kk=jj; kk>0 && ee[aa[kk]] > ee[aa[kk-1]]; --kk)
+               swap(aa[kk], aa[kk-1]);
+      }
+
+      // Each pass histograms the slice of the domain left by the cuts of
+      // the previous passes along the next axis.
+      vector<double> target(nSeg);
+      vector<int> cut(3*nSeg);
+      for (int pass=0; pass<3; ++pass)
+      {
+         vector<int> nBins(nSeg);
+         for (int ss=0; ss<nSeg; ++ss)
+            nBins[ss] = extent[3*ss+axis[3*ss+pass]];
+         vector<int> offset;
+         prefixSum(nBins, offset);
+         vector<double> hist(offset[nSeg], 0.0);
+         for (unsigned ii=0; ii<nLocal; ++ii)
+         {
+            int ss = seg[ii];
+            if (ss < 0)
+               continue;
+            const int* aa = &axis[3*ss];
+            const int* cc = &coord[3*ii];
+            bool inSlice = true;
+            for (int jj=0; jj<pass; ++jj)
+               inSlice = inSlice && cc[aa[jj]] == cut[3*ss+jj];
+            if (inSlice)
+               hist[offset[ss] + cc[aa[pass]] - low[3*ss+aa[pass]]] += weight[ii];
+         }
+         MPI_Allreduce(MPI_IN_PLACE, &hist[0], offset[nSeg], MPI_DOUBLE, MPI_SUM, comm_);
+
+         for (int ss=0; ss<nSeg; ++ss)
+         {
+            const double* hh = &hist[offset[ss]];
+            if (pass == 0)
+            {
+               double total = 0;
+               for (int bb=0; bb<nBins[ss]; ++bb)
+                  total += hh[bb];
+               int mid = segLo[ss] + (segHi[ss]-segLo[ss])/2;
+               target[ss] = total*(mid-segLo[ss])/(segHi[ss]-segLo[ss]);
+            }
+            double below = 0;
+            int bb = 0;
+            while (bb < nBins[ss]-1 && below+hh[bb] <= target[ss])
+               below += hh[bb++];
+            target[ss] -= below;
+            // Along the last axis a bin is a single cell.
+            if (pass == 2 && target[ss] > 0.5*hh[bb])
+               ++bb;
+            cut[3*ss+pass] = low[3*ss+axis[3*ss+pass]] + bb;
+         }
+      }
+
+      vector<int> nextLo;
+      vector<int> nextHi;
+      vector<int> child(2*nSeg, -1);
+      for (int ss=0; ss<nSeg; ++ss)
+      {
+         int mid = segLo[ss] + (segHi[ss]-segLo[ss])/2;
+         if (mid - segLo[ss] > 1)
+         {
+            child[2*ss] = nextLo.size();
+            nextLo.push_back(segLo[ss]);
+            nextHi.push_back(mid);
+         }
+         if (segHi[ss] - mid > 1)
+         {
+            child[2*ss+1] = nextLo.size();
+            nextLo.push_back(mid);
+            nextHi.push_back(segHi[ss]);
+         }
+      }
+      for (unsigned ii=0; ii<nLocal; ++ii)
+      {
+         int ss = seg[ii];
+         if (ss < 0)
+            continue;
+         const int* aa = &axis[3*ss];
+         const int* cc = &coord[3*ii];
+         const int* kk = &cut[3*ss];
+         bool left = (cc[aa[0]] < kk[0] ||
+                      (cc[aa[0]] == kk[0] &&
+                       (cc[aa[1]] < kk[1] ||
+                        (cc[aa[1]] == kk[1] && cc[aa[2]] < kk[2]))));
+         int mid = segLo[ss] + (segHi[ss]-segLo[ss])/2;
+         cells_[ii].dest_ = (left ? segLo[ss] : mid);
+         seg[ii] = child[2*ss + (left ? 0 : 1)];
+      }
+      segLo.swap(nextLo);
+      segHi.swap(nextHi);
+   }
+}
+
+void GraphBalancer::sendCellsToDestinations()
+{
+   sort(cells_.begin(), cells_.end(), AnatomyCell::destLessThan);
+   unsigned nLocal = cells_.size();
+   vector<unsigned> dest(nLocal+1);
+   vector<unsigned> nRecv(nTasks_, 0);
+   for (unsigned ii=0; ii<nLocal; ++ii)
+   {
+      dest[ii] = cells_[ii].dest_;
+      ++nRecv[dest[ii]];
+   }
+   vector<int> recvCnts(nTasks_, 1);
+   unsigned nFinal;
+   MPI_Reduce_scatter(&nRecv[0], &nFinal, &recvCnts[0], MPI_UNSIGNED, MPI_SUM, comm_);
+
+   cells_.resize(max(max(nFinal, nLocal), 1u));
+   assignArray((unsigned char*)&(cells_[0]), &nLocal, cells_.capacity(),
+               sizeof(AnatomyCell), &(dest[0]), 0, comm_);
+   assert(nLocal == nFinal);
+   cells_.resize(nLocal);
+}
+
+/** Finds the neighbors of the local cells.  Neighbors that are on other
+ *  tasks become ghost cells whose labels come from the home task of
+ *  their gid.  Grid points that aren't tissue are dropped after the
+ *  first exchange of labels finds that no cell registered them. */
+void GraphBalancer::buildGraph()
+{
+   sort(cells_.begin(), cells_.end(), AnatomyCellGidSort());
+   unsigned nLocal = cells_.size();
+   vector<Long64> gid(nLocal+1);
+   for (unsigned ii=0; ii<nLocal; ++ii)
+      gid[ii] = cells_[ii].gid_;
+
+   // The 18 neighbors of the 19 point stencil.
+   vector<Long64> nbrGid;
+   nbrOffset_.assign(nLocal+1, 0);
+   for (unsigned ii=0; ii<nLocal; ++ii)
+   {
+      GridPoint gp(gid[ii], nx_, ny_, nz_);
+      for (int kk=-1; kk<=1; ++kk)
+         for (int jj=-1; jj<=1; ++jj)
+            for (int ll=-1; ll<=1; ++ll)
+            {
+               int nOffsets = (ll != 0) + (jj != 0) + (kk != 0);
+               int x = gp.x + ll;
+               int y = gp.y + jj;
+               int z = gp.z + kk;
+               if (nOffsets == 0 || nOffsets == 3 ||
+                   x < 0 || x >= nx_ || y < 0 || y >= ny_ || z < 0 || z >= nz_)
+                  continue;
+               nbrGid.push_back(x + Long64(nx_)*(y + Long64(ny_)*z));
+            }
+      nbrOffset_[ii+1] = nbrGid.size();
+   }
+
+   vector<Long64> ghost;
+   for (unsigned ii=0; ii<nbrGid.size(); ++ii)
+      if (!binary_search(gid.begin(), gid.begin()+nLocal, nbrGid[ii]))
+         ghost.push_back(nbrGid[ii]);
+   sort(ghost.begin(), ghost.end());
+   ghost.erase(unique(ghost.begin(), ghost.end()), ghost.end());
+
+   nbr_.resize(nbrGid.size());
+   for (unsigned ii=0; ii<nbrGid.size(); ++ii)
+   {
+      vector<Long64>::iterator here = lower_bound(gid.begin(), gid.begin()+nLocal, nbrGid[ii]);
+      if (here != gid.begin()+nLocal && *here == nbrGid[ii])
+         nbr_[ii] = here - gid.begin();
+      else
+         nbr_[ii] = nLocal + (lower_bound(ghost.begin(), ghost.end(), nbrGid[ii]) - ghost.begin());
+   }
+
+   // The cells are sorted by gid so they are already grouped by home.
+   registerCnt_.assign(nTasks_, 0);
+   for (unsigned ii=0; ii<nLocal; ++ii)
+      ++registerCnt_[home(gid[ii])];
+   prefixSum(registerCnt_, registerOffset_);
+   homeCnt_.resize(nTasks_);
+   MPI_Alltoall(&registerCnt_[0], 1, MPI_INT, &homeCnt_[0], 1, MPI_INT, comm_);
+   prefixSum(homeCnt_, homeOffset_);
+   homeGid_.resize(homeOffset_[nTasks_]+1);
+   MPI_Alltoallv(&gid[0], &registerCnt_[0], &registerOffset_[0], MPI_LONG_LONG,
+                 &homeGid_[0], &homeCnt_[0], &homeOffset_[0], MPI_LONG_LONG, comm_);
+
+   label_.assign(nLocal + ghost.size() + 1, myRank_);
+   buildRequests(ghost);
+   exchangeLabels();
+   pruneGhosts();
+}
+
+void GraphBalancer::buildRequests(const vector<Long64>& ghostGid)
+{
+   ghostGid_ = ghostGid;
+   requestCnt_.assign(nTasks_, 0);
+   for (unsigned ii=0; ii<ghostGid_.size(); ++ii)
+      ++requestCnt_[home(ghostGid_[ii])];
+   prefixSum(requestCnt_, requestOffset_);
+   serveCnt_.resize(nTasks_);
+   MPI_Alltoall(&requestCnt_[0], 1, MPI_INT, &serveCnt_[0], 1, MPI_INT, comm_);
+   prefixSum(serveCnt_, serveOffset_);
+
+   vector<Long64> request(ghostGid_);
+   request.push_back(0);
+   vector<Long64> serveGid(serveOffset_[nTasks_]+1);
+   MPI_Alltoallv(&request[0], &requestCnt_[0], &requestOffset_[0], MPI_LONG_LONG,
+                 &serveGid[0], &serveCnt_[0], &serveOffset_[0], MPI_LONG_LONG, comm_);
+
+   int nHome = homeOffset_[nTasks_];
+   vector<pair<Long64, int> > index(nHome);
+   for (int ii=0; ii<nHome; ++ii)
+      index[ii] = make_pair(homeGid_[ii], ii);
+   sort(index.begin(), index.end());
+   serveSlot_.resize(serveOffset_[nTasks_]);
+   for (unsigned ii=0; ii<serveSlot_.size(); ++ii)
+   {
+      vector<pair<Long64, int> >::iterator here =
+         lower_bound(index.begin(), index.end(), make_pair(serveGid[ii], INT_MIN));
+      if (here != index.end() && here->first == serveGid[ii])
+         serveSlot_[ii] = here->second;
+      else
+         serveSlot_[ii] = -1;
+   }
+}
+
+/** Sends the labels of the local cells to their homes and gets the
+ *  labels of the ghost cells back.  Ghosts that aren't tissue get -1. */
+void GraphBalancer::exchangeLabels()
+{
+   unsigned nLocal = cells_.size();
+   vector<int> homeLabel(homeOffset_[nTasks_]+1);
+   MPI_Alltoallv(&label_[0], &registerCnt_[0], &registerOffset_[0], MPI_INT,
+                 &homeLabel[0], &homeCnt_[0], &homeOffset_[0], MPI_INT, comm_);
+   vector<int> reply(serveSlot_.size()+1);
+   for (unsigned ii=0; ii<serveSlot_.size(); ++ii)
+      reply[ii] = (serveSlot_[ii] < 0 ? -1 : homeLabel[serveSlot_[ii]]);
+   MPI_Alltoallv(&reply[0], &serveCnt_[0], &serveOffset_[0], MPI_INT,
+                 &label_[nLocal], &requestCnt_[0], &requestOffset_[0], MPI_INT, comm_);
+}
+
+void GraphBalancer::pruneGhosts()
+{
+   unsigned nLocal = cells_.size();
+   vector<int> newIndex(ghostGid_.size(), -1);
+   vector<Long64> tissue;
+   for (unsigned ii=0; ii<ghostGid_.size(); ++ii)
+      if (label_[nLocal+ii] >= 0)
+      {
+         newIndex[ii] = nLocal + tissue.size();
+         tissue.push_back(ghostGid_[ii]);
+      }
+
+   vector<int> offset(nLocal+1, 0);
+   vector<int> nbr;
+   for (unsigned ii=0; ii<nLocal; ++ii)
+   {
+      for (int kk=nbrOffset_[ii]; kk<nbrOffset_[ii+1]; ++kk)
+      {
+         int jj = nbr_[kk];
+         if (jj >= int(nLocal))
+            jj = newIndex[jj-nLocal];
+         if (jj >= 0)
+            nbr.push_back(jj);
+      }
+      offset[ii+1] = nbr.size();
+   }
+   nbrOffset_.swap(offset);
+   nbr_.swap(nbr);
+
+   label_.resize(nLocal + tissue.size() + 1);
+   buildRequests(tissue);
+   exchangeLabels();
+}
+
+/** Moves boundary cells to the neighboring domain that holds the most
+ *  of their neighbors when that is more than their own domain holds.
+ *  Only moves to higher numbered domains are allowed when direction
+ *  is positive and only to lower numbered ones otherwise, so two
+ *  neighbors never trade places.  The room a domain has below the
+ *  upper load limit is shared evenly among the tasks that want to move
+ *  cells into it, and likewise for the room above the lower limit of
+ *  the domains that lose cells.  Returns the number of cells moved on
+ *  all tasks. */
+int GraphBalancer::refineStep(int direction)
+{
+   unsigned nLocal = cells_.size();
+   vector<double> load;
+   computeLoad(load);
+   double aveLoad = 0;
+   for (int ii=0; ii<nTasks_; ++ii)
+      aveLoad += load[ii];
+   aveLoad /= nTasks_;
+   double maxLoad = (1 + tolerance_)*aveLoad;
+   double minLoad = (1 - tolerance_)*aveLoad;
+
+   vector<Move> candidate;
+   vector<int> nMovers(2*nTasks_, 0);
+   for (unsigned ii=0; ii<nLocal; ++ii)
+   {
+      int from = label_[ii];
+      int nOwn = 0;
+      int nDomains = 0;
+      int domain[18];
+      int count[18];
+      for (int kk=nbrOffset_[ii]; kk<nbrOffset_[ii+1]; ++kk)
+      {
+         int dd = label_[nbr_[kk]];
+         if (dd == from)
+         {
+            ++nOwn;
+            continue;
+         }
+         int jj = 0;
+         while (jj < nDomains && domain[jj] != dd)
+            ++jj;
+         if (jj == nDomains)
+         {
+            domain[nDomains] = dd;
+            count[nDomains++] = 0;
+         }
+         ++count[jj];
+      }
+      int to = -1;
+      int toCount = nOwn;
+      for (int jj=0; jj<nDomains; ++jj)
+      {
+         if ((domain[jj] - from)*direction <= 0)
+            continue;
+         if (count[jj] > toCount || (count[jj] == toCount && to >= 0 && domain[jj] < to))
+         {
+            to = domain[jj];
+            toCount = count[jj];
+         }
+      }
+      if (to < 0)
+         continue;
+      candidate.push_back(Move(toCount-nOwn, cells_[ii].gid_, ii, to));
+      nMovers[to] = 1;
+      nMovers[nTasks_+from] = 1;
+   }
+   MPI_Allreduce(MPI_IN_PLACE, &nMovers[0], 2*nTasks_, MPI_INT, MPI_SUM, comm_);
+
+   // A cell doesn't move when a local neighbor already moved in this
+   // step since its gain was computed with the neighbor where it was.
+   sort(candidate.begin(), candidate.end());
+   vector<double> moveIn(nTasks_, 0.0);
+   vector<double> moveOut(nTasks_, 0.0);
+   vector<char> moved(nLocal+1, 0);
+   int nMoved = 0;
+   for (unsigned ii=0; ii<candidate.size(); ++ii)
+   {
+      unsigned cell = candidate[ii].cell_;
+      int to = candidate[ii].to_;
+      int from = label_[cell];
+      bool nbrMoved = false;
+      for (int kk=nbrOffset_[cell]; kk<nbrOffset_[cell+1]; ++kk)
+         if (nbr_[kk] < int(nLocal) && moved[nbr_[kk]])
+            nbrMoved = true;
+      if (nbrMoved)
+         continue;
+      double ww = cost_(cells_[cell].cellType_);
+      if ((moveIn[to] + ww)*nMovers[to] > maxLoad - load[to] ||
+          (moveOut[from] + ww)*nMovers[nTasks_+from] > load[from] - minLoad)
+         continue;
+      label_[cell] = to;
+      moved[cell] = 1;
+      moveIn[to] += ww;
+      moveOut[from] += ww;
+      ++nMoved;
+   }
+   int nMovedGlobal;
+   MPI_Allreduce(&nMoved, &nMovedGlobal, 1, MPI_INT, MPI_SUM, comm_);
+   return nMovedGlobal;
+}
+
+void GraphBalancer::computeLoad(vector<double>& load)
+{
+   load.assign(nTasks_, 0.0);
+   for (unsigned ii=0; ii<cells_.size(); ++ii)
+      load[label_[ii]] += cost_(cells_[ii].cellType_);
+   MPI_Allreduce(MPI_IN_PLACE, &load[0], nTasks_, MPI_DOUBLE, MPI_SUM, comm_);
+}
+
+void GraphBalancer::printStatistics(const string& phase)
+{
+   vector<double> load;
+   computeLoad(load);
+   double maxLoad = 0;
+   double aveLoad = 0;
+   for (int ii=0; ii<nTasks_; ++ii)
+   {
+      maxLoad = max(maxLoad, load[ii]);
+      aveLoad += load[ii];
+   }
+   aveLoad /= nTasks_;
+
+   // Every cut edge is seen from both of its cells.
+   Long64 nCut = 0;
+   for (unsigned ii=0; ii<cells_.size(); ++ii)
+      for (int kk=nbrOffset_[ii]; kk<nbrOffset_[ii+1]; ++kk)
+         if (label_[nbr_[kk]] != label_[ii])
+            ++nCut;
+   Long64 nCutGlobal;
+   MPI_Allreduce(&nCut, &nCutGlobal, 1, MPI_LONG_LONG, MPI_SUM, comm_);
+   if (myRank_ == 0)
+      cout << "Graph balancer after " << phase
+           << ": load max/ave = " << maxLoad/aveLoad
+           << ", cut edges = " << nCutGlobal/2 << endl;
+}
@@ -0,0 +1,94 @@
+#ifndef GRAPH_BALANCER_HH
+#define GRAPH_BALANCER_HH
+
+#include <string>
+#include <vector>
+#include <mpi.h>
+#include "AnatomyCell.hh"
+#include "Long64.hh"
+#include "ReactionCost.hh"
+
+class Anatomy;
+
+struct GraphBalancerParms
+{
+   bool verbose;
+   int maxRefineSteps;
+   double tolerance;
+   ReactionCost cost; // load of each cell
+};
+
+/** Partitions the cells into one domain per task by geometric
+ *  recursive bisection followed by refinement on the graph of the
+ *  cells.  Two cells are connected when they share a face or an edge,
+ *  as in the 19 point stencil of the diffusion, so the edges cut by
+ *  the domain boundaries are what goes into the halos.
+ *
+ *  The bisection only looks at the coordinates of the cells, not at
+ *  the graph.  Each level cuts every domain across its longest extent
+ *  so that each half carries the load of the tasks it will be split
+ *  among, all domains of a level at once with a few reductions.  Only
+ *  the refinement uses the graph: a cell moves to a neighboring
+ *  domain that holds more of its neighbors than its own domain does,
+ *  as long as the loads stay within tolerance of the average.  The geometric cuts
+ *  follow the extents of the tissue and the refinement follows the
+ *  tissue itself, which is what matters for thin walls and fibers
+ *  where a domain boundary would otherwise cut the tissue obliquely.
+ *
+ *  DECOMPOSITION keywords (method = graph):
+ *    maxRefineSteps (default 20) limits the refinement steps.  Steps
+ *      alternate between moving cells to higher and to lower numbered
+ *      domains and stop when neither moves a cell.
+ *    tolerance (default 0.03) is how far the load of a domain may move
+ *      from the average during the refinement.
+ *    verbose (default 1) prints the load and cut after each phase.
+ */
+class GraphBalancer
+{
+ public:
+
+   GraphBalancer(Anatomy& anatomy, const GraphBalancerParms& parms, MPI_Comm comm);
+
+ private:
+
+   void bisectGeometrically();
+   void sendCellsToDestinations();
+   void buildGraph();
+   void buildRequests(const std::vector<Long64>& ghostGid);
+   void exchangeLabels();
+   void pruneGhosts();
+   int refineStep(int direction);
+   void computeLoad(std::vector<double>& load);
+   void printStatistics(const std::string& phase);
+   int home(Long64 gid) const {return (gid*nTasks_)/nGrid_;}
+
+   bool verbose_;
+   int maxRefineSteps_;
+   double tolerance_;
+   ReactionCost cost_;
+
+   MPI_Comm comm_;
+   int myRank_;
+   int nTasks_;
+   int nx_, ny_, nz_;
+   Long64 nGrid_;
+
+   std::vector<AnatomyCell>& cells_;
+
+   // The local cells, sorted by gid, then the ghost cells.
+   std::vector<int> label_;
+   std::vector<int> nbrOffset_;
+   std::vector<int> nbr_;
+   std::vector<Long64> ghostGid_;
+
+   // Every cell registers its label with the home task of its gid,
+   // which answers the requests for the labels of ghost cells.
+   std::vector<int> registerCnt_, registerOffset_;
+   std::vector<int> homeCnt_, homeOffset_;
+   std::vector<Long64> homeGid_;
+   std::vector<int> requestCnt_, requestOffset_;
+   std::vector<int> serveCnt_, serveOffset_;
+   std::vector<int> serveSlot_;
+};
+
+#endif
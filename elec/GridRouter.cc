@@ -19,7 +19,11 @@
 // #include <sstream> //ddt
 using namespace std;
 
-GridRouter::GridRouter(vector<Long64>& gid, int nx, int ny, int nz, MPI_Comm comm)
+/** haloDepth is the number of stencil applications the halo must
+ *  support.  The remote cells are all cells that can be reached from a
+ *  local cell in haloDepth or fewer stencil steps. */
+GridRouter::GridRouter(vector<Long64>& gid, int nx, int ny, int nz, MPI_Comm comm,
+                       int haloDepth)
 : comm_(comm)
 {
    int nTasks, myRank;
@@ -46,14 +50,21 @@ GridRouter::GridRouter(vector<Long64>& gid, int nx, int ny, int nz, MPI_Comm com
    // telling. 
    vector<Long64> neededCells;
    {//scope
+      assert(haloDepth > 0);
       set<Long64> stencilGids;
-      set<Long64> myGids;
-      for (unsigned ii=0; ii<gid.size(); ++ii)
+      set<Long64> myGids(gid.begin(), gid.end());
+      vector<Long64> front(gid);
+      for (int iLayer=0; iLayer<haloDepth; ++iLayer)
       {
-         myGids.insert(gid[ii]);
-         Grid3DStencil stencil(gid[ii], nx, ny, nz);
-         for (int jj=0; jj<stencil.nStencil(); ++jj)
-            stencilGids.insert(stencil[jj]);
+         vector<Long64> nextFront;
+         for (unsigned ii=0; ii<front.size(); ++ii)
+         {
+            Grid3DStencil stencil(front[ii], nx, ny, nz);
+            for (int jj=0; jj<stencil.nStencil(); ++jj)
+               if (stencilGids.insert(stencil[jj]).second)
+                  nextFront.push_back(stencil[jj]);
+         }
+         front.swap(nextFront);
       }
       set_difference(stencilGids.begin(), stencilGids.end(),
                      myGids.begin(), myGids.end(), 
@@ -20,7 +20,8 @@ class GridRouter
    
   public:
   
-   GridRouter(std::vector<Long64>& gid, int nx, int ny, int nz, MPI_Comm comm);
+   GridRouter(std::vector<Long64>& gid, int nx, int ny, int nz, MPI_Comm comm,
+              int haloDepth=1);
    CommTable commTable() const;
    const std::vector<int>& sendMap() const {return sendMap_;}
 };
@@ -0,0 +1,93 @@
+#include "HaloCodec.hh"
+
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <inttypes.h>
+
+using namespace std;
+
+HaloCodec::HaloCodec(HaloCodecType type, unsigned width,
+                     const vector<int>& sendOffset,
+                     const vector<int>& recvOffset)
+: type_(type), itemBytes_(width), headerBytes_(0),
+  sendOffset_(sendOffset), recvOffset_(recvOffset),
+  validate_(false), maxError_(0)
+{
+   assert(type_ == haloCodecNone || width == sizeof(double));
+   if (type_ == haloCodecFloat)
+      itemBytes_ = sizeof(float);
+   if (type_ == haloCodecDelta16)
+   {
+      itemBytes_ = sizeof(int16_t);
+      headerBytes_ = sizeof(double);
+      sendRef_.assign(sendOffset_.back(), 0.0);
+   }
+}
+
+void HaloCodec::encode(const double* send, char* wire)
+{
+   assert(type_ != haloCodecNone);
+   if (type_ == haloCodecFloat)
+   {
+      float* out = (float*) wire;
+      int nSend = sendOffset_.back();
+      for (int ii=0; ii<nSend; ++ii)
+         out[ii] = send[ii];
+      if (validate_)
+         for (int ii=0; ii<nSend; ++ii)
+            maxError_ = max(maxError_, fabs(send[ii] - double(out[ii])));
+      return;
+   }
+
+   for (unsigned iMsg=0; iMsg+1<sendOffset_.size(); ++iMsg)
+   {
+      int begin = sendOffset_[iMsg];
+      int end = sendOffset_[iMsg+1];
+      double* ref = &sendRef_[0];
+      double maxDelta = 0;
+      for (int ii=begin; ii<end; ++ii)
+         maxDelta = max(maxDelta, fabs(send[ii] - ref[ii]));
+      double scale = maxDelta/32767;
+
+      char* msg = wire + wireOffset(sendOffset_, iMsg);
+      memcpy(msg, &scale, sizeof(double));
+      int16_t* out = (int16_t*) (msg + headerBytes_);
+      for (int ii=begin; ii<end; ++ii)
+      {
+         int16_t qq = 0;
+         if (scale > 0)
+            qq = lround((send[ii] - ref[ii])/scale);
+         out[ii-begin] = qq;
+         ref[ii] += qq*scale; // exactly what decode does
+      }
+      if (validate_)
+         for (int ii=begin; ii<end; ++ii)
+            maxError_ = max(maxError_, fabs(send[ii] - ref[ii]));
+   }
+}
+
+void HaloCodec::decode(const char* wire, double* recv) const
+{
+   assert(type_ != haloCodecNone);
+   if (type_ == haloCodecFloat)
+   {
+      const float* in = (const float*) wire;
+      int nRecv = recvOffset_.back();
+      for (int ii=0; ii<nRecv; ++ii)
+         recv[ii] = in[ii];
+      return;
+   }
+
+   for (unsigned iMsg=0; iMsg+1<recvOffset_.size(); ++iMsg)
+   {
+      const char* msg = wire + wireOffset(recvOffset_, iMsg);
+      double scale;
+      memcpy(&scale, msg, sizeof(double));
+      const int16_t* in = (const int16_t*) (msg + headerBytes_);
+      int begin = recvOffset_[iMsg];
+      int end = recvOffset_[iMsg+1];
+      for (int ii=begin; ii<end; ++ii)
+         recv[ii] += in[ii-begin]*scale;
+   }
+}
@@ -0,0 +1,56 @@
+#ifndef HALO_CODEC_HH
+#define HALO_CODEC_HH
+
+#include <vector>
+
+enum HaloCodecType {haloCodecNone, haloCodecFloat, haloCodecDelta16};
+
+/** Wire format of the halo messages of a HaloExchange<double>.
+ *
+ *  haloCodecNone sends the items as they are.  haloCodecFloat sends
+ *  each value as a float.  haloCodecDelta16 sends the difference from
+ *  the value the receiver got last time, quantized to 16 bits with one
+ *  scale per message so that the error is at most half of the largest
+ *  difference in the message divided by 32767.  The sender keeps the
+ *  same reconstruction as the receiver so quantization errors are
+ *  corrected by the next exchange instead of accumulating.
+ *
+ *  Message ii starts at byte offset[ii]*itemBytes() + ii*headerBytes()
+ *  on the wire, where offset is the _sendOffset or _recvOffset of the
+ *  CommTable.
+ *
+ *  With validation on, encode tracks the largest difference between a
+ *  value and what the receiver will reconstruct from it. */
+class HaloCodec
+{
+ public:
+   HaloCodec(HaloCodecType type, unsigned width,
+             const std::vector<int>& sendOffset,
+             const std::vector<int>& recvOffset);
+
+   HaloCodecType type() const {return type_;}
+   unsigned itemBytes() const {return itemBytes_;}
+   unsigned headerBytes() const {return headerBytes_;}
+   unsigned wireOffset(const std::vector<int>& offset, unsigned ii) const
+   {
+      return offset[ii]*itemBytes_ + ii*headerBytes_;
+   }
+
+   void encode(const double* send, char* wire);
+   void decode(const char* wire, double* recv) const;
+
+   void validate() {validate_ = true;}
+   double maxError() const {return maxError_;}
+
+ private:
+   HaloCodecType type_;
+   unsigned itemBytes_;
+   unsigned headerBytes_;
+   const std::vector<int>& sendOffset_;
+   const std::vector<int>& recvOffset_;
+   std::vector<double> sendRef_; // receiver's values, for haloCodecDelta16
+   bool validate_;
+   double maxError_;
+};
+
+#endif
@@ -2,8 +2,11 @@
 #define HALO_EXCHANGE_HH
 
 #include <vector>
+#include <algorithm>
 #include <cassert>
+#include <cstring>
 #include "CommTable.hh"
+#include "HaloCodec.hh"
 #include <iostream>
 #include "PerformanceTimers.hh"
 #include "DeviceFor.hh"
@@ -13,6 +16,10 @@
 #include "spi_impl.h"
 #endif
 
+#ifdef USE_CUDA
+#include <cuda_runtime_api.h>
+#endif
+
 /**
  *  There are two ways of using this class.  The simplest is to call
  *  execute().  This method performs all aspects of the HaloExchange
@@ -76,8 +83,35 @@ class HaloExchangeBase
       stopTimer(PerformanceTimers::haloMove2BufTimer);
          
    }
+   /** Asks for an exchange without the send and receive buffers: item
+    *  ii of the send buffer is sent straight from
+    *  sendBase[sendMap[ii]] and item ii of the receive buffer lands
+    *  in recvBase[recvIndex[ii]].  Returns false when the
+    *  implementation can't do that, in which case the buffers must be
+    *  used as usual.  When it returns true neither fillSendBuffer nor
+    *  getRecvBuf are used, and the base arrays must stay put. */
+   virtual bool useDatatypes(const T* sendBase, T* recvBase, const unsigned* recvIndex)
+   {
+      return false;
+   }
+   /** Hands the DEFAULT_COMPUTE_SPACE copies of the send and receive
+    *  buffers straight to MPI, which must then be able to read device
+    *  memory (CUDA aware), instead of staging them through the host.
+    *  Returns false when there is no device or the implementation
+    *  can't do that. */
+   virtual bool useDeviceBuffers() {return false;}
+   /** Makes a lossy HaloCodec track its error, see codecError(). */
+   virtual void validateCodec() {}
+   /** Largest difference between a value this task sent and what the
+    *  receiver reconstructed, when validating. */
+   virtual double codecError() {return 0;}
    virtual ro_mgarray_ptr<T> getRecvBuf() = 0;
    virtual void startComm() = 0;
+   /** Gives MPI a chance to progress the exchange started by
+    *  startComm without blocking.  Returns true once all the messages
+    *  have arrived, after which wait() only finishes up.  A mode that
+    *  can't be tested always returns true and wait() does the work. */
+   virtual bool test() {return true;}
    virtual void wait() = 0;
    virtual void barrier() = 0;
 
@@ -101,7 +135,9 @@ class HaloExchange : public HaloExchangeBase<T>
    using HaloExchangeBase<T>::sendBuf_;
    using HaloExchangeBase<T>::sendMap_;
    using HaloExchangeBase<T>::width_;
-   HaloExchange(const std::vector<int>& sendMap, const CommTable* comm)
+   HaloExchange(const std::vector<int>& sendMap, const CommTable* comm,
+                HaloExchangeMode mode = haloIrecv,
+                HaloCodecType codec = haloCodecNone)
    : HaloExchangeBase<T>(sendMap,comm), bw_(1)
   {
      recvBuf_.resize(commTable_->recvSize()*2);
@@ -186,52 +222,182 @@ class HaloExchange : public HaloExchangeBase<T>
    using HaloExchangeBase<T>::sendMap_;
    using HaloExchangeBase<T>::width_;
 
-   HaloExchange(const std::vector<int>& sendMap, const CommTable* comm) 
+   /** Must be called by all tasks in comm->_comm when mode is
+    *  haloNeighbor, haloRma or haloShm since the graph communicator or
+    *  the window is built here.  A codec other than haloCodecNone needs
+    *  T = double. */
+   HaloExchange(const std::vector<int>& sendMap, const CommTable* comm,
+                HaloExchangeMode mode = haloIrecv,
+                HaloCodecType codec = haloCodecNone)
    : HaloExchangeBase<T>(sendMap,comm),
+     mode_(mode),
+     codec_(codec, width_, comm->_sendOffset, comm->_recvOffset),
      recvReq_(comm->recvSize()),
-     sendReq_(comm->sendSize())
+     sendReq_(comm->sendSize()),
+     persistentSend_(0),
+     persistentRecv_(0),
+     graphComm_(MPI_COMM_NULL),
+     window_(MPI_WIN_NULL),
+     windowBase_(0),
+     sendGroup_(MPI_GROUP_EMPTY),
+     recvGroup_(MPI_GROUP_EMPTY),
+     nodeComm_(MPI_COMM_NULL),
+     shmWindow_(MPI_WIN_NULL),
+     shmBase_(0),
+     shmHalf_(0),
+     parity_(0),
+     bufferSpace_(CPU),
+     sendBase_(0),
+     recvBase_(0)
    {
       recvBuf_.resize(comm->recvSize());
+      if (codec != haloCodecNone)
+      {
+         // one extra byte so that &v[0] is valid without neighbors
+         sendWire_.resize(codec_.wireOffset(comm->_sendOffset, comm->_sendTask.size())+1);
+         recvWire_.resize(codec_.wireOffset(comm->_recvOffset, comm->_recvTask.size())+1);
+         // delta16 adds to the last halo, which starts at zero
+         memset((void*)recvBuf_.writeonly(CPU).raw(), 0, comm->recvSize()*width_);
+      }
+      if (mode_ == haloNeighbor)
+         buildGraphComm();
+      if (mode_ == haloRma)
+      {
+         // A lone task has nothing to exchange and some MPIs have no
+         // one sided component for a single process.
+         int nTasks;
+         MPI_Comm_size(comm->_comm, &nTasks);
+         if (nTasks == 1)
+            mode_ = haloIrecv;
+         else
+            buildWindow();
+      }
+      if (mode_ == haloShm)
+         buildShm();
    }
-   
+
+   ~HaloExchange()
+   {
+      int finalized;
+      MPI_Finalized(&finalized);
+      if (finalized)
+         return;
+      freePersistent();
+      freeDatatypes();
+      if (graphComm_ != MPI_COMM_NULL)
+         MPI_Comm_free(&graphComm_);
+      if (window_ != MPI_WIN_NULL)
+         MPI_Win_free(&window_);
+      if (shmWindow_ != MPI_WIN_NULL)
+      {
+         MPI_Win_unlock_all(shmWindow_);
+         MPI_Win_free(&shmWindow_);
+      }
+      if (nodeComm_ != MPI_COMM_NULL)
+         MPI_Comm_free(&nodeComm_);
+      if (sendGroup_ != MPI_GROUP_EMPTY)
+         MPI_Group_free(&sendGroup_);
+      if (recvGroup_ != MPI_GROUP_EMPTY)
+         MPI_Group_free(&recvGroup_);
+   }
+
    virtual void startComm()
    {
 #pragma omp critical 
       {
-         const char* sendBuf = (const char*)sendBuf_.readonly(CPU).raw();
-         char* recvBuf = (char*)recvBuf_.writeonly(CPU).raw();
-
-         MPI_Request* recvReq = &recvReq_[0];
-         const int tag = 151515;
-         for (unsigned ii=0; ii< commTable_->_recvTask.size(); ++ii)
+         const char* sendBuf = sendBase_;
+         char* recvBuf = recvBase_;
+         if (codec_.type() != haloCodecNone)
          {
-            assert(recvBuf);
-            unsigned sender = commTable_->_recvTask[ii];
-            unsigned nItems = commTable_->_recvOffset[ii+1] - commTable_->_recvOffset[ii];
-            unsigned len = nItems * width_;
-            char* recvPtr = recvBuf + commTable_->_recvOffset[ii]*width_;
-            MPI_Irecv(recvPtr, len, MPI_CHAR, sender, tag, commTable_->_comm, recvReq+ii);
+            codec_.encode((const double*)sendBuf_.readonly(CPU).raw(), &sendWire_[0]);
+            sendBuf = &sendWire_[0];
+            recvBuf = &recvWire_[0];
          }
- 
-         MPI_Request* sendReq = &sendReq_[0];
-         for (unsigned ii=0; ii<commTable_->_sendTask.size(); ++ii)
+         else if (sendType_.empty())
          {
-            assert(sendBuf);
-            unsigned target = commTable_->_sendTask[ii];
-            unsigned nItems = commTable_->_sendOffset[ii+1] - commTable_->_sendOffset[ii];
-            unsigned len = nItems * width_;
-            const char* sendPtr = sendBuf + commTable_->_sendOffset[ii]*width_;
-            MPI_Isend(sendPtr, len, MPI_CHAR, target, tag, commTable_->_comm, sendReq+ii);
+            sendBuf = (const char*)sendBuf_.readonly(bufferSpace_).raw();
+            recvBuf = (char*)recvBuf_.writeonly(bufferSpace_).raw();
+#ifdef USE_CUDA
+            // MPI doesn't know about the stream of the pack kernel
+            if (bufferSpace_ != CPU)
+               cudaDeviceSynchronize();
+#endif
+         }
+
+         switch (mode_)
+         {
+           case haloIrecv:
+            startIrecv(sendBuf, recvBuf);
+            break;
+           case haloPersistent:
+            startPersistent(sendBuf, recvBuf);
+            break;
+           case haloNeighbor:
+            MPI_Ineighbor_alltoallv(const_cast<char*>(sendBuf), &sendCount_[0], &sendDispl_[0], MPI_CHAR,
+                                    recvBuf, &recvCount_[0], &recvDispl_[0], MPI_CHAR,
+                                    graphComm_, &neighborReq_);
+            break;
+           case haloRma:
+            assert(recvBuf == windowBase_);
+            startRma(sendBuf);
+            break;
+           case haloShm:
+            startIrecv(sendBuf, recvBuf);
+            startShm(sendBuf);
+            break;
          }
       }
    };
    
+   virtual bool test()
+   {
+      int done = 1;
+#pragma omp critical
+      {
+         if (mode_ == haloNeighbor)
+            MPI_Test(&neighborReq_, &done, MPI_STATUS_IGNORE);
+         else if (mode_ != haloRma)
+         {
+            int flag;
+            MPI_Testall(commTable_->_recvTask.size(), &recvReq_[0], &flag, MPI_STATUSES_IGNORE);
+            done = flag;
+            MPI_Testall(commTable_->_sendTask.size(), &sendReq_[0], &flag, MPI_STATUSES_IGNORE);
+            done = done && flag;
+            if (mode_ == haloShm)
+            {
+               MPI_Test(&shmReq_, &flag, MPI_STATUS_IGNORE);
+               done = done && flag;
+            }
+         }
+      }
+      return done;
+   }
+
    virtual void wait()
    {
 #pragma omp critical              
-      {                                            
-         MPI_Waitall(commTable_->_sendTask.size(), &sendReq_[0], MPI_STATUS_IGNORE);
-         MPI_Waitall(commTable_->_recvTask.size(), &recvReq_[0], MPI_STATUS_IGNORE);
+      {
+         if (mode_ == haloNeighbor)
+            MPI_Wait(&neighborReq_, MPI_STATUS_IGNORE);
+         else if (mode_ == haloRma)
+         {
+            MPI_Win_complete(window_);
+            MPI_Win_wait(window_);
+         }
+         else
+         {
+            MPI_Waitall(commTable_->_sendTask.size(), &sendReq_[0], MPI_STATUS_IGNORE);
+            MPI_Waitall(commTable_->_recvTask.size(), &recvReq_[0], MPI_STATUS_IGNORE);
+         }
+         if (mode_ == haloShm)
+         {
+            if (codec_.type() != haloCodecNone)
+               finishShm(&recvWire_[0]);
+            else
+               finishShm((char*)recvBuf_.readwrite(CPU).raw());
+         }
+         if (codec_.type() != haloCodecNone)
+            codec_.decode(&recvWire_[0], (double*)recvBuf_.readwrite(CPU).raw());
       }
    };
 
@@ -244,11 +410,371 @@ class HaloExchange : public HaloExchangeBase<T>
    {
       return recvBuf_;
    }
+
+   virtual void validateCodec() {codec_.validate();}
+   virtual double codecError() {return codec_.maxError();}
+
+   /** Only the modes that hand the buffers to MPI untouched qualify,
+    *  not the ones that copy (haloShm), encode (codecs) or expose them
+    *  through a window (haloRma). */
+   virtual bool useDeviceBuffers()
+   {
+      if (NUMSPACES == 1 || !sendType_.empty() || codec_.type() != haloCodecNone)
+         return false;
+      if (mode_ != haloIrecv && mode_ != haloPersistent && mode_ != haloNeighbor)
+         return false;
+      bufferSpace_ = DEFAULT_COMPUTE_SPACE;
+      return true;
+   }
+
+   /** Builds one hindexed block type per message.  Only the point to
+    *  point modes support this, and the receive indices must not
+    *  repeat since MPI forbids overlapping receive types. */
+   virtual bool useDatatypes(const T* sendBase, T* recvBase, const unsigned* recvIndex)
+   {
+      if ((mode_ != haloIrecv && mode_ != haloPersistent) || !sendBase || !recvBase)
+         return false;
+      if (bufferSpace_ != CPU)
+         return false;
+      if (codec_.type() != haloCodecNone)
+         return false;
+      unsigned nRecv = commTable_->recvSize();
+      std::vector<unsigned> sorted(recvIndex, recvIndex+nRecv);
+      std::sort(sorted.begin(), sorted.end());
+      if (std::adjacent_find(sorted.begin(), sorted.end()) != sorted.end())
+         return false;
+
+      freeDatatypes();
+      ro_array_ptr<int> sendMap = sendMap_.readonly(CPU);
+      std::vector<MPI_Aint> displ;
+      sendType_.resize(commTable_->_sendTask.size());
+      for (unsigned ii=0; ii<sendType_.size(); ++ii)
+      {
+         displ.clear();
+         for (int jj=commTable_->_sendOffset[ii]; jj<commTable_->_sendOffset[ii+1]; ++jj)
+            displ.push_back(MPI_Aint(sendMap[jj])*width_);
+         displ.push_back(0);
+         MPI_Type_create_hindexed_block(displ.size()-1, width_, &displ[0], MPI_BYTE, &sendType_[ii]);
+         MPI_Type_commit(&sendType_[ii]);
+      }
+      recvType_.resize(commTable_->_recvTask.size());
+      for (unsigned ii=0; ii<recvType_.size(); ++ii)
+      {
+         displ.clear();
+         for (int jj=commTable_->_recvOffset[ii]; jj<commTable_->_recvOffset[ii+1]; ++jj)
+            displ.push_back(MPI_Aint(recvIndex[jj])*width_);
+         displ.push_back(0);
+         MPI_Type_create_hindexed_block(displ.size()-1, width_, &displ[0], MPI_BYTE, &recvType_[ii]);
+         MPI_Type_commit(&recvType_[ii]);
+      }
+      sendBase_ = (const char*)sendBase;
+      recvBase_ = (char*)recvBase;
+      return true;
+   }
    
  private:
+   /** Address, count and type of send message ii, either a slice of
+    *  the send buffer or the derived type over sendBase_. */
+   void sendMsg(unsigned ii, const char* sendBuf, const char*& ptr, int& count, MPI_Datatype& type) const
+   {
+      if (!sendType_.empty())
+      {
+         ptr = sendBase_; count = 1; type = sendType_[ii];
+         return;
+      }
+      const std::vector<int>& offset = commTable_->_sendOffset;
+      ptr = sendBuf + codec_.wireOffset(offset, ii);
+      count = codec_.wireOffset(offset, ii+1) - codec_.wireOffset(offset, ii);
+      type = MPI_CHAR;
+   }
+
+   void recvMsg(unsigned ii, char* recvBuf, char*& ptr, int& count, MPI_Datatype& type) const
+   {
+      if (!recvType_.empty())
+      {
+         ptr = recvBase_; count = 1; type = recvType_[ii];
+         return;
+      }
+      const std::vector<int>& offset = commTable_->_recvOffset;
+      ptr = recvBuf + codec_.wireOffset(offset, ii);
+      count = codec_.wireOffset(offset, ii+1) - codec_.wireOffset(offset, ii);
+      type = MPI_CHAR;
+   }
+
+   void freeDatatypes()
+   {
+      for (unsigned ii=0; ii<sendType_.size(); ++ii)
+         MPI_Type_free(&sendType_[ii]);
+      for (unsigned ii=0; ii<recvType_.size(); ++ii)
+         MPI_Type_free(&recvType_[ii]);
+      sendType_.clear();
+      recvType_.clear();
+   }
+
+   void startIrecv(const char* sendBuf, char* recvBuf)
+   {
+      MPI_Request* recvReq = &recvReq_[0];
+      const int tag = 151515;
+      for (unsigned ii=0; ii< commTable_->_recvTask.size(); ++ii)
+      {
+         if (!recvOnNode_.empty() && recvOnNode_[ii])
+         {
+            recvReq[ii] = MPI_REQUEST_NULL;
+            continue;
+         }
+         assert(recvBuf);
+         unsigned sender = commTable_->_recvTask[ii];
+         char* recvPtr; int len; MPI_Datatype type;
+         recvMsg(ii, recvBuf, recvPtr, len, type);
+         MPI_Irecv(recvPtr, len, type, sender, tag, commTable_->_comm, recvReq+ii);
+      }
+ 
+      MPI_Request* sendReq = &sendReq_[0];
+      for (unsigned ii=0; ii<commTable_->_sendTask.size(); ++ii)
+      {
+         if (!sendOnNode_.empty() && sendOnNode_[ii])
+         {
+            sendReq[ii] = MPI_REQUEST_NULL;
+            continue;
+         }
+         assert(sendBuf);
+         unsigned target = commTable_->_sendTask[ii];
+         const char* sendPtr; int len; MPI_Datatype type;
+         sendMsg(ii, sendBuf, sendPtr, len, type);
+         MPI_Isend(sendPtr, len, type, target, tag, commTable_->_comm, sendReq+ii);
+      }
+   }
+
+   /** The persistent requests are bound to the buffer addresses so
+    *  they are (re)built whenever the buffers have moved.  Since the
+    *  buffers are never resized this normally happens only once. */
+   void startPersistent(const char* sendBuf, char* recvBuf)
+   {
+      if (sendBuf != persistentSend_ || recvBuf != persistentRecv_)
+      {
+         freePersistent();
+         const int tag = 151515;
+         for (unsigned ii=0; ii< commTable_->_recvTask.size(); ++ii)
+         {
+            char* recvPtr; int len; MPI_Datatype type;
+            recvMsg(ii, recvBuf, recvPtr, len, type);
+            MPI_Recv_init(recvPtr, len, type, commTable_->_recvTask[ii],
+                          tag, commTable_->_comm, &recvReq_[ii]);
+         }
+         for (unsigned ii=0; ii<commTable_->_sendTask.size(); ++ii)
+         {
+            const char* sendPtr; int len; MPI_Datatype type;
+            sendMsg(ii, sendBuf, sendPtr, len, type);
+            MPI_Send_init(const_cast<char*>(sendPtr), len, type, commTable_->_sendTask[ii],
+                          tag, commTable_->_comm, &sendReq_[ii]);
+         }
+         persistentSend_ = sendBuf;
+         persistentRecv_ = recvBuf;
+      }
+      MPI_Startall(commTable_->_recvTask.size(), &recvReq_[0]);
+      MPI_Startall(commTable_->_sendTask.size(), &sendReq_[0]);
+   }
+
+   void freePersistent()
+   {
+      if (persistentSend_ == 0 && persistentRecv_ == 0)
+         return;
+      for (unsigned ii=0; ii< commTable_->_recvTask.size(); ++ii)
+         MPI_Request_free(&recvReq_[ii]);
+      for (unsigned ii=0; ii<commTable_->_sendTask.size(); ++ii)
+         MPI_Request_free(&sendReq_[ii]);
+      persistentSend_ = 0;
+      persistentRecv_ = 0;
+   }
+
+   /** The sources and destinations of the graph are in the same order
+    *  as the CommTable so the byte counts and displacements of the
+    *  neighborhood collective come straight from the offsets. */
+   void buildGraphComm()
+   {
+      // one extra element so that &v[0] is valid without neighbors
+      std::vector<int> recvTask(commTable_->_recvTask);
+      std::vector<int> sendTask(commTable_->_sendTask);
+      recvTask.push_back(-1);
+      sendTask.push_back(-1);
+      MPI_Dist_graph_create_adjacent(commTable_->_comm,
+                                     recvTask.size()-1, &recvTask[0], MPI_UNWEIGHTED,
+                                     sendTask.size()-1, &sendTask[0], MPI_UNWEIGHTED,
+                                     MPI_INFO_NULL, 0, &graphComm_);
+      recvTask.pop_back();
+      sendTask.pop_back();
+
+      recvCount_.resize(recvTask.size()+1);
+      recvDispl_.resize(recvTask.size()+1);
+      for (unsigned ii=0; ii<recvTask.size(); ++ii)
+      {
+         recvDispl_[ii] = codec_.wireOffset(commTable_->_recvOffset, ii);
+         recvCount_[ii] = codec_.wireOffset(commTable_->_recvOffset, ii+1) - recvDispl_[ii];
+      }
+      sendCount_.resize(sendTask.size()+1);
+      sendDispl_.resize(sendTask.size()+1);
+      for (unsigned ii=0; ii<sendTask.size(); ++ii)
+      {
+         sendDispl_[ii] = codec_.wireOffset(commTable_->_sendOffset, ii);
+         sendCount_[ii] = codec_.wireOffset(commTable_->_sendOffset, ii+1) - sendDispl_[ii];
+      }
+   }
+
+   /** Post-start-complete-wait epochs.  Posting exposes our receive
+    *  buffer only once startComm is called, i.e., after the previous
+    *  halo was copied out, so no receiver side handshake is needed.
+    *  The target offsets were computed by the CommTable. */
+   void startRma(const char* sendBuf)
+   {
+      MPI_Win_post(recvGroup_, 0, window_);
+      MPI_Win_start(sendGroup_, 0, window_);
+      for (unsigned ii=0; ii<commTable_->_putTask.size(); ++ii)
+      {
+         const char* sendPtr; int len; MPI_Datatype type;
+         sendMsg(commTable_->_putIdx[ii], sendBuf, sendPtr, len, type);
+         // _putCntOffset is the message index on the receiver
+         MPI_Aint disp = MPI_Aint(commTable_->_putOffset[ii])*codec_.itemBytes()
+            + commTable_->_putCntOffset[ii]*codec_.headerBytes();
+         MPI_Put(const_cast<char*>(sendPtr), len, MPI_CHAR,
+                 commTable_->_putTask[ii], disp, len, MPI_CHAR, window_);
+      }
+   }
+
+   void buildWindow()
+   {
+      if (codec_.type() != haloCodecNone)
+         windowBase_ = &recvWire_[0];
+      else
+         windowBase_ = (char*)recvBuf_.writeonly(CPU).raw();
+      MPI_Aint size = codec_.wireOffset(commTable_->_recvOffset, commTable_->_recvTask.size());
+      MPI_Win_create(windowBase_, size, 1,
+                     MPI_INFO_NULL, commTable_->_comm, &window_);
+
+      MPI_Group group;
+      MPI_Comm_group(commTable_->_comm, &group);
+      if (!commTable_->_sendTask.empty())
+         MPI_Group_incl(group, commTable_->_sendTask.size(), &commTable_->_sendTask[0], &sendGroup_);
+      if (!commTable_->_recvTask.empty())
+         MPI_Group_incl(group, commTable_->_recvTask.size(), &commTable_->_recvTask[0], &recvGroup_);
+      MPI_Group_free(&group);
+   }
+
+   /** The shared window of each task holds two copies of its receive
+    *  buffer (as encoded on the wire), used on alternate exchanges.
+    *  The senders on the node copy into the copy of this exchange and
+    *  enter a node wide MPI_Ibarrier; the receiver copies out after the
+    *  barrier.  A task can only start writing the same copy again
+    *  after the next barrier, which every task enters after it has
+    *  copied out, so no other handshake is needed. */
+   void startShm(const char* sendBuf)
+   {
+      parity_ = 1 - parity_;
+      for (unsigned ii=0; ii<putBase_.size(); ++ii)
+      {
+         if (!putBase_[ii])
+            continue;
+         const char* sendPtr; int len; MPI_Datatype type;
+         sendMsg(commTable_->_putIdx[ii], sendBuf, sendPtr, len, type);
+         MPI_Aint disp = parity_*putHalf_[ii]
+            + MPI_Aint(commTable_->_putOffset[ii])*codec_.itemBytes()
+            + commTable_->_putCntOffset[ii]*codec_.headerBytes();
+         memcpy(putBase_[ii]+disp, sendPtr, len);
+      }
+      MPI_Win_sync(shmWindow_);
+      MPI_Ibarrier(nodeComm_, &shmReq_);
+   }
+
+   void finishShm(char* recvBuf)
+   {
+      MPI_Wait(&shmReq_, MPI_STATUS_IGNORE);
+      MPI_Win_sync(shmWindow_);
+      const char* shm = shmBase_ + parity_*shmHalf_;
+      const std::vector<int>& offset = commTable_->_recvOffset;
+      for (unsigned ii=0; ii<recvOnNode_.size(); ++ii)
+      {
+         if (!recvOnNode_[ii])
+            continue;
+         unsigned begin = codec_.wireOffset(offset, ii);
+         memcpy(recvBuf+begin, shm+begin, codec_.wireOffset(offset, ii+1)-begin);
+      }
+   }
+
+   void buildShm()
+   {
+      MPI_Comm_split_type(commTable_->_comm, MPI_COMM_TYPE_SHARED, 0,
+                          MPI_INFO_NULL, &nodeComm_);
+      std::vector<int> nodeRank = commTable_->nodeRanks(nodeComm_);
+
+      shmHalf_ = codec_.wireOffset(commTable_->_recvOffset, commTable_->_recvTask.size());
+      MPI_Info info;
+      MPI_Info_create(&info);
+      MPI_Info_set(info, (char*)"alloc_shared_noncontig", (char*)"true");
+      MPI_Win_allocate_shared(2*shmHalf_, 1, info, nodeComm_, &shmBase_, &shmWindow_);
+      MPI_Info_free(&info);
+      MPI_Win_lock_all(MPI_MODE_NOCHECK, shmWindow_);
+
+      recvOnNode_.resize(commTable_->_recvTask.size());
+      for (unsigned ii=0; ii<recvOnNode_.size(); ++ii)
+         recvOnNode_[ii] = (nodeRank[commTable_->_recvTask[ii]] >= 0);
+      sendOnNode_.resize(commTable_->_sendTask.size());
+      for (unsigned ii=0; ii<sendOnNode_.size(); ++ii)
+         sendOnNode_[ii] = (nodeRank[commTable_->_sendTask[ii]] >= 0);
+      // The segments can be larger than asked for so the size of a copy
+      // has to come from its owner.
+      int nNode;
+      MPI_Comm_size(nodeComm_, &nNode);
+      std::vector<MPI_Aint> half(nNode);
+      MPI_Allgather(&shmHalf_, 1, MPI_AINT, &half[0], 1, MPI_AINT, nodeComm_);
+      putBase_.assign(commTable_->_putTask.size(), (char*)0);
+      putHalf_.assign(commTable_->_putTask.size(), 0);
+      for (unsigned ii=0; ii<putBase_.size(); ++ii)
+      {
+         int target = nodeRank[commTable_->_putTask[ii]];
+         if (target < 0)
+            continue;
+         MPI_Aint size;
+         int dispUnit;
+         void* base;
+         MPI_Win_shared_query(shmWindow_, target, &size, &dispUnit, &base);
+         putBase_[ii] = (char*)base;
+         putHalf_[ii] = half[target];
+      }
+   }
+
+   HaloExchangeMode mode_;
+   HaloCodec codec_;
+   std::vector<char> sendWire_; // encoded messages, unless haloCodecNone
+   std::vector<char> recvWire_;
    lazy_array<T> recvBuf_;
    std::vector<MPI_Request> recvReq_;
    std::vector<MPI_Request> sendReq_;
+   const char* persistentSend_;
+   char* persistentRecv_;
+   MPI_Comm graphComm_;
+   MPI_Request neighborReq_;
+   std::vector<int> sendCount_; // in bytes, for haloNeighbor
+   std::vector<int> sendDispl_;
+   std::vector<int> recvCount_;
+   std::vector<int> recvDispl_;
+   MPI_Win window_;       // over recvBuf_, for haloRma
+   char* windowBase_;
+   MPI_Group sendGroup_;
+   MPI_Group recvGroup_;
+   MPI_Comm nodeComm_;    // for haloShm
+   MPI_Win shmWindow_;
+   char* shmBase_;
+   MPI_Aint shmHalf_;
+   int parity_;
+   MPI_Request shmReq_;
+   std::vector<char> recvOnNode_;
+   std::vector<char> sendOnNode_;
+   std::vector<char*> putBase_; // null for neighbors on other nodes
+   std::vector<MPI_Aint> putHalf_;
+   ExecutionSpace bufferSpace_; // where MPI reads and writes the buffers
+   const char* sendBase_; // for useDatatypes
+   char* recvBase_;
+   std::vector<MPI_Datatype> sendType_;
+   std::vector<MPI_Datatype> recvType_;
 };
 
 #endif // ifdef SPI
@@ -261,8 +787,10 @@ class HaloExchangeDevice : public HaloExchange<T>
    using HaloExchangeBase<T>::sendBuf_;
    using HaloExchangeBase<T>::sendMap_;
    
-   HaloExchangeDevice(const std::vector<int>& sendMap, const CommTable* comm)
-     : HaloExchange<T>(sendMap, comm)
+   HaloExchangeDevice(const std::vector<int>& sendMap, const CommTable* comm,
+                      HaloExchangeMode mode = haloIrecv,
+                      HaloCodecType codec = haloCodecNone)
+     : HaloExchange<T>(sendMap, comm, mode, codec)
    {};
 
    ~HaloExchangeDevice()
@@ -276,8 +804,15 @@ class HaloExchangeDevice : public HaloExchange<T>
       ro_array_ptr<int> sendMap = sendMap_.readonly(DEFAULT_COMPUTE_SPACE);
       wo_array_ptr<T> sendBuf = sendBuf_.writeonly(DEFAULT_COMPUTE_SPACE);
       ro_array_ptr<T> data = _data.useOn(DEFAULT_COMPUTE_SPACE);
+#ifdef USE_CUDA
       DEVICE_PARALLEL_FORALL(sendMap.size(), ii,
                              sendBuf[ii] = data[sendMap[ii]]);
+#else
+      int nSend = sendMap.size();
+      #pragma omp parallel for
+      for (int ii=0; ii<nSend; ++ii)
+         sendBuf[ii] = data[sendMap[ii]];
+#endif
 
       stopTimer(PerformanceTimers::haloMove2BufTimer);
    };
@@ -2,6 +2,7 @@
 
 #include "Interpolation.hh"
 #include "svd.h"
+#include "fitCache.hh"
 #include <set>
 #include <cmath>
 #include <cassert>
@@ -112,10 +113,31 @@ static vector<double> hornFromCheby(const vector<double>& chebyCoeff,
    return xCoeff;
 }
 
+/** Returns the fit from the FitCache if one is open and has it,
+ *  otherwise fits and adds the result to the cache. */
 double Interpolation::create(const vector<double>& inputs,
                              const vector<double>& outputs,
                              const double tolerance,
                              const double rangeWindow)
+{
+   string key;
+   if (FitCache::active())
+   {
+      key = FitCache::key(inputs, outputs, tolerance, rangeWindow);
+      double error;
+      if (FitCache::lookup(key, *this, error))
+         return error;
+   }
+   double error = fit(inputs, outputs, tolerance, rangeWindow);
+   if (!key.empty())
+      FitCache::store(key, *this, error);
+   return error;
+}
+
+double Interpolation::fit(const vector<double>& inputs,
+                          const vector<double>& outputs,
+                          const double tolerance,
+                          const double rangeWindow)
 {   
    double lb = inputs[0];
    double ub = inputs[inputs.size()-1];
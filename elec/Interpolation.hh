@@ -4,12 +4,20 @@
 #include <vector>
 
 #define MAX_TERM_COUNT 32
+// polynomials at least this long are evaluated with Estrin's scheme
+#ifndef ESTRIN_MIN_TERM_COUNT
+#define ESTRIN_MIN_TERM_COUNT 12
+#endif
 
 class Interpolation {
  public:
    template <typename TTT>
    inline TTT eval(const TTT xx)
    {
+      if (numNumer_ >= ESTRIN_MIN_TERM_COUNT || numDenom_ >= ESTRIN_MIN_TERM_COUNT)
+      {
+         return evalEstrin(xx);
+      }
       double * coeffCursor = &coeff_[0];
       TTT numer(coeffCursor[numNumer_-1]);
       switch (numNumer_)
@@ -97,11 +105,97 @@ class Interpolation {
       }
       return result;
    }
+
+   /** Same result as eval up to rounding.  Horner's rule is one long
+    *  chain of dependent multiply-adds; Estrin's scheme evaluates the
+    *  polynomial as a tree of depth log2(terms), which keeps more of
+    *  them in flight. */
+   template <typename TTT>
+   inline TTT evalEstrin(const TTT xx)
+   {
+      TTT xPow[5];
+      xPow[0] = xx;
+      for (int ii=1; ii<5; ii++)
+      {
+         xPow[ii] = xPow[ii-1]*xPow[ii-1];
+      }
+      const double* coeffCursor = &coeff_[0];
+      TTT numer = estrin(coeffCursor, numNumer_, xPow);
+      if (numDenom_ == 1)
+      {
+         return numer;
+      }
+      coeffCursor += numNumer_;
+      TTT denom = 1 + xx*estrin(coeffCursor, numDenom_-1, xPow);
+      return numer/denom;
+   }
+
+   /** Sum of coeff[ii]*x^ii for ii < nTerms, given xPow[kk] = x^(2^kk). */
+   template <typename TTT>
+   static inline TTT estrin(const double* coeff, const int nTerms, const TTT* xPow)
+   {
+      switch (nTerms)
+      {
+#define ESTRIN_CASE(nn) case nn: return EstrinPoly<nn,TTT>::eval(coeff, xPow);
+         ESTRIN_CASE( 1) ESTRIN_CASE( 2) ESTRIN_CASE( 3) ESTRIN_CASE( 4)
+         ESTRIN_CASE( 5) ESTRIN_CASE( 6) ESTRIN_CASE( 7) ESTRIN_CASE( 8)
+         ESTRIN_CASE( 9) ESTRIN_CASE(10) ESTRIN_CASE(11) ESTRIN_CASE(12)
+         ESTRIN_CASE(13) ESTRIN_CASE(14) ESTRIN_CASE(15) ESTRIN_CASE(16)
+         ESTRIN_CASE(17) ESTRIN_CASE(18) ESTRIN_CASE(19) ESTRIN_CASE(20)
+         ESTRIN_CASE(21) ESTRIN_CASE(22) ESTRIN_CASE(23) ESTRIN_CASE(24)
+         ESTRIN_CASE(25) ESTRIN_CASE(26) ESTRIN_CASE(27) ESTRIN_CASE(28)
+         ESTRIN_CASE(29) ESTRIN_CASE(30) ESTRIN_CASE(31) ESTRIN_CASE(32)
+#undef ESTRIN_CASE
+        default:
+         return TTT(0.0);
+      }
+   }
+
+ private:
+   /** Splits the polynomial at the largest power of two below its
+    *  length, P(x) = Plo(x) + x^lo*Phi(x), down to linear pieces.  The
+    *  recursion is resolved at compile time so each length becomes
+    *  straight line code like the Horner switch in eval. */
+   template <int NN, typename TTT>
+   struct EstrinPoly
+   {
+      enum { LOG_LO = (NN>16) ? 4 : (NN>8) ? 3 : (NN>4) ? 2 : (NN>2) ? 1 : 0,
+             LO = 1 << LOG_LO };
+      static inline TTT eval(const double* coeff, const TTT* xPow)
+      {
+         return EstrinPoly<LO,TTT>::eval(coeff, xPow)
+            + xPow[LOG_LO]*EstrinPoly<NN-LO,TTT>::eval(coeff+LO, xPow);
+      }
+   };
+   template <typename TTT>
+   struct EstrinPoly<2,TTT>
+   {
+      static inline TTT eval(const double* coeff, const TTT* xPow)
+      {
+         return coeff[0] + xPow[0]*TTT(coeff[1]);
+      }
+   };
+   template <typename TTT>
+   struct EstrinPoly<1,TTT>
+   {
+      static inline TTT eval(const double* coeff, const TTT*)
+      {
+         return TTT(coeff[0]);
+      }
+   };
+
+ public:
    double create(const std::vector<double>& inputs,
                  const std::vector<double>& outputs,
                  const double tolerance,
                  const double rangeWindow=0.1);
 
+ private:
+   double fit(const std::vector<double>& inputs,
+              const std::vector<double>& outputs,
+              const double tolerance,
+              const double rangeWindow);
+
  public:
    int numNumer_;
    int numDenom_;
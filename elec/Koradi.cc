@@ -7,8 +7,10 @@
 #include <algorithm>
 #include <cassert>
 #include <sstream>
+#include <iterator>
+#include <omp.h>
+#include "kdtree++/kdtree.hpp"
 #include "ioUtils.h"
-#include "GridAssignmentObject.h"
 #include "mpiUtils.h"
 #include "mpiTpl.hh"
 #include "Drand48Object.hh"
@@ -21,8 +23,6 @@ using namespace std;
 // 1.  The (test) results are not reproducible across different numbers
 //     of tasks (when overprovisioned).  This is due to the way the
 //     initial centers are chosen.
-// 3.  Last vestige of THREE_VECTOR is in call to gao_nearestCenter.
-//     Figure out how to get rid of it.
 // 4.  Sort out whether it is better to balance to the local average or
 //     the global average load.
 // 5.  Need to implement an early bailout clause for the voronoi
@@ -41,6 +41,34 @@ using namespace std;
 
 
 
+namespace
+{
+   // A center in the k-d tree.  It remembers which domain it is.
+   struct CenterPoint
+   {
+      typedef double value_type;
+      CenterPoint(const Vector& r, int index)
+      : index_(index)
+      {
+         r_[0] = r[0]; r_[1] = r[1]; r_[2] = r[2];
+      }
+      double operator[](size_t ii) const {return r_[ii];}
+      double r_[3];
+      int index_;
+   };
+   typedef KDTree::KDTree<3, CenterPoint> CenterTree;
+
+   void buildCenterTree(const vector<Vector>& centers, CenterTree& tree)
+   {
+      vector<CenterPoint> points;
+      points.reserve(centers.size());
+      for (unsigned ii=0; ii<centers.size(); ++ii)
+         points.push_back(CenterPoint(centers[ii], ii));
+      tree.efficient_replace_and_optimise(points);
+   }
+}
+
+
 Koradi::Koradi(Anatomy& anatomy, const KoradiParms& parms)
 :verbose_(parms.verbose),
  nCentersPerTask_(parms.nCentersPerTask),
@@ -50,8 +78,9 @@ Koradi::Koradi(Anatomy& anatomy, const KoradiParms& parms)
  tolerance_      (parms.tolerance),
  nbrDeltaR_      (parms.nbrDeltaR),
  alphaStep_      (parms.alphaStep),
+ cost_           (parms.cost),
+ taskFactor_     (parms.taskFactor),
  indexToVector_  (anatomy.nx(), anatomy.ny(), anatomy.nz()),
- indexTo3Vector_ (anatomy.nx(), anatomy.ny(), anatomy.nz()),
  cells_          (anatomy.cellArray())
 {
    MPI_Comm_size(MPI_COMM_WORLD, &nTasks_);
@@ -67,9 +96,14 @@ Koradi::Koradi(Anatomy& anatomy, const KoradiParms& parms)
 
    if (centers_.size() == 1 ) maxVoronoiSteps_ = 1;
 
-   distributeCellsEvenly();
-   pickInitialCenters();
-   voronoiBalance();
+   if (parms.warmStart)
+      warmStartCenters();
+   else
+   {
+      distributeCellsEvenly();
+      pickInitialCenters();
+      voronoiBalance();
+   }
 
    for (unsigned ii=0; ii<maxSteps_; ++ii)
    {
@@ -181,6 +215,23 @@ void Koradi::pickInitialCenters()
    
 }
 
+// The domains we start from are the current ones, so their centers of
+// mass are as good as it gets.
+void Koradi::warmStartCenters()
+{
+   vector<Vector> sum;
+   vector<int> nCells;
+   sumLocalCells(sum, nCells);
+   for (unsigned ii=0; ii<nCentersPerTask_; ++ii)
+   {
+      centers_[ii+localOffset_] = sum[ii];
+      if (nCells[ii] > 0)
+         centers_[ii+localOffset_] /= double(nCells[ii]);
+   }
+   allGather(centers_, nCentersPerTask_, MPI_COMM_WORLD);
+   computeRadii();
+}
+
 void Koradi::assignCells()
 {
    calculateCellDestinations();
@@ -190,19 +241,17 @@ void Koradi::assignCells()
 
 void Koradi::calculateCellDestinations()
 {
-   // Without nbr domain info, bootstrap using a grid approach.
+   // Without nbr domain info, bootstrap with the nearest center.
    if (nbrDomains_[0].size() == 0)
    {
-      GRID_ASSIGNMENT_OBJECT* gao = gao_init(centers_.size(),
-                                             (const void*) &(centers_[0]),
-                                             sizeof(Vector));
-   
-      for (unsigned ii=0; ii<cells_.size(); ++ii)
+      CenterTree tree;
+      buildCenterTree(centers_, tree);
+      #pragma omp parallel for
+      for (int ii=0; ii<cells_.size(); ++ii)
       {
-         THREE_VECTOR r = indexTo3Vector_(cells_[ii].gid_);
-         cells_[ii].dest_ = gao_nearestCenter(gao, r);
+         CenterPoint r(indexToVector_(cells_[ii].gid_), -1);
+         cells_[ii].dest_ = tree.find_nearest(r).first->index_;
       }
-      gao_destroy(gao);
    }
    else // we know which domains might be close
    {
@@ -258,20 +307,49 @@ void Koradi::moveCenters()
    // we include the current center location in the center of mass
    // calculation.  This means a domain with no cells won't suddenly
    // warp to the origin.
-   vector<int> nCells(centers_.size(), 1);
-   for (unsigned ii=0; ii<cells_.size(); ++ii)
+   vector<Vector> sum;
+   vector<int> nCells;
+   sumLocalCells(sum, nCells);
+   for (unsigned ii=0; ii<nCentersPerTask_; ++ii)
    {
-      int dest = cells_[ii].dest_;
-      Vector r = indexToVector_(cells_[ii].gid_);
-      ++nCells[dest];
-      centers_[dest] += r;
+      centers_[ii+localOffset_] += sum[ii];
+      centers_[ii+localOffset_] /= double(nCells[ii]+1);
    }
-
-   for (unsigned ii=0; ii<nCentersPerTask_; ++ii)
-      centers_[ii+localOffset_] /= double(nCells[ii+localOffset_]);
    allGather(centers_, nCentersPerTask_, MPI_COMM_WORLD);
 }
 
+/** Sum of the positions and number of the cells of each local domain.
+ *  Each thread sums its share of the cells and the partial sums are
+ *  added in thread order so that the result doesn't depend on the
+ *  schedule. */
+void Koradi::sumLocalCells(vector<Vector>& sum, vector<int>& nCells)
+{
+   int nThreads = omp_get_max_threads();
+   vector<Vector> threadSum(nThreads*nCentersPerTask_, Vector(0, 0, 0));
+   vector<int> threadCount(nThreads*nCentersPerTask_, 0);
+   #pragma omp parallel
+   {
+      int offset = omp_get_thread_num()*nCentersPerTask_ - localOffset_;
+      #pragma omp for
+      for (int ii=0; ii<cells_.size(); ++ii)
+      {
+         int dest = cells_[ii].dest_;
+         assert(dest/nCentersPerTask_ == myRank_);
+         threadSum[offset+dest] += indexToVector_(cells_[ii].gid_);
+         ++threadCount[offset+dest];
+      }
+   }
+
+   sum.assign(nCentersPerTask_, Vector(0, 0, 0));
+   nCells.assign(nCentersPerTask_, 0);
+   for (int iThread=0; iThread<nThreads; ++iThread)
+      for (unsigned ii=0; ii<nCentersPerTask_; ++ii)
+      {
+         sum[ii] += threadSum[iThread*nCentersPerTask_+ii];
+         nCells[ii] += threadCount[iThread*nCentersPerTask_+ii];
+      }
+}
+
 // We impose minimum radius to ensure that if a domain happens to
 // include no cells (or perhaps one cell) it still has a non-zero
 // volume.
@@ -279,15 +357,25 @@ void Koradi::computeRadii()
 {
    radii_.assign(radii_.size(), 0.);
    
-   #pragma omp parallel for
-   for (int ii=0; ii<cells_.size(); ++ii)
+   int nThreads = omp_get_max_threads();
+   vector<double> threadR2(nThreads*nCentersPerTask_, 0.);
+   #pragma omp parallel
    {
-      Vector v = indexToVector_(cells_[ii].gid_);
-      int cellOwner = cells_[ii].dest_;
-      assert(cellOwner/nCentersPerTask_ == myRank_);
-      double r2 = diffSq(v,  centers_[cellOwner]);
-      radii_[cellOwner] = max(radii_[cellOwner], r2);
+      int offset = omp_get_thread_num()*nCentersPerTask_ - localOffset_;
+      #pragma omp for
+      for (int ii=0; ii<cells_.size(); ++ii)
+      {
+         Vector v = indexToVector_(cells_[ii].gid_);
+         int cellOwner = cells_[ii].dest_;
+         assert(cellOwner/nCentersPerTask_ == myRank_);
+         double r2 = diffSq(v,  centers_[cellOwner]);
+         threadR2[offset+cellOwner] = max(threadR2[offset+cellOwner], r2);
+      }
    }
+   for (int iThread=0; iThread<nThreads; ++iThread)
+      for (unsigned ii=0; ii<nCentersPerTask_; ++ii)
+         radii_[ii+localOffset_] = max(radii_[ii+localOffset_],
+                                       threadR2[iThread*nCentersPerTask_+ii]);
 
    for (unsigned ii=0; ii<radii_.size(); ++ii)
       radii_[ii] = sqrt(radii_[ii]);
@@ -344,13 +432,22 @@ void Koradi::findNbrDomains()
    for (unsigned ii=0; ii<nCentersPerTask_; ++ii)
       nbrDomains_[ii].clear();
 
+   CenterTree tree;
+   buildCenterTree(centers_, tree);
+   double maxRadius = *max_element(radii_.begin(), radii_.end());
+   vector<CenterPoint> candidates;
    for (unsigned iCenter=0; iCenter<nCentersPerTask_; ++iCenter)
    {
       unsigned ii = iCenter+localOffset_;
       const Vector& ci = centers_[ii];
       double rii = radii_[ii];
-      for (unsigned jj=0; jj<centers_.size(); ++jj)
+      // No center outside of this box can be close enough.
+      candidates.clear();
+      tree.find_within_range(CenterPoint(ci, ii), rii+maxRadius+nbrDeltaR_,
+                             back_inserter(candidates));
+      for (unsigned iCandidate=0; iCandidate<candidates.size(); ++iCandidate)
       {
+         unsigned jj = candidates[iCandidate].index_;
          if (jj == ii)
             continue;
          Vector cij = ci - centers_[jj];
@@ -359,6 +456,9 @@ void Koradi::findNbrDomains()
          if (r2 < (rii+rjj+nbrDeltaR_)*(rii+rjj+nbrDeltaR_))
              nbrDomains_[iCenter].push_back(jj);
       }
+      // Same order as a scan over all centers so that ties go the
+      // same way.
+      sort(nbrDomains_[iCenter].begin(), nbrDomains_[iCenter].end());
    }
 }
 
@@ -393,9 +493,22 @@ void Koradi::computeLoad(vector<double>& load)
 {
    load.assign(nTasks_*nCentersPerTask_, 0.);
 
-   for (unsigned ii=0; ii<cells_.size(); ++ii)
+   int nThreads = omp_get_max_threads();
+   vector<double> threadLoad(nThreads*nCentersPerTask_, 0.);
+   #pragma omp parallel
    {
-      load[cells_[ii].dest_] += 1;
+      int offset = omp_get_thread_num()*nCentersPerTask_ - localOffset_;
+      #pragma omp for
+      for (int ii=0; ii<cells_.size(); ++ii)
+      {
+         int dest = cells_[ii].dest_;
+         assert(dest/nCentersPerTask_ == myRank_);
+         double factor = (taskFactor_.empty() ? 1.0 : taskFactor_[cells_[ii].sortind_]);
+         threadLoad[offset+dest] += factor*cost_(cells_[ii].cellType_);
+      }
    }
+   for (int iThread=0; iThread<nThreads; ++iThread)
+      for (unsigned ii=0; ii<nCentersPerTask_; ++ii)
+         load[ii+localOffset_] += threadLoad[iThread*nCentersPerTask_+ii];
    allGather(load, nCentersPerTask_, MPI_COMM_WORLD);
 }
@@ -5,7 +5,7 @@
 #include "AnatomyCell.hh"
 #include "Vector.hh"
 #include "IndexToVector.hh"
-#include "IndexToThreeVector.hh"
+#include "ReactionCost.hh"
 
 class Anatomy;
 
@@ -20,8 +20,26 @@ struct KoradiParms
    double alphaStep;
    double tolerance;
    double nbrDeltaR;
+   ReactionCost cost; // load of each cell
+   // The cells are already on the task of their domain, which is in
+   // dest_.  Start from the centers of those domains instead of random
+   // cells and skip the voronoi steps.
+   bool warmStart;
+   // When not empty the load of a cell is also scaled by the entry of
+   // the task in its sortind_.
+   std::vector<double> taskFactor;
 };
 
+/** Balances the load of Voronoi domains by moving their centers and
+ *  scaling their radii.  Centers are found with a k-d tree and the
+ *  loops over the local cells are threaded.
+ *
+ *  DECOMPOSITION keywords (method = koradi):
+ *    warmStart (default none) is a domains# file, such as the ones
+ *      written with outputRate, for nCenters domains.  The balancer
+ *      starts from those domains instead of from random centers and
+ *      skips the voronoi steps, so rebalancing an anatomy that changed
+ *      little takes a few steps. */
 class Koradi
 {
  public:
@@ -35,10 +53,12 @@ class Koradi
    void voronoiBalance();
    void distributeCellsEvenly();
    void pickInitialCenters();
+   void warmStartCenters();
    void assignCells();
    void initialAssignment();
    void sendCellsToDestinations();
    void moveCenters();
+   void sumLocalCells(std::vector<Vector>& sum, std::vector<int>& nCells);
    void computeRadii();
    void biasAlpha();
    void printStatistics();
@@ -59,13 +79,14 @@ class Koradi
    double alphaStep_;
    double tolerance_;
    double nbrDeltaR_;
+   ReactionCost cost_;
+   std::vector<double> taskFactor_;
 
    int myRank_;
    int nTasks_;
    int localOffset_;
 
    IndexToVector indexToVector_;
-   IndexToThreeVector indexTo3Vector_;
 
    // shared globally
    std::vector<Vector> centers_;
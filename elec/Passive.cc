@@ -313,15 +313,24 @@ ThisReaction::~ThisReaction() {}
 void ThisReaction::calc(double _dt,
                 ro_mgarray_ptr<int> ___indexArray,
                 ro_mgarray_ptr<double> ___Vm,
-                ro_mgarray_ptr<double> ,
+                ro_mgarray_ptr<double> ___iStim,
                 wo_mgarray_ptr<double> ___dVm)
 {
-   ro_array_ptr<int>    __indexArray = ___indexArray.useOn(CPU);
-   ro_array_ptr<double> __Vm = ___Vm.useOn(CPU);
-   wo_array_ptr<double> __dVm = ___dVm.useOn(CPU);
+   ro_array_ptr<int>    indexArray = ___indexArray.useOn(CPU);
+   ro_array_ptr<double> Vm = ___Vm.useOn(CPU);
+   wo_array_ptr<double> dVm = ___dVm.useOn(CPU);
+   calcTile(_dt, 0, nCells_, indexArray.raw(), Vm.raw(), 0, dVm.raw());
+}
+
+void ThisReaction::calcTile(double _dt, int __begin, int __end,
+                const int* __indexArray,
+                const double* __Vm,
+                const double*,
+                double* __dVm)
+{
 
    //define the constants
-   for (unsigned __jj=0; __jj<(nCells_+width-1)/width; __jj++)
+   for (unsigned __jj=__begin/width; __jj<(__end+width-1)/width; __jj++)
    {
       const int __ii = __jj*width;
       //set Vm
@@ -331,7 +340,7 @@ void ThisReaction::calc(double _dt,
          for (int __kk=0; __kk<width; __kk++)
          {
             __Vm_local[__kk] = __Vm[__indexArray[__ii+cursor]];
-            if (__ii+__kk < nCells_) { cursor++; }
+            if (__ii+__kk+1 < nCells_) { cursor++; }
          }
       }
       const real V = load(&__Vm_local[0]);
@@ -60,6 +60,16 @@ namespace Passive
                 ro_mgarray_ptr<double> Vm_m,
                 ro_mgarray_ptr<double> iStim_m,
                 wo_mgarray_ptr<double> dVm_m);
+#ifndef USE_CUDA
+      bool supportsTiles() const { return true; }
+      int tileAlignment() const { return SIMDOPS_FLOAT64V_WIDTH; }
+      bool supportsMultirate() const { return true; }
+      void calcTile(double dt, int begin, int end,
+                    const int* indexArray,
+                    const double* Vm,
+                    const double* iStim,
+                    double* dVm);
+#endif //USE_CUDA
       void initializeMembraneVoltage(ro_mgarray_ptr<int> indexArray, wo_mgarray_ptr<double> Vm);
       virtual ~ThisReaction();
 #ifdef USE_CUDA
@@ -57,6 +57,7 @@ namespace PerformanceTimers
    TimerHandle haloTimer;
    TimerHandle haloLaunchTimer;
    TimerHandle haloWaitTimer;
+   TimerHandle haloProgressTimer;
    TimerHandle haloMove2BufTimer;
    TimerHandle diffusionCalcTimer;
    TimerHandle stimulusTimer;
@@ -126,6 +127,7 @@ void  profileInit()
    haloTimer = profileGetHandle("HaloExchange");
    haloLaunchTimer = profileGetHandle("HaloExchangeLaunch");
    haloWaitTimer = profileGetHandle("HaloExchangeWait");
+   haloProgressTimer = profileGetHandle("HaloExchangeProgress");
    haloMove2BufTimer = profileGetHandle("HaloExchMove2Buf");
    diffusionCalcTimer= profileGetHandle("DiffusionCalc");
    stimulusTimer = profileGetHandle("Stimulus");
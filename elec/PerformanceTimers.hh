@@ -19,6 +19,7 @@ namespace PerformanceTimers
    extern TimerHandle haloTimer;
    extern TimerHandle haloLaunchTimer;
    extern TimerHandle haloWaitTimer;
+   extern TimerHandle haloProgressTimer;
    extern TimerHandle haloMove2BufTimer;
    extern TimerHandle diffusionCalcTimer;
    extern TimerHandle stimulusTimer;
@@ -20,6 +20,35 @@ class Reaction
    virtual void updateNonGate(double dt, ro_mgarray_ptr<int> indexArray, ro_mgarray_ptr<double> Vm, wo_mgarray_ptr<double> dVR) {};
    virtual void updateGate   (double dt, ro_mgarray_ptr<int> indexArray, ro_mgarray_ptr<double> Vm) {};
 
+   /** Interface for the fused reaction+integrate loop.  calcTile
+    *  computes dVm only for entries [begin, end) of indexArray.  begin
+    *  is always a multiple of tileAlignment() and end is either a
+    *  multiple of tileAlignment() or the size of indexArray.  Distinct
+    *  tiles may be computed concurrently, so a model that returns true
+    *  from supportsTiles() must not share scratch data between tiles.
+    *  The arrays are host pointers that the caller resolved before its
+    *  parallel region, since moving a lazy_array isn't thread safe.
+    *  Models that don't support tiles are run through calc(). */
+   virtual bool supportsTiles() const { return false; }
+   virtual int  tileAlignment() const { return 1; }
+   virtual void calcTile(double dt, int begin, int end,
+                         const int* indexArray,
+                         const double* Vm,
+                         const double* iStim,
+                         double* dVm) {};
+   /** Models that return true accept a dt in calcTile that is a whole
+    *  multiple of the dt they were created with and advance their
+    *  state over that many steps at once.  The multirate mode of the
+    *  fused loop uses this to update quiescent tiles less often. */
+   virtual bool supportsMultirate() const { return false; }
+   /** For the multirate quiescence test: the largest |d/dt| (1/ms) of
+    *  the gates of entries [begin, end) of indexArray over their last
+    *  calcTile.  Models only track it after trackGateRates(true) since
+    *  it costs a copy of the gates.  Models without gates keep the
+    *  defaults. */
+   virtual void trackGateRates(bool on) {}
+   virtual double maxGateRate(int begin, int end) const { return 0; }
+
    /** Populates the Vm array with some sensible default initial
     * membrane voltage.  Vm will be the parallel to the local cells in
     * the anatomy that was used to create the concrete reaction class. */
@@ -0,0 +1,214 @@
+#include "ReactionCost.hh"
+
+#include <cassert>
+#include <fstream>
+#include <sstream>
+#include <iostream>
+#include <iomanip>
+
+#include "object_cc.hh"
+#include "ReactionManager.hh"
+#include "ThreadServer.hh"
+#include "PerformanceTimers.hh"
+#include "lazy_array.hh"
+#include "AnatomyCell.hh"
+#include "mpiUtils.h"
+
+using namespace std;
+
+namespace
+{
+   // Enough cells to fill the vector lanes of every model and enough
+   // steps to be well above the resolution of MPI_Wtime.
+   const int nCalibrationCells = 1024;
+   const int nCalibrationSteps = 50;
+
+   /** Seconds per cell per time step of the work every cell does
+    *  whatever its model: a 19 point stencil like the FGR diffusion
+    *  (float weights, a padded double Vm) on a 16x16x4 brick and the
+    *  forward Euler update of Vm. */
+   double timeBaseline(double dt)
+   {
+      const int nx = 16, ny = 16, nz = 4;
+      const int px = nx+2, py = ny+2, pz = nz+2;
+      const int nCells = nx*ny*nz;
+      int offset[19];
+      int nOffset = 0;
+      for (int kk=-1; kk<=1; ++kk)
+         for (int jj=-1; jj<=1; ++jj)
+            for (int ii=-1; ii<=1; ++ii)
+               if (ii*ii + jj*jj + kk*kk < 3)
+                  offset[nOffset++] = (kk*py + jj)*px + ii;
+      assert(nOffset == 19);
+      vector<double> VmBlock(px*py*pz, -85.0);
+      vector<float> weight(nCells*19, 1.0/19);
+      vector<double> dVmD(nCells), dVmR(nCells, 0.0), iStim(nCells, 0.0);
+
+      double start = 0;
+      for (int step=-1; step<nCalibrationSteps; ++step)
+      {
+         if (step == 0)
+            start = MPI_Wtime();
+         int cell = 0;
+         for (int kk=1; kk<=nz; ++kk)
+            for (int jj=1; jj<=ny; ++jj)
+               for (int ii=1; ii<=nx; ++ii, ++cell)
+               {
+                  const double* Vm = &VmBlock[(kk*py + jj)*px + ii];
+                  const float* ww = &weight[cell*19];
+                  double sum = 0;
+                  for (int nn=0; nn<19; ++nn)
+                     sum += ww[nn]*Vm[offset[nn]];
+                  dVmD[cell] = sum - Vm[0];
+               }
+         cell = 0;
+         for (int kk=1; kk<=nz; ++kk)
+            for (int jj=1; jj<=ny; ++jj)
+               for (int ii=1; ii<=nx; ++ii, ++cell)
+                  VmBlock[(kk*py + jj)*px + ii] += dt*(dVmR[cell] + dVmD[cell] + iStim[cell]);
+      }
+      return (MPI_Wtime()-start)/(double(nCalibrationSteps)*nCells);
+   }
+}
+
+ReactionCost::ReactionCost(const string& filename, MPI_Comm comm)
+{
+   if (filename.empty())
+      return;
+
+   int myRank;
+   MPI_Comm_rank(comm, &myRank);
+   vector<int> type;
+   vector<double> cost;
+   int nTypes = 0;
+   if (myRank == 0)
+   {
+      ifstream in(filename.c_str());
+      if (!in)
+         nTypes = -1;
+      string line;
+      while (nTypes >= 0 && getline(in, line))
+      {
+         if (line.empty() || line[0] == '#')
+            continue;
+         istringstream fields(line);
+         int tt;
+         double cc;
+         if (!(fields >> tt >> cc) || cc <= 0)
+         {
+            nTypes = -1;
+            break;
+         }
+         type.push_back(tt);
+         cost.push_back(cc);
+         ++nTypes;
+      }
+   }
+   MPI_Bcast(&nTypes, 1, MPI_INT, 0, comm);
+   if (nTypes < 0)
+   {
+      if (getRank(0) == 0)
+         cout << "Can't read the reactionCost table " << filename
+              << ".  Expected lines of cellType and a positive cost." << endl;
+      assert(false); // reachable only due to bad input
+   }
+   type.resize(nTypes+1);
+   cost.resize(nTypes+1);
+   MPI_Bcast(&type[0], nTypes, MPI_INT, 0, comm);
+   MPI_Bcast(&cost[0], nTypes, MPI_DOUBLE, 0, comm);
+   for (int ii=0; ii<nTypes; ++ii)
+      cost_[type[ii]] = cost[ii];
+}
+
+double ReactionCost::average(const vector<AnatomyCell>& cells, MPI_Comm comm) const
+{
+   if (uniform())
+      return 1.0;
+   double local[2] = {0.0, double(cells.size())};
+   for (unsigned ii=0; ii<cells.size(); ++ii)
+      local[0] += (*this)(cells[ii].cellType_);
+   double global[2];
+   MPI_Allreduce(local, global, 2, MPI_DOUBLE, MPI_SUM, comm);
+   return (global[1] > 0 ? global[0]/global[1] : 1.0);
+}
+
+void calibrateReactionCost(const vector<string>& reactionNames,
+                           double dt, const string& filename, MPI_Comm comm)
+{
+   int nReactions = reactionNames.size();
+   if (nReactions == 0)
+      return;
+   profileStart("ReactionCostCalibration");
+   int nTasks, myRank;
+   MPI_Comm_size(comm, &nTasks);
+   MPI_Comm_rank(comm, &myRank);
+
+   vector<double> seconds(nReactions, 0.0);
+   vector<vector<int> > cellTypes(nReactions);
+   vector<string> method(nReactions);
+   for (int ir=0; ir<nReactions; ++ir)
+   {
+      OBJECT* obj = objectFind(reactionNames[ir], "REACTION");
+      objectGet(obj, "cellTypes", cellTypes[ir]);
+      objectGet(obj, "method", method[ir], "");
+      if (cellTypes[ir].empty())
+         continue;
+
+      // All of the cellTypes of a REACTION object share its model and
+      // parameters so one of them is enough.
+      ReactionManager reaction;
+      reaction.addReaction(reactionNames[ir]);
+      vector<int> type(nCalibrationCells, cellTypes[ir][0]);
+      ThreadTeam noTeam;
+      reaction.create(dt, type, noTeam);
+
+      lazy_array<double> Vm;
+      lazy_array<double> iStim;
+      lazy_array<double> dVm;
+      Vm.resize(nCalibrationCells);
+      iStim.resize(nCalibrationCells);
+      dVm.resize(nCalibrationCells);
+      reaction.initializeMembraneState(Vm);
+      {
+         wo_array_ptr<double> stim = iStim.useOn(CPU);
+         for (int ii=0; ii<nCalibrationCells; ++ii)
+            stim[ii] = 0;
+      }
+
+      // The first call moves the data and warms up the caches.
+      reaction.calc(dt, Vm, iStim, dVm);
+      double start = MPI_Wtime();
+      for (int ii=0; ii<nCalibrationSteps; ++ii)
+         reaction.calc(dt, Vm, iStim, dVm);
+      seconds[ir] = (MPI_Wtime()-start)/(double(nCalibrationSteps)*nCalibrationCells);
+   }
+
+   seconds.push_back(timeBaseline(dt));
+   vector<double> sum(nReactions+1);
+   MPI_Reduce(&seconds[0], &sum[0], nReactions+1, MPI_DOUBLE, MPI_SUM, 0, comm);
+   if (myRank == 0)
+   {
+      double baseline = sum[nReactions]/nTasks;
+      double maxSeconds = 0;
+      for (int ir=0; ir<nReactions; ++ir)
+      {
+         sum[ir] /= nTasks;
+         maxSeconds = max(maxSeconds, sum[ir] + baseline);
+      }
+      if (maxSeconds == 0)
+         maxSeconds = 1;
+      ofstream out(filename.c_str());
+      out << "# cost per cell per time step on " << nTasks << " tasks, relative to the\n"
+          << "# most expensive cell.  Each cell costs its reaction plus a baseline of\n"
+          << "# " << baseline << " seconds for the diffusion and the integration.\n"
+          << "# cellType relative reactionSeconds reaction method\n";
+      for (int ir=0; ir<nReactions; ++ir)
+         for (unsigned ii=0; ii<cellTypes[ir].size(); ++ii)
+            out << setw(8) << cellTypes[ir][ii] << " "
+                << setw(12) << (sum[ir] + baseline)/maxSeconds << " "
+                << setw(12) << sum[ir] << " "
+                << reactionNames[ir] << " " << method[ir] << "\n";
+      cout << "Reaction cost table written to " << filename << endl;
+   }
+   profileStop("ReactionCostCalibration");
+}
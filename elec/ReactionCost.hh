@@ -0,0 +1,60 @@
+#ifndef REACTION_COST_HH
+#define REACTION_COST_HH
+
+#include <map>
+#include <string>
+#include <vector>
+#include <mpi.h>
+
+class AnatomyCell;
+
+/** Cost of one cell, by cellType, relative to the most expensive cell.
+ *  A cell costs its reaction plus the diffusion and integration every
+ *  cell does.  The load balancers weight each cell by its cost instead
+ *  of counting cells so that a domain full of Passive cells can be
+ *  larger than one full of Grandi cells.  The halo exchange grows with
+ *  the surface of a domain, not its cells, so it isn't in the table.
+ *
+ *  DECOMPOSITION keywords:
+ *    reactionCost (default none) is a table written by
+ *      calibrateReactionCost.  koradi, graph, grid and block weight
+ *      the cells with it.  Without it every cell costs 1.
+ */
+class ReactionCost
+{
+ public:
+   /** Every cell costs 1. */
+   ReactionCost() {};
+   /** Reads the table in filename on rank 0 of comm and shares it.
+    *  An empty filename means every cell costs 1.  Collective. */
+   ReactionCost(const std::string& filename, MPI_Comm comm);
+
+   /** Cost of a cell of cellType.  Types that aren't in the table
+    *  cost 1, as much as the most expensive cell. */
+   double operator()(int cellType) const
+   {
+      std::map<int, double>::const_iterator here = cost_.find(cellType);
+      return (here == cost_.end() ? 1.0 : here->second);
+   }
+   bool uniform() const {return cost_.empty();}
+   /** The average cost of the cells on all tasks of comm.  The
+    *  balancers that weigh the tissue against the bounding box
+    *  (diffCost) scale diffCost by it, since diffCost is relative to
+    *  the cost of a typical cell.  Collective. */
+   double average(const std::vector<AnatomyCell>& cells, MPI_Comm comm) const;
+
+ private:
+   std::map<int, double> cost_;
+};
+
+/** Times the reaction of each of the REACTION objects in reactionNames
+ *  on a block of resting cells on every task, the way the omp loop
+ *  calls them, and a stencil and Vm update like the diffusion and the
+ *  integration.  Writes the average cost per cell per time step of
+ *  each cellType, reaction plus baseline, to filename.  Models that need the thread teams of the
+ *  parallelDiffusionReaction loop can't be timed this way.  Collective
+ *  over comm. */
+void calibrateReactionCost(const std::vector<std::string>& reactionNames,
+                           double dt, const std::string& filename, MPI_Comm comm);
+
+#endif
@@ -1,6 +1,8 @@
 
 #include <set>
 #include <algorithm>
+#include <limits>
+#include <cmath>
 #include "ReactionManager.hh"
 #include "Reaction.hh"
 #include "object_cc.hh"
@@ -51,6 +53,155 @@ void ReactionManager::updateGate(double dt,
    }
 }
 
+void ReactionManager::setMultirate(int maxSteps, double threshold,
+                                   double gateThreshold)
+{
+   assert(maxSteps >= 1);
+   multirateMaxSteps_ = maxSteps;
+   multirateThreshold_ = threshold;
+   multirateGateThreshold_ = gateThreshold;
+   for (int ii=0; ii<reactions_.size(); ++ii)
+      if (reactions_[ii]->supportsMultirate())
+         reactions_[ii]->trackGateRates(maxSteps > 1);
+}
+
+/** Fused reaction and forward Euler integration for the omp loop.
+ *  Each reaction is processed in tiles of roughly tileSize cells.  A
+ *  tile is reacted and then immediately integrated while Vm, iStim and
+ *  the derivatives for its cells are still in cache, so each cell is
+ *  streamed from memory once per time step instead of once for the
+ *  reaction and again for the integrator.
+ *
+ *  The diffusion derivatives must be complete for *all* cells before
+ *  this is called since Vm is updated in place.  With catchUp every
+ *  multirate tile is brought up to date, for steps after which the
+ *  reaction state is read by sensors, checkpoints or a rebalance. */
+void ReactionManager::calcAndIntegrate(double dt, int tileSize,
+                                       rw_mgarray_ptr<double> Vm_m,
+                                       ro_mgarray_ptr<double> iStim_m,
+                                       ro_mgarray_ptr<double> dVmDiffusion_m,
+                                       rw_mgarray_ptr<double> dVmReaction_m,
+                                       bool catchUp)
+{
+   assert(tileSize > 0);
+   rw_array_ptr<double> Vm = Vm_m.useOn(CPU);
+   ro_array_ptr<double> iStim = iStim_m.useOn(CPU);
+   ro_array_ptr<double> dVmD = dVmDiffusion_m.useOn(CPU);
+   rw_array_ptr<double> dVmR = dVmReaction_m.useOn(CPU);
+   ro_array_ptr<int> EindexFromIindex = EindexFromIindex_.readonly(CPU);
+
+   for (int ii=0; ii<reactions_.size(); ++ii)
+   {
+      const int* index = &EindexFromIindex[extents_[ii]];
+      int nCells = extents_[ii+1] - extents_[ii];
+      Reaction* reaction = reactions_[ii];
+
+      if (!reaction->supportsTiles())
+      {
+         ro_mgarray_ptr<int> indexArray = ro_mgarray_ptr<int>(EindexFromIindex_).slice(extents_[ii],extents_[ii+1]);
+         reaction->calc(dt, indexArray, Vm_m, iStim_m, dVmReaction_m);
+         #pragma omp parallel for
+         for (int jj=0; jj<nCells; ++jj)
+         {
+            int kk = index[jj];
+            Vm[kk] += dt*(dVmR[kk]+dVmD[kk]+iStim[kk]);
+         }
+         continue;
+      }
+
+      int align = reaction->tileAlignment();
+      int stride = ((tileSize+align-1)/align)*align;
+      int nTiles = (nCells+stride-1)/stride;
+      if (multirateMaxSteps_ == 1 || !reaction->supportsMultirate())
+      {
+         #pragma omp parallel for schedule(dynamic)
+         for (int iTile=0; iTile<nTiles; ++iTile)
+         {
+            int begin = iTile*stride;
+            int end = min(begin+stride, nCells);
+            reaction->calcTile(dt, begin, end, index, Vm.raw(), iStim.raw(), dVmR.raw());
+            for (int jj=begin; jj<end; ++jj)
+            {
+               int kk = index[jj];
+               Vm[kk] += dt*(dVmR[kk]+dVmD[kk]+iStim[kk]);
+            }
+         }
+         continue;
+      }
+
+      /* Multirate.  A quiescent tile keeps the dVmR of its last update
+       * while its state lags behind.  It is updated over all the steps
+       * it missed once it stops being quiescent, falls maxSteps behind
+       * or has to catch up.  Only the compacted list of due tiles is
+       * reacted.  The gates don't move while a tile is skipped, so
+       * their rate is that of its last update. */
+      vector<int>& lag = tileLag_[ii];
+      vector<char>& quiet = tileQuiet_[ii];
+      if (lag.size() != nTiles)
+      {
+         lag.assign(nTiles, 0);
+         quiet.assign(nTiles, 0);
+      }
+      dueTiles_.clear();
+      skippedTiles_.clear();
+      for (int iTile=0; iTile<nTiles; ++iTile)
+      {
+         if (quiet[iTile] && lag[iTile]+1 < multirateMaxSteps_ && !catchUp)
+            skippedTiles_.push_back(iTile);
+         else
+            dueTiles_.push_back(iTile);
+      }
+      #pragma omp parallel
+      {
+         #pragma omp for schedule(dynamic) nowait
+         for (int iDue=0; iDue<dueTiles_.size(); ++iDue)
+         {
+            int iTile = dueTiles_[iDue];
+            int begin = iTile*stride;
+            int end = min(begin+stride, nCells);
+            reaction->calcTile((lag[iTile]+1)*dt, begin, end, index, Vm.raw(), iStim.raw(), dVmR.raw());
+            double maxRate = 0;
+            for (int jj=begin; jj<end; ++jj)
+            {
+               int kk = index[jj];
+               double rate = dVmR[kk]+dVmD[kk]+iStim[kk];
+               Vm[kk] += dt*rate;
+               maxRate = max(maxRate, fabs(rate));
+            }
+            lag[iTile] = 0;
+            quiet[iTile] = (maxRate < multirateThreshold_ &&
+                            reaction->maxGateRate(begin, end) < multirateGateThreshold_);
+         }
+         #pragma omp for schedule(static)
+         for (int iSkip=0; iSkip<skippedTiles_.size(); ++iSkip)
+         {
+            int iTile = skippedTiles_[iSkip];
+            int begin = iTile*stride;
+            int end = min(begin+stride, nCells);
+            double maxRate = 0;
+            for (int jj=begin; jj<end; ++jj)
+            {
+               int kk = index[jj];
+               double rate = dVmR[kk]+dVmD[kk]+iStim[kk];
+               Vm[kk] += dt*rate;
+               maxRate = max(maxRate, fabs(rate));
+            }
+            ++lag[iTile];
+            quiet[iTile] = (maxRate < multirateThreshold_ &&
+                            reaction->maxGateRate(begin, end) < multirateGateThreshold_);
+         }
+      }
+   }
+
+   // Cells without a reaction model still diffuse and can be stimulated.
+   for (int ii=0; ii<unclaimedCells_.size(); ++ii)
+   {
+      int kk = unclaimedCells_[ii];
+      dVmR[kk] = 0;
+      Vm[kk] += dt*(dVmD[kk]+iStim[kk]);
+   }
+}
+
 /** Populates the Vm array with some sensible default initial
  * membrane voltage.  Vm will be the parallel to the local cells in
  * the anatomy that was used to create the concrete reaction class. */
@@ -258,6 +409,7 @@ void ReactionManager::create(const double dt, ro_array_ptr<int> cellTypes, const
             EindexFromIindexArray[Iindex] = icell;
          }
          IindexFromEindex_[Eindex] = Iindex;
+         if (Iindex == -1) { unclaimedCells_.push_back(Eindex); }
       }
       //finish off the index
       for (int ireaction=0; ireaction<numReactions; ++ireaction)
@@ -268,6 +420,11 @@ void ReactionManager::create(const double dt, ro_array_ptr<int> cellTypes, const
    
    //create the reaction objects
    reactions_.resize(numReactions);
+   tileLag_.resize(numReactions);
+   tileQuiet_.resize(numReactions);
+   multirateMaxSteps_ = 1;
+   multirateThreshold_ = 0;
+   multirateGateThreshold_ = 0;
    for (int ireaction=0; ireaction<numReactions; ++ireaction)
    {
       int localSize = countFromRidx[ireaction];
@@ -19,6 +19,18 @@ class ReactionManager
              wo_mgarray_ptr<double> dVm);
    void updateNonGate(double dt, ro_mgarray_ptr<double> Vm, wo_mgarray_ptr<double> dVR);
    void updateGate   (double dt, ro_mgarray_ptr<double> Vm);
+   void calcAndIntegrate(double dt, int tileSize,
+                         rw_mgarray_ptr<double> Vm,
+                         ro_mgarray_ptr<double> iStim,
+                         ro_mgarray_ptr<double> dVmDiffusion,
+                         rw_mgarray_ptr<double> dVmReaction,
+                         bool catchUp);
+   /** Lets calcAndIntegrate update the state of quiescent tiles only
+    *  every maxSteps steps.  A tile is quiescent while every cell has
+    *  |dVm/dt| below threshold (mV/ms) and the gates of its model
+    *  change by less than gateThreshold per ms.  maxSteps = 1 is
+    *  off. */
+   void setMultirate(int maxSteps, double threshold, double gateThreshold);
    std::string stateDescription() const;
 
    /** Populates the Vm array with some sensible default initial
@@ -48,6 +60,17 @@ class ReactionManager
    std::vector<int> extents_;
    lazy_array<int> EindexFromIindex_;
    std::vector<int> IindexFromEindex_;
+   std::vector<int> unclaimedCells_;
+
+   int multirateMaxSteps_;
+   double multirateThreshold_;
+   double multirateGateThreshold_;
+   // per reaction and tile: steps the state is behind, and whether
+   // the tile was quiescent the last step
+   std::vector<std::vector<int> > tileLag_;
+   std::vector<std::vector<char> > tileQuiet_;
+   std::vector<int> dueTiles_;
+   std::vector<int> skippedTiles_;
    
    std::vector<std::string> unitFromHandle_;
    std::map<std::string, int> handleFromVarname_;
@@ -13,6 +13,8 @@
 #include "VectorDouble32.hh"
 #include "slow_fix.hh"
 #include "lazy_array.hh"
+#include "CommTable.hh"
+#include "HaloCodec.hh"
 
 class Diffusion;
 class ReactionManager;
@@ -20,6 +22,7 @@ class Stimulus;
 class Sensor;
 class Drug;
 class CommTable;
+class DeepHalo;
 //using std::isnan;
 
 // storage class for persistent data such as potentials that may 
@@ -86,6 +89,11 @@ class Simulate
    
    CheckRange checkRange_;
    LoopType loopType_;
+   HaloExchangeMode haloExchangeMode_;
+   bool haloDatatypes_; // exchange straight between Vm and the diffusion block
+   HaloCodecType haloCodec_;
+   bool haloCodecValidate_;
+   bool haloDeviceBuffers_; // MPI reads and writes the device halo buffers
    volatile int loop_; // volatile (read + modified in threaded section)
    int maxLoop_;
    int globalSyncRate_;
@@ -96,9 +104,16 @@ class Simulate
    FILE *printFile_; 
    int checkpointRate_;
    bool asciiCheckpoints_;
+   int reactionTileSize_; // >0 fuses reaction and integrator (omp loop)
+   int diffusionSubsteps_; // diffusion steps per time step (omp loop)
+   int haloInterval_; // time steps per halo exchange (omp loop)
+   int rebalanceRate_; // time steps between imbalance checks (omp loop)
+   double rebalanceThreshold_; // max/average compute time - 1
+   int rebalanceSteps_; // koradi steps per rebalance
 
    ThreadTeam diffusionThreads_;
    ThreadTeam reactionThreads_;
+   ThreadTeam progressThreads_; // drives the halo exchange (pdr loop)
    
    double dt_;
    double time_;
@@ -117,6 +132,7 @@ class Simulate
    Diffusion* diffusion_;
    ReactionManager* reaction_;
    std::vector<Stimulus*> stimulus_;
+   DeepHalo* deepHalo_; // 0 unless haloInterval_ > 1
    std::vector<Sensor*> sensor_;
     
    void initSensors(const std::vector<std::string>& names);
@@ -28,6 +28,12 @@ bool spaceMalloc<void>(const ExecutionSpace space,void** dst, const std::size_t
       CUDA_VERIFY(cudaMalloc(dst, size));
    }
    return true;
+#elif defined(USE_HOST_DEVICE)
+   bool failed = posix_memalign(dst,512,size) != 0;
+   // NaN, so that reading device data that was never transferred shows
+   if (!failed && space != CPU)
+      memset(*dst, 0xff, size);
+   return failed;
 #else
    return posix_memalign(dst,512,size) != 0;
 #endif
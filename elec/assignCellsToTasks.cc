@@ -11,12 +11,16 @@
 #include "object_cc.hh"
 #include "ioUtils.h"
 #include "Koradi.hh"
+#include "GraphBalancer.hh"
 #include "writeCells.hh"
 #include "Simulate.hh"
 #include "GDLoadBalancer.hh"
 #include "BlockLoadBalancer.hh"
 #include "workBoundBalancer.hh"
 #include "pioBalancer.hh"
+#include "placeDomains.hh"
+#include "ReactionCost.hh"
+#include "decompositionCache.hh"
 #include "Long64.hh"
 #include "mpiUtils.h"
 #include "GridPoint.hh"
@@ -28,14 +32,17 @@ using namespace std;
 
 namespace
 {
-    void koradiBalancer(Simulate& sim, OBJECT* obj, MPI_Comm comm);
-    LoadLevel gridBalancer(Simulate& sim, OBJECT* obj, MPI_Comm comm);
-    void blockBalancer(Simulate& sim, OBJECT* obj, MPI_Comm comm);
+    void koradiBalancer(Simulate& sim, OBJECT* obj, MPI_Comm comm, const ReactionCost& cellCost);
+    void readKoradiParms(OBJECT* obj, KoradiParms& kp);
+    void graphBalancer(Simulate& sim, OBJECT* obj, MPI_Comm comm, const ReactionCost& cellCost);
+    LoadLevel gridBalancer(Simulate& sim, OBJECT* obj, MPI_Comm comm, const ReactionCost& cellCost);
+    void blockBalancer(Simulate& sim, OBJECT* obj, MPI_Comm comm, const ReactionCost& cellCost);
     LoadLevel workBoundScan(Simulate& sim, OBJECT* obj, MPI_Comm comm);
     int pioBalancerScan(Simulate& sim, OBJECT* obj, MPI_Comm comm);
 
-    void computeWorkHistogram(Simulate& sim, vector<AnatomyCell>& cells, int nProcs, MPI_Comm comm, double diffCost);
-    double costFunction(Long64 nTissue, Long64 area, Long64 height, double a);
+    void computeWorkHistogram(Simulate& sim, vector<AnatomyCell>& cells, int nProcs, MPI_Comm comm, double diffCost,
+                              const ReactionCost& cellCost);
+    double costFunction(double nTissue, Long64 area, Long64 height, double a);
     void computeVolHistogram(Simulate& sim, vector<AnatomyCell>& cells, int nProcs, MPI_Comm comm);
     void computeNCellsHistogram(Simulate& sim, vector<AnatomyCell>& cells, int nProcs, MPI_Comm comm);
     void printTaskLoadInfo(Simulate& sim, vector<AnatomyCell>& cells, int nProcs, MPI_Comm comm);
@@ -52,23 +59,99 @@ LoadLevel assignCellsToTasks(Simulate& sim, const string& name, MPI_Comm comm)
    loadLevel.nDiffusionCoresHint=0; 
    loadLevel.variantHint=""; 
 
+   string costFile;
+   objectGet(obj, "reactionCost", costFile, "");
+   ReactionCost cellCost(costFile, comm);
+   if (!cellCost.uniform() && (method == "workBound" || method == "pio"))
+   {
+      if (getRank(0) == 0)
+         cout << "reactionCost is not supported by the " << method
+              << " balancer.  Using cell counts." << endl;
+   }
+
+   string cacheDir;
+   objectGet(obj, "cacheDir", cacheDir, "");
+   if (!cacheDir.empty() && method == "pio")
+   {
+      if (getRank(0) == 0)
+         cout << "cacheDir is not supported by the pio balancer.  Not caching." << endl;
+      cacheDir = "";
+   }
+   string cacheKey;
+   bool cached = false;
+   if (!cacheDir.empty())
+   {
+      cacheKey = DecompositionCache::key(sim, obj, cellCost, comm);
+      cached = DecompositionCache::load(cacheDir, cacheKey, sim, loadLevel, comm);
+   }
+
    profileStart("Assignment");
-   if (method == "koradi")
-      koradiBalancer(sim, obj, comm);
-   else if (method == "grid")
-      loadLevel = gridBalancer(sim, obj, comm);
-   else if (method == "block")
-      blockBalancer(sim, obj, comm);
-   else if (method == "workBound")
-      loadLevel = workBoundScan(sim, obj, comm);
-   else if (method == "pio")
-      loadLevel.nDiffusionCoresHint = pioBalancerScan(sim, obj, comm);
-   else
-      assert(1==0);      
+   if (!cached)
+   {
+      if (method == "koradi")
+         koradiBalancer(sim, obj, comm, cellCost);
+      else if (method == "graph")
+         graphBalancer(sim, obj, comm, cellCost);
+      else if (method == "grid")
+         loadLevel = gridBalancer(sim, obj, comm, cellCost);
+      else if (method == "block")
+         blockBalancer(sim, obj, comm, cellCost);
+      else if (method == "workBound")
+         loadLevel = workBoundScan(sim, obj, comm);
+      else if (method == "pio")
+         loadLevel.nDiffusionCoresHint = pioBalancerScan(sim, obj, comm);
+      else
+         assert(1==0);      
+      if (!cacheDir.empty())
+         DecompositionCache::store(cacheDir, cacheKey, sim, loadLevel, comm);
+   }
+   loadLevel = placeDomains(sim, obj, loadLevel, comm);
    profileStop("Assignment");
    return loadLevel;
 }
 
+void rebalanceCellsToTasks(Simulate& sim, const string& name,
+                           const vector<double>& taskSeconds, int maxSteps,
+                           MPI_Comm comm)
+{
+   int nTasks, myRank;
+   MPI_Comm_size(comm, &nTasks);
+   MPI_Comm_rank(comm, &myRank);
+   OBJECT* obj = object_find(name.c_str(), "DECOMPOSITION");
+   vector<AnatomyCell>& cells = sim.anatomy_.cellArray();
+   assert(sim.anatomy_.nRemote() == 0);
+
+   KoradiParms kp;
+   readKoradiParms(obj, kp);
+   string costFile;
+   objectGet(obj, "reactionCost", costFile, "");
+   kp.cost = ReactionCost(costFile, comm);
+   kp.nCentersPerTask = 1;
+   kp.maxSteps = maxSteps;
+   kp.outputRate = -1;
+   kp.warmStart = true;
+
+   // The model says what a cell costs relative to the others, the
+   // timers say what the cells of each task actually cost.  Each cell
+   // remembers its task in sortind_ so that it keeps that factor
+   // wherever the balancer moves it.
+   double modelLoad = 0;
+   for (unsigned ii=0; ii<cells.size(); ++ii)
+   {
+      cells[ii].dest_ = myRank;
+      cells[ii].sortind_ = myRank;
+      modelLoad += kp.cost(cells[ii].cellType_);
+   }
+   kp.taskFactor.resize(nTasks);
+   MPI_Allgather(&modelLoad, 1, MPI_DOUBLE, &kp.taskFactor[0], 1, MPI_DOUBLE, comm);
+   for (int ii=0; ii<nTasks; ++ii)
+      kp.taskFactor[ii] = (kp.taskFactor[ii] > 0 ? taskSeconds[ii]/kp.taskFactor[ii] : 0);
+
+   profileStart("Koradi");
+   Koradi balancer(sim.anatomy_, kp);
+   profileStop("Koradi");
+}
+
 namespace
 {
    LoadLevel  workBoundScan(Simulate& sim, OBJECT* obj, MPI_Comm comm)
@@ -131,7 +214,7 @@ namespace
 
 namespace
 {
-   void koradiBalancer(Simulate& sim, OBJECT* obj, MPI_Comm comm)
+   void koradiBalancer(Simulate& sim, OBJECT* obj, MPI_Comm comm, const ReactionCost& cellCost)
    {
       int nTasks;  MPI_Comm_size(comm, &nTasks);
       stringstream buf;
@@ -140,16 +223,19 @@ namespace
       KoradiParms kp;
       int nCenters;      
       objectGet(obj, "nCenters", nCenters, buf.str());
-      objectGet(obj, "verbose",         kp.verbose,         "1");
-      objectGet(obj, "maxVoronoiSteps", kp.maxVoronoiSteps, "50");
-      objectGet(obj, "maxSteps",        kp.maxSteps,        "500");
-      objectGet(obj, "outputRate",      kp.outputRate,      "-1");
-      objectGet(obj, "alphaStep",       kp.alphaStep,       "0.01");
-      objectGet(obj, "tolerance",       kp.tolerance,       "0.03");
-      objectGet(obj, "nbrDeltaR",       kp.nbrDeltaR,       "2");
+      readKoradiParms(obj, kp);
       
+      kp.cost = cellCost;
       kp.nCentersPerTask = nCenters/nTasks;
       assert(nCenters > 0);
+      string warmStartFile;
+      objectGet(obj, "warmStart", warmStartFile, "");
+      kp.warmStart = !warmStartFile.empty();
+      if (kp.warmStart)
+      {
+         timestampBarrier("reading koradi warm start", comm);
+         loadAndAssignDomains(warmStartFile, kp.nCentersPerTask, sim, comm);
+      }
       
       profileStart("Koradi");
       Koradi balancer(sim.anatomy_, kp);
@@ -164,13 +250,50 @@ namespace
    }
 }
 
+namespace
+{
+   void readKoradiParms(OBJECT* obj, KoradiParms& kp)
+   {
+      objectGet(obj, "verbose",         kp.verbose,         "1");
+      objectGet(obj, "maxVoronoiSteps", kp.maxVoronoiSteps, "50");
+      objectGet(obj, "maxSteps",        kp.maxSteps,        "500");
+      objectGet(obj, "outputRate",      kp.outputRate,      "-1");
+      objectGet(obj, "alphaStep",       kp.alphaStep,       "0.01");
+      objectGet(obj, "tolerance",       kp.tolerance,       "0.03");
+      objectGet(obj, "nbrDeltaR",       kp.nbrDeltaR,       "2");
+   }
+}
+
+namespace
+{
+   void graphBalancer(Simulate& sim, OBJECT* obj, MPI_Comm comm, const ReactionCost& cellCost)
+   {
+      int nTasks;
+      MPI_Comm_size(comm, &nTasks);
+
+      GraphBalancerParms gp;
+      objectGet(obj, "verbose",        gp.verbose,        "1");
+      objectGet(obj, "maxRefineSteps", gp.maxRefineSteps, "20");
+      objectGet(obj, "tolerance",      gp.tolerance,      "0.03");
+      gp.cost = cellCost;
+
+      profileStart("GraphBalancer");
+      GraphBalancer balancer(sim.anatomy_, gp, comm);
+      profileStop("GraphBalancer");
+
+      vector<AnatomyCell>& cells = sim.anatomy_.cellArray();
+      computeNCellsHistogram(sim,cells,nTasks,comm);
+      computeVolHistogram(sim,cells,nTasks,comm);
+   }
+}
+
 namespace
 {
     // The grid load balancer assigns cells to a 3D process grid by minimizing
     // the maximum value of either a cost function or the bounding box volume
     // on any MPI task.  
     
-   LoadLevel gridBalancer(Simulate& sim, OBJECT* obj, MPI_Comm comm)
+   LoadLevel gridBalancer(Simulate& sim, OBJECT* obj, MPI_Comm comm, const ReactionCost& cellCost)
    {
       int nTasks, myRank;
       MPI_Comm_size(comm, &nTasks);
@@ -259,6 +382,7 @@ namespace
       objectGet(obj, "diffCost", diffCost, "0.1");
       if (myRank == 0)
          cout << "Grid load balance starting with relative diffusion cost diffCost = " << diffCost << endl;
+      diffCost *= cellCost.average(cells, comm);
 
       // choose quantity to minimize:  "volume" or "work" (default)
       string minimize;
@@ -271,14 +395,14 @@ namespace
       else
       {
          minimize = "work"; 
-         loadbal.initialDistByWorkFn(cells, sim.nx_, sim.ny_, sim.nz_, diffCost);
+         loadbal.initialDistByWorkFn(cells, sim.nx_, sim.ny_, sim.nz_, diffCost, cellCost);
       }
       profileStop("gd_assign_init");
 
       timestampBarrier("computing load histograms", MPI_COMM_WORLD);
       computeNCellsHistogram(sim,cells,npegrid,comm);
       computeVolHistogram(sim,cells,npegrid,comm);
-      computeWorkHistogram(sim,cells,npegrid,comm, diffCost);
+      computeWorkHistogram(sim,cells,npegrid,comm, diffCost, cellCost);
 
       int taskprint;
       objectGet(obj, "printTaskInfo", taskprint, "0");
@@ -475,7 +599,7 @@ namespace
     // for dense regions, larger blocks for diffuse regions sized according to work
     // function
     
-   void blockBalancer(Simulate& sim, OBJECT* obj, MPI_Comm comm)
+   void blockBalancer(Simulate& sim, OBJECT* obj, MPI_Comm comm, const ReactionCost& cellCost)
    {
       int nTasks, myRank;
       MPI_Comm_size(comm, &nTasks);
@@ -577,11 +701,12 @@ namespace
       objectGet(obj, "diffCost", diffCost, "0.125");
       if (myRank == 0)
          cout << "Block load balance starting with diffusion cost = " << diffCost << endl;
+      diffCost *= cellCost.average(cells, comm);
 
       profileStart("block_loadbal");
       int npes;
       int pesum_loc = 0;
-      pesum_loc += loadbal.block(cells, diffCost, nCols, localCols);
+      pesum_loc += loadbal.block(cells, diffCost, nCols, localCols, cellCost);
       MPI_Allreduce(&pesum_loc, &npes, 1, MPI_INT, MPI_SUM, comm);
       if (myRank == 0)
             cout << "Diffusion cost = " << diffCost << ", load distributed on " << npes << " tasks." << endl;
@@ -610,7 +735,7 @@ namespace
             trialDiffCost += 0.01;
             
          int pesum_loc = 0;
-         pesum_loc += loadbal.block(cells, trialDiffCost, nCols, localCols);
+         pesum_loc += loadbal.block(cells, trialDiffCost, nCols, localCols, cellCost);
          
          MPI_Allreduce(&pesum_loc, &npes, 1, MPI_INT, MPI_SUM, comm);
          if (myRank == 0)
@@ -723,7 +848,8 @@ namespace
 
 namespace
 {
-    void computeWorkHistogram(Simulate& sim, vector<AnatomyCell>& cells, int nProcs, MPI_Comm comm, double diffCost)
+    void computeWorkHistogram(Simulate& sim, vector<AnatomyCell>& cells, int nProcs, MPI_Comm comm, double diffCost,
+                              const ReactionCost& cellCost)
     {
        int nTasks, myRank;
        MPI_Comm_size(comm, &nTasks);
@@ -736,7 +862,7 @@ namespace
        vector<int> pemaxx(nProcs,-99999999);
        vector<int> pemaxy(nProcs,-99999999);
        vector<int> pemaxz(nProcs,-99999999);
-       vector<Long64> nloc(nProcs,0);
+       vector<double> nloc(nProcs,0);
        for (unsigned ii=0; ii<cells.size(); ++ii)
        {
           int peid = cells[ii].dest_;
@@ -748,7 +874,7 @@ namespace
           if (gpt.x > pemaxx[peid]) pemaxx[peid] = gpt.x;
           if (gpt.y > pemaxy[peid]) pemaxy[peid] = gpt.y;
           if (gpt.z > pemaxz[peid]) pemaxz[peid] = gpt.z;
-          nloc[peid]++;
+          nloc[peid] += cellCost(cells[ii].cellType_);
        }
        vector<int> peminx_all(nProcs);
        vector<int> peminy_all(nProcs);
@@ -756,14 +882,14 @@ namespace
        vector<int> pemaxx_all(nProcs);
        vector<int> pemaxy_all(nProcs);
        vector<int> pemaxz_all(nProcs);
-       vector<Long64> nall(nProcs);
+       vector<double> nall(nProcs);
        MPI_Allreduce(&peminx[0], &peminx_all[0], nProcs, MPI_INT, MPI_MIN, comm);
        MPI_Allreduce(&peminy[0], &peminy_all[0], nProcs, MPI_INT, MPI_MIN, comm);
        MPI_Allreduce(&peminz[0], &peminz_all[0], nProcs, MPI_INT, MPI_MIN, comm);
        MPI_Allreduce(&pemaxx[0], &pemaxx_all[0], nProcs, MPI_INT, MPI_MAX, comm);
        MPI_Allreduce(&pemaxy[0], &pemaxy_all[0], nProcs, MPI_INT, MPI_MAX, comm);
        MPI_Allreduce(&pemaxz[0], &pemaxz_all[0], nProcs, MPI_INT, MPI_MAX, comm);
-       MPI_Allreduce(&nloc[0], &nall[0], nProcs, MPI_LONG_LONG, MPI_SUM, comm);
+       MPI_Allreduce(&nloc[0], &nall[0], nProcs, MPI_DOUBLE, MPI_SUM, comm);
 
       if (myRank == 0)
       {
@@ -813,7 +939,7 @@ namespace
       }
     }
 
-    double costFunction(Long64 nTissue, Long64 area, Long64 height, double a)
+    double costFunction(double nTissue, Long64 area, Long64 height, double a)
     {
        Long64 dz4 = (height+2);
        if (dz4 % 4  != 0) dz4 += (4-dz4%4);
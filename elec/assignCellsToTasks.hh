@@ -2,6 +2,7 @@
 #define ASSIGN_CELLS_TO_TASKS_HH
 
 #include <string>
+#include <vector>
 #include <mpi.h>
 
 class Simulate;
@@ -9,4 +10,15 @@ class LoadLevel;
 
 LoadLevel assignCellsToTasks(Simulate& sim, const std::string& name, MPI_Comm comm);
 
+/** Moves the local cells of sim to new tasks with the koradi balancer,
+ *  starting from the current domains instead of from scratch.  The
+ *  load of a task is the cost of its cells from the reactionCost table
+ *  of the DECOMPOSITION object, scaled so that the cells of each task
+ *  add up to taskSeconds of that task.  The anatomy must not have
+ *  remote cells.  Each cell is left with the task it came from in
+ *  sortind_.  Collective. */
+void rebalanceCellsToTasks(Simulate& sim, const std::string& name,
+                           const std::vector<double>& taskSeconds, int maxSteps,
+                           MPI_Comm comm);
+
 #endif
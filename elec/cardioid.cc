@@ -68,7 +68,10 @@ MPI_Comm COMM_LOCAL = MPI_COMM_WORLD;
 int main(int argc, char** argv)
 {
    int npes, mype;
-   MPI_Init(&argc,&argv);
+   // The parallelDiffusionReaction loop calls MPI from several threads,
+   // one at a time.
+   int threadLevel;
+   MPI_Init_thread(&argc, &argv, MPI_THREAD_SERIALIZED, &threadLevel);
    MPI_Comm_size(MPI_COMM_WORLD, &npes);
    MPI_Comm_rank(MPI_COMM_WORLD, &mype);  
 
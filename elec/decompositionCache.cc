@@ -0,0 +1,209 @@
+#include "decompositionCache.hh"
+
+#include <cassert>
+#include <cctype>
+#include <cstdio>
+#include <dirent.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "Simulate.hh"
+#include "Anatomy.hh"
+#include "AnatomyCell.hh"
+#include "ReactionCost.hh"
+#include "LoadLevel.hh"
+#include "pioBalancer.hh"
+#include "writeCells.hh"
+#include "ioUtils.h"
+#include "mpiUtils.h"
+
+using namespace std;
+
+namespace
+{
+   void fnv1a(uint64_t& hash, const void* data, size_t nBytes)
+   {
+      const unsigned char* cc = (const unsigned char*) data;
+      for (size_t ii=0; ii<nBytes; ++ii)
+      {
+         hash ^= cc[ii];
+         hash *= 1099511628211ULL;
+      }
+   }
+
+   /** The keywords of obj without white space, sorted, and without
+    *  cacheDir so that moving the cache doesn't invalidate it. */
+   string balancerKeywords(OBJECT* obj)
+   {
+      vector<string> keyword;
+      stringstream in(object_keywordsAndValues(obj));
+      string statement;
+      while (getline(in, statement, ';'))
+      {
+         string compact;
+         for (unsigned ii=0; ii<statement.size(); ++ii)
+            if (!isspace(statement[ii]))
+               compact += statement[ii];
+         if (!compact.empty() && compact.compare(0, 9, "cacheDir=") != 0)
+            keyword.push_back(compact);
+      }
+      sort(keyword.begin(), keyword.end());
+      string result;
+      for (unsigned ii=0; ii<keyword.size(); ++ii)
+         result += keyword[ii] + ";";
+      return result;
+   }
+
+   void removeEntry(const string& dirName)
+   {
+      DIR* dir = opendir(dirName.c_str());
+      struct dirent* dirEntry;
+      while (dir && (dirEntry = readdir(dir)))
+      {
+         string name = dirEntry->d_name;
+         if (name != "." && name != "..")
+            remove((dirName + "/" + name).c_str());
+      }
+      if (dir)
+         closedir(dir);
+      rmdir(dirName.c_str());
+   }
+}
+
+namespace DecompositionCache
+{
+
+string key(Simulate& sim, OBJECT* obj, const ReactionCost& cellCost, MPI_Comm comm)
+{
+   int nTasks;
+   MPI_Comm_size(comm, &nTasks);
+   Anatomy& anatomy = sim.anatomy_;
+   const vector<AnatomyCell>& cells = anatomy.cellArray();
+
+   // A sum of per-cell hashes doesn't depend on where the cells are.
+   uint64_t localSum = 0;
+   for (unsigned ii=0; ii<cells.size(); ++ii)
+   {
+      uint64_t hash = 14695981039346656037ULL;
+      double cost = cellCost(cells[ii].cellType_);
+      fnv1a(hash, &cells[ii].gid_, sizeof(cells[ii].gid_));
+      fnv1a(hash, &cells[ii].cellType_, sizeof(cells[ii].cellType_));
+      fnv1a(hash, &cost, sizeof(cost));
+      localSum += hash;
+   }
+   uint64_t cellSum;
+   MPI_Allreduce(&localSum, &cellSum, 1, MPI_UINT64_T, MPI_SUM, comm);
+
+   uint64_t hash = 14695981039346656037ULL;
+   unsigned grid[4] = {anatomy.nx(), anatomy.ny(), anatomy.nz(), anatomy.nGlobal()};
+   fnv1a(hash, grid, sizeof(grid));
+   fnv1a(hash, &nTasks, sizeof(nTasks));
+   fnv1a(hash, &cellSum, sizeof(cellSum));
+   string keywords = balancerKeywords(obj);
+   fnv1a(hash, keywords.data(), keywords.size());
+   char buf[17];
+   sprintf(buf, "%016" PRIx64, hash);
+   return buf;
+}
+
+bool load(const string& cacheDir, const string& key,
+          Simulate& sim, LoadLevel& loadLevel, MPI_Comm comm)
+{
+   int nTasks, myRank;
+   MPI_Comm_size(comm, &nTasks);
+   MPI_Comm_rank(comm, &myRank);
+   string entry = cacheDir + "/" + key;
+
+   // rank 0 reads the "nD variant" line of every task.
+   vector<int> nD(nTasks);
+   vector<char> variant(nTasks*16, '\0');
+   int found = 0;
+   if (myRank == 0)
+   {
+      ifstream in((entry + "/loadLevel").c_str());
+      int nRead = 0;
+      string line;
+      while (nRead < nTasks && getline(in, line))
+      {
+         if (line.empty() || line[0] == '#')
+            continue;
+         istringstream fields(line);
+         string vv;
+         fields >> nD[nRead] >> vv;
+         if (vv != "-")
+            vv.copy(&variant[nRead*16], 15);
+         ++nRead;
+      }
+      found = (nRead == nTasks &&
+               access((entry + "/domains#000000").c_str(), R_OK) == 0);
+   }
+   MPI_Bcast(&found, 1, MPI_INT, 0, comm);
+   if (!found)
+      return false;
+
+   if (myRank == 0)
+      cout << "Loading the decomposition from " << entry << endl;
+   MPI_Scatter(&nD[0], 1, MPI_INT, &loadLevel.nDiffusionCoresHint, 1, MPI_INT, 0, comm);
+   char myVariant[16];
+   MPI_Scatter(&variant[0], 16, MPI_CHAR, myVariant, 16, MPI_CHAR, 0, comm);
+   loadLevel.variantHint = myVariant;
+   loadAndAssignDomains(entry + "/domains#", 1, sim, comm);
+   return true;
+}
+
+void store(const string& cacheDir, const string& key,
+           Simulate& sim, const LoadLevel& loadLevel, MPI_Comm comm)
+{
+   int nTasks, myRank;
+   MPI_Comm_size(comm, &nTasks);
+   MPI_Comm_rank(comm, &myRank);
+   string entry = cacheDir + "/" + key;
+
+   // Write to a private directory and rename it so readers never see
+   // a partial entry.
+   int pid = getpid();
+   MPI_Bcast(&pid, 1, MPI_INT, 0, comm);
+   stringstream tmpName;
+   tmpName << entry << ".tmp" << pid;
+   if (myRank == 0)
+   {
+      DirTestCreate(cacheDir.c_str());
+      DirTestCreate(tmpName.str().c_str());
+   }
+
+   vector<AnatomyCell>& cells = sim.anatomy_.cellArray();
+   for (unsigned ii=0; ii<cells.size(); ++ii)
+      cells[ii].dest_ = myRank;
+   writeCells(cells, sim.nx_, sim.ny_, sim.nz_, tmpName.str() + "/domains");
+
+   vector<int> nD(nTasks);
+   vector<char> variant(nTasks*16);
+   char myVariant[16] = {0};
+   assert(loadLevel.variantHint.size() < 16);
+   loadLevel.variantHint.copy(myVariant, 15);
+   int myND = loadLevel.nDiffusionCoresHint;
+   MPI_Gather(&myND, 1, MPI_INT, &nD[0], 1, MPI_INT, 0, comm);
+   MPI_Gather(myVariant, 16, MPI_CHAR, &variant[0], 16, MPI_CHAR, 0, comm);
+   if (myRank != 0)
+      return;
+
+   ofstream out((tmpName.str() + "/loadLevel").c_str());
+   out << "# nDiffusionCoresHint variantHint of each of " << nTasks << " tasks\n";
+   for (int ii=0; ii<nTasks; ++ii)
+   {
+      string vv(&variant[ii*16]);
+      out << nD[ii] << " " << (vv.empty() ? "-" : vv) << "\n";
+   }
+   out.close();
+   if (!out || rename(tmpName.str().c_str(), entry.c_str()) != 0)
+      removeEntry(tmpName.str());
+   else
+      cout << "Decomposition stored in " << entry << endl;
+}
+
+}
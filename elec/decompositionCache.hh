@@ -0,0 +1,42 @@
+#ifndef DECOMPOSITION_CACHE_HH
+#define DECOMPOSITION_CACHE_HH
+
+#include <string>
+#include <mpi.h>
+#include "object.h"
+
+class Simulate;
+class ReactionCost;
+struct LoadLevel;
+
+/** On-disk cache of the decompositions made by assignCellsToTasks.
+ *  Each entry is a directory named by a hash of everything the
+ *  balancer sees: the grid size, the number of tasks, a checksum of
+ *  the gid, cellType and reactionCost of every cell, and the
+ *  keywords of the DECOMPOSITION object.  It holds the domains# file
+ *  that the pio balancer reads and the load level hints of each task.
+ *  Placement isn't cached since it depends on the nodes of the run.
+ *
+ *  DECOMPOSITION keywords:
+ *    cacheDir (default none) turns the cache on.  The koradi, graph,
+ *      grid, block and workBound balancers look up their decomposition
+ *      in it and store it there when it is missing.
+ */
+namespace DecompositionCache
+{
+   /** Collective. */
+   std::string key(Simulate& sim, OBJECT* obj, const ReactionCost& cellCost,
+                   MPI_Comm comm);
+   /** Moves the cells to the tasks of the cached decomposition and
+    *  returns true, or leaves them alone and returns false when there
+    *  is no entry for key.  Collective. */
+   bool load(const std::string& cacheDir, const std::string& key,
+             Simulate& sim, LoadLevel& loadLevel, MPI_Comm comm);
+   /** Stores the decomposition of the local cells.  Concurrent runs
+    *  with the same key may race; the first to finish wins.
+    *  Collective. */
+   void store(const std::string& cacheDir, const std::string& key,
+              Simulate& sim, const LoadLevel& loadLevel, MPI_Comm comm);
+}
+
+#endif
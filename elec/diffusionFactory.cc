@@ -1,6 +1,7 @@
 #include "diffusionFactory.hh"
 
 #include <cassert>
+#include <iostream>
 
 #include "Diffusion.hh"
 #include "object_cc.hh"
@@ -16,6 +17,7 @@
 //#include "OpenmpGpuFlatDiffusion.hh"
 #include "CUDADiffusion.hh"
 #include "Simulate.hh"
+#include "mpiUtils.h"
 
 class Anatomy;
 class ThreadTeam;
@@ -76,22 +78,48 @@ namespace
       FGRUtils::FGRDiffusionParms p;
       objectGet(obj, "diffusionScale", p.diffusionScale_, "1.0", "l^3/capacitance");
       objectGet(obj, "printBBox",      p.printBBox_, "0");
+      objectGet(obj, "temporalTileWidth", p.temporalTileWidth_, "4");
+      objectGet(obj, "checkWeightPrecision", p.checkWeightPrecision_, "1");
+      objectGet(obj, "compressWeights", p.compressWeights_, "0");
+      objectGet(obj, "sparseBricks", p.sparseBricks_, "0");
+      string weightPrecision;
+      objectGet(obj, "weightPrecision", weightPrecision, DEFAULT_WEIGHT_PRECISION);
+      assert(weightPrecision == "float" || weightPrecision == "double");
+      bool single = (weightPrecision == "float");
       string defaultVariant = "omp";
       if (! variantHint.empty())
          defaultVariant = variantHint;
       string variant;
       objectGet(obj, "variant", variant, defaultVariant);
+      bool omp = (variant == "omp" || simLoopType == Simulate::omp);
+      if (!omp && variant == "threads" && single && getRank(0) == 0)
+         cout << "weightPrecision = float is not supported here (variant = "
+              << variant << ").  Using double." << endl;
+      if (!omp && p.compressWeights_ && getRank(0) == 0)
+         cout << "compressWeights is not supported here (variant = "
+              << variant << ").  Not compressing." << endl;
+      if (!omp && p.sparseBricks_ && getRank(0) == 0)
+         cout << "sparseBricks is not supported here (variant = "
+              << variant << ").  Using the dense layout." << endl;
       if (0) {}
+      else if ((variant == "omp" || simLoopType == Simulate::omp) && single)
+         return new FGRDiffusionOMP<float>(p, anatomy);
       else if (variant == "omp" || simLoopType == Simulate::omp)
-         return new FGRDiffusionOMP(p, anatomy);
+         return new FGRDiffusionOMP<double>(p, anatomy);
       else if (variant == "threads")
          return new FGRDiffusionThreads(p, anatomy, threadInfo, reactionThreadInfo);
+      else if (variant == "simd" && single)
+         return new FGRDiffusion<float>(p, anatomy, threadInfo, reactionThreadInfo);
       else if (variant == "simd")
-         return new FGRDiffusion(p, anatomy, threadInfo, reactionThreadInfo);
-      else if (variant == "strip" )
-         return new FGRDiffusionStrip(p, anatomy, threadInfo, reactionThreadInfo);
-      else if (variant == "overlap" )
-         return new FGRDiffusionOverlap(p, anatomy, threadInfo, reactionThreadInfo);
+         return new FGRDiffusion<double>(p, anatomy, threadInfo, reactionThreadInfo);
+      else if (variant == "strip" && single)
+         return new FGRDiffusionStrip<float>(p, anatomy, threadInfo, reactionThreadInfo);
+      else if (variant == "strip")
+         return new FGRDiffusionStrip<double>(p, anatomy, threadInfo, reactionThreadInfo);
+      else if (variant == "overlap" && single)
+         return new FGRDiffusionOverlap<float>(p, anatomy, threadInfo, reactionThreadInfo);
+      else if (variant == "overlap")
+         return new FGRDiffusionOverlap<double>(p, anatomy, threadInfo, reactionThreadInfo);
 
 
       // unreachable.  Should have matched a clause above.
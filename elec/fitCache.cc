@@ -0,0 +1,160 @@
+#include "fitCache.hh"
+
+#include <cassert>
+#include <cstdio>
+#include <dirent.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <mpi.h>
+#include "Interpolation.hh"
+#include "ioUtils.h"
+#include "mpiUtils.h"
+
+using namespace std;
+
+namespace
+{
+   struct Entry
+   {
+      double error;
+      Interpolation interp;
+   };
+
+   bool g_active = false;
+   string g_cacheDir;
+   map<string, Entry> g_entries;
+
+   void fnv1a(uint64_t& hash, const void* data, size_t nBytes)
+   {
+      const unsigned char* cc = (const unsigned char*) data;
+      for (size_t ii=0; ii<nBytes; ++ii)
+      {
+         hash ^= cc[ii];
+         hash *= 1099511628211ULL;
+      }
+   }
+
+   /** An entry is "error numNumer numDenom coeff..." */
+   bool parseEntry(istream& in, Entry& entry)
+   {
+      Interpolation& interp = entry.interp;
+      in >> entry.error >> interp.numNumer_ >> interp.numDenom_;
+      if (!in || interp.numNumer_ < 1 || interp.numDenom_ < 1)
+         return false;
+      interp.coeff_.resize(interp.numNumer_ + interp.numDenom_ - 1);
+      for (unsigned ii=0; ii<interp.coeff_.size(); ++ii)
+         in >> interp.coeff_[ii];
+      return bool(in);
+   }
+}
+
+namespace FitCache
+{
+
+void open(const string& cacheDir)
+{
+   close();
+   g_cacheDir = cacheDir;
+   g_active = true;
+
+   // rank 0 gathers the directory into one buffer of "key entry" lines
+   string buffer;
+   if (getRank(0) == 0)
+   {
+      DirTestCreate(cacheDir.c_str());
+      DIR* dir = opendir(cacheDir.c_str());
+      struct dirent* dirEntry;
+      while (dir && (dirEntry = readdir(dir)))
+      {
+         string name = dirEntry->d_name;
+         if (name.size() != 20 || name.substr(16) != ".fit")
+            continue;
+         ifstream in((cacheDir + "/" + name).c_str());
+         string line;
+         getline(in, line);
+         buffer += name.substr(0, 16) + " " + line + "\n";
+      }
+      if (dir)
+         closedir(dir);
+   }
+   int size = buffer.size();
+   MPI_Bcast(&size, 1, MPI_INT, 0, MPI_COMM_WORLD);
+   buffer.resize(size);
+   MPI_Bcast(&buffer[0], size, MPI_CHAR, 0, MPI_COMM_WORLD);
+
+   stringstream in(buffer);
+   string line;
+   while (getline(in, line))
+   {
+      stringstream lineIn(line);
+      string key;
+      Entry entry;
+      lineIn >> key;
+      if (parseEntry(lineIn, entry))
+         g_entries[key] = entry;
+   }
+}
+
+void close()
+{
+   g_active = false;
+   g_entries.clear();
+}
+
+bool active()
+{
+   return g_active;
+}
+
+string key(const vector<double>& inputs, const vector<double>& outputs,
+           double tolerance, double rangeWindow)
+{
+   uint64_t hash = 14695981039346656037ULL;
+   int maxTerms = MAX_TERM_COUNT;
+   fnv1a(hash, &maxTerms, sizeof(maxTerms));
+   fnv1a(hash, &tolerance, sizeof(tolerance));
+   fnv1a(hash, &rangeWindow, sizeof(rangeWindow));
+   fnv1a(hash, &inputs[0], inputs.size()*sizeof(double));
+   fnv1a(hash, &outputs[0], outputs.size()*sizeof(double));
+   char buf[17];
+   sprintf(buf, "%016" PRIx64, hash);
+   return buf;
+}
+
+bool lookup(const string& key, Interpolation& interp, double& error)
+{
+   map<string, Entry>::const_iterator iter = g_entries.find(key);
+   if (iter == g_entries.end())
+      return false;
+   interp = iter->second.interp;
+   error = iter->second.error;
+   return true;
+}
+
+void store(const string& key, const Interpolation& interp, double error)
+{
+   Entry& entry = g_entries[key];
+   entry.interp = interp;
+   entry.error = error;
+   if (getRank(0) != 0)
+      return;
+
+   // write to a private name and rename so readers never see a partial entry
+   string name = g_cacheDir + "/" + key + ".fit";
+   stringstream tmpName;
+   tmpName << name << ".tmp" << getpid();
+   ofstream out(tmpName.str().c_str());
+   out.precision(17);
+   out << error << " " << interp.numNumer_ << " " << interp.numDenom_;
+   for (unsigned ii=0; ii<interp.coeff_.size(); ++ii)
+      out << " " << interp.coeff_[ii];
+   out << "\n";
+   out.close();
+   if (!out || rename(tmpName.str().c_str(), name.c_str()) != 0)
+      remove(tmpName.str().c_str());
+}
+
+}
@@ -0,0 +1,31 @@
+#ifndef FIT_CACHE_HH
+#define FIT_CACHE_HH
+
+#include <string>
+#include <vector>
+
+class Interpolation;
+
+/** On-disk cache of the rational fits made by Interpolation::create.
+ *  Entries are keyed by a hash of everything the fit depends on (the
+ *  sampled inputs and outputs, the tolerance and the range window),
+ *  so the model, function, range, dt and cell parameters are all part
+ *  of the key without anyone having to list them.
+ *
+ *  open is collective: rank 0 reads the whole cache directory and
+ *  broadcasts it.  While a cache is open Interpolation::create looks
+ *  up every fit in it and rank 0 adds the fits that were missing. */
+namespace FitCache
+{
+   void open(const std::string& cacheDir);
+   void close();
+   bool active();
+
+   std::string key(const std::vector<double>& inputs,
+                   const std::vector<double>& outputs,
+                   double tolerance, double rangeWindow);
+   bool lookup(const std::string& key, Interpolation& interp, double& error);
+   void store(const std::string& key, const Interpolation& interp, double error);
+}
+
+#endif
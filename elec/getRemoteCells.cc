@@ -1,5 +1,6 @@
 #include "getRemoteCells.hh"
 #include <vector>
+#include <algorithm>
 
 #include "Simulate.hh"
 #include "Anatomy.hh"
@@ -55,7 +56,10 @@ void getRemoteCells(Simulate& sim, const string& name, MPI_Comm comm)
    for (unsigned ii=0; ii<anatomy.size(); ++ii)
       myCells[ii] = anatomy.gid(ii);
    
-   GridRouter router(myCells, nx, ny, nz, MPI_COMM_WORLD);
+   // Each diffusion substep consumes one layer of the halo, and so
+   // does each time step between exchanges of a deep halo.
+   anatomy.haloDepth() = max(sim.diffusionSubsteps_, sim.haloInterval_);
+   GridRouter router(myCells, nx, ny, nz, MPI_COMM_WORLD, anatomy.haloDepth());
    sim.sendMap_ = router.sendMap();
    sim.commTable_ = new CommTable(router.commTable());
 
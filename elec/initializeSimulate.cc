@@ -9,12 +9,15 @@
 
 #include "initializeAnatomy.hh"
 #include "assignCellsToTasks.hh"
+#include "ReactionCost.hh"
 #include "diffusionFactory.hh"
+#include "Diffusion.hh"
 #include "ReactionManager.hh"
 #include "stimulusFactory.hh"
 #include "Stimulus.hh"
 #include "sensorFactory.hh"
 #include "getRemoteCells.hh"
+#include "DeepHalo.hh"
 #include "Anatomy.hh"
 #include "mpiUtils.h"
 #include "PerformanceTimers.hh"
@@ -58,12 +61,98 @@ namespace
      simulation., decomposition}
    @kw{diffusion, The name of the DIFFUSION object for this simulation.,
      diffusion}
+   @kw{diffusionSubsteps, The number of diffusion substeps taken per
+     time step.  Values greater than one exchange a halo that is
+     diffusionSubsteps cells deep once per time step and let the
+     diffusion object advance all substeps with temporal tiling.
+     Only supported by the omp loop., 1}
+   @kw{haloCodec, Wire format of the voltage halo.  none sends doubles\,
+     float sends floats and delta16 sends the change since the last
+     exchange quantized to 16 bits with one scale per message.  The
+     lossy formats need the copy haloPack.  Ignored on SPI builds., none}
+   @kw{haloCodecValidate, When set the senders track the largest
+     difference between a voltage and what its receivers reconstruct.
+     The maximum over all tasks is printed at the end of the run.  For
+     an end to end check compare the snapshots against a run with
+     haloCodec = none using compareSnapshots., 0}
+   @kw{haloDeviceBuffers, When set the omp loop hands the device copies
+     of the halo send and receive buffers to MPI\, which has to be CUDA
+     aware\, instead of staging them through the host.  Needs a CUDA or
+     ENABLE_HOST_DEVICE build\, the irecv\, persistent or neighbor
+     haloExchange and haloCodec = none\, and falls back to host buffers
+     otherwise., 0}
+   @kw{haloExchange, How the voltage halo is communicated.  irecv posts
+     new MPI_Irecv/MPI_Isend pairs every time step\, persistent starts
+     persistent requests that are set up once\, neighbor uses
+     MPI_Ineighbor_alltoallv on a distributed graph communicator\, and
+     rma puts the halo straight into the receive buffers of the
+     neighbors with MPI_Put in post/start/complete/wait epochs.  shm
+     copies the halo of neighbors on the same node through an MPI
+     shared memory window with a node wide barrier instead of messages
+     and sends the rest like irecv.  Compare the HaloExchange timers to pick one.  Ignored on SPI
+     builds., irecv}
+   @kw{haloInterval, Time steps between halo exchanges.  Values greater
+     than one exchange a halo that is haloInterval cells deep together
+     with the reaction state of its cells and compute the halo cells
+     redundantly in between\, trading extra reaction and diffusion
+     work for fewer and larger messages.  Only supported by the omp
+     loop without diffusionSubsteps or reactionTileSize., 1}
+   @kw{haloPack, copy gathers the halo into a send buffer and the
+     diffusion scatters it from a receive buffer\, both threaded.
+     datatype sends straight from Vm and receives straight into the
+     diffusion block through MPI derived datatypes\, skipping both
+     copies.  datatype needs the omp loop and the irecv or persistent
+     haloExchange\, and falls back to copy when the diffusion or the
+     exchange can't support it., copy}
    @kw{heap, Storage allocated for IO buffers, 500}
    @kw{dt, The time step., 0.01 msec}
    @kw{loop, The initial loop count for the simulation., 0}
    @kw{maxLoop, The maximum value for the loop count., 1000}
    @kw{printRate, , }
+   @kw{progressThread, With the parallelDiffusionReaction loop a
+     thread on this core is taken away from the reaction to drive the
+     halo exchange.  It starts the exchange and keeps testing it so
+     that MPI makes progress while the diffusion computes the
+     overlapped part of the stencil.  Needs MPI_THREAD_SERIALIZED.
+     -1 leaves the exchange to the first diffusion thread., -1}
    @kw{reaction, The name of the REACTION object for this simulation., reaction}
+   @kw{reactionCostCalibrate, When set to a file name each task times
+     every reaction model on a block of resting cells before the cells
+     are assigned to tasks\, and the diffusion and integration that
+     every cell does.  The average cost per cell of each cellType\,
+     reaction plus that baseline\, is written to the file relative to
+     the most expensive cell.
+     Give the file to the reactionCost keyword of the DECOMPOSITION so
+     that the load balancers weight the cells with it., No calibration}
+   @kw{reactionMultirate, With the fused loop (reactionTileSize > 0)
+     tiles whose cells are all quiescent update their reaction state
+     only every reactionMultirate steps\, over all the steps they
+     missed.  In between they are integrated with their last reaction
+     current.  Only models that support it (BetterTT06\, Passive) are
+     affected.  Before steps that write sensors or checkpoints or may
+     rebalance all tiles are brought up to date.  One disables
+     multirate., 1}
+   @kw{reactionMultirateGateThreshold, A tile is quiescent only while
+     the gates of its model change by less than this value per ms.,
+     0.001}
+   @kw{reactionMultirateThreshold, A tile is quiescent while |dVm/dt|
+     of every cell is below this value in mV/ms., 0.1}
+   @kw{reactionTileSize, When positive the omp loop fuses the reaction
+     and integrator.  Cells are reacted and integrated in tiles of
+     this many cells while their data is still in cache.  This gives
+     up the overlap of the reaction with the halo exchange.  Zero
+     selects the unfused loop., 0}
+   @kw{rebalanceRate, With the omp loop the tasks compare how long
+     they spent computing every rebalanceRate time steps.  When the
+     slowest task is more than rebalanceThreshold above the average
+     the koradi balancer moves the cells\, starting from the current
+     domains and weighting the cells of each task by its measured time.
+     The cells take their reaction state with them and the halo\,
+     diffusion\, stimulus and sensor objects are rebuilt.  Sensors
+     start over\, as on a restart.  The koradi keywords of the DECOMPOSITION apply
+     whatever its method., -1 (never)}
+   @kw{rebalanceSteps, The most koradi steps of a rebalance., 100}
+   @kw{rebalanceThreshold, See rebalanceRate., 0.1}
    @kw{sensor, The name of the sensor object(s) for this simulation.
      Multiple sensors may be specified., No sensors}
    @kw{stateFile, The name of the file(s) from which to load cell model
@@ -164,6 +253,88 @@ void initializeSimulate(const string& name, Simulate& sim)
       else
          sim.loopType_ = Simulate::omp;
    }
+   objectGet(obj, "haloExchange", tmp, "irecv");
+   if (tmp == "irecv")
+      sim.haloExchangeMode_ = haloIrecv;
+   else if (tmp == "persistent")
+      sim.haloExchangeMode_ = haloPersistent;
+   else if (tmp == "neighbor")
+      sim.haloExchangeMode_ = haloNeighbor;
+   else if (tmp == "rma")
+      sim.haloExchangeMode_ = haloRma;
+   else if (tmp == "shm")
+      sim.haloExchangeMode_ = haloShm;
+   else
+   {
+      if (getRank(0) == 0)
+         cout << "Unknown haloExchange " << tmp << endl;
+      assert(false); // reachable only due to bad input
+   }
+   objectGet(obj, "haloCodec", tmp, "none");
+   if (tmp == "none")
+      sim.haloCodec_ = haloCodecNone;
+   else if (tmp == "float")
+      sim.haloCodec_ = haloCodecFloat;
+   else if (tmp == "delta16")
+      sim.haloCodec_ = haloCodecDelta16;
+   else
+   {
+      if (getRank(0) == 0)
+         cout << "Unknown haloCodec " << tmp << endl;
+      assert(false); // reachable only due to bad input
+   }
+   objectGet(obj, "haloCodecValidate", sim.haloCodecValidate_, "0");
+   objectGet(obj, "haloDeviceBuffers", sim.haloDeviceBuffers_, "0");
+   objectGet(obj, "haloPack", tmp, "copy");
+   if (tmp != "copy" && tmp != "datatype")
+   {
+      if (getRank(0) == 0)
+         cout << "Unknown haloPack " << tmp << endl;
+      assert(false); // reachable only due to bad input
+   }
+   sim.haloDatatypes_ = (tmp == "datatype");
+   assert(!sim.haloDatatypes_ || sim.loopType_ == Simulate::omp);
+   objectGet(obj, "reactionTileSize", sim.reactionTileSize_, "0");
+   objectGet(obj, "diffusionSubsteps", sim.diffusionSubsteps_, "1");
+   if (sim.diffusionSubsteps_ < 1 ||
+       (sim.diffusionSubsteps_ > 1 && sim.loopType_ != Simulate::omp))
+   {
+      if (getRank(0) == 0)
+         cout << "diffusionSubsteps has to be at least one, and more than "
+              << "one needs the omp loop." << endl;
+      assert(false); // reachable only due to bad input
+   }
+   objectGet(obj, "haloInterval", sim.haloInterval_, "1");
+   assert(sim.haloInterval_ > 0);
+   if (sim.haloInterval_ > 1 &&
+       (sim.loopType_ != Simulate::omp || sim.diffusionSubsteps_ > 1 ||
+        sim.reactionTileSize_ > 0 || sim.haloDatatypes_ ||
+        sim.haloCodec_ != haloCodecNone))
+   {
+      if (getRank(0) == 0)
+         cout << "haloInterval > 1 needs the omp loop without diffusionSubsteps,\n"
+              << "reactionTileSize, haloPack = datatype or haloCodec." << endl;
+      assert(false); // reachable only due to bad input
+   }
+   objectGet(obj, "rebalanceRate", sim.rebalanceRate_, "-1");
+   objectGet(obj, "rebalanceThreshold", sim.rebalanceThreshold_, "0.1");
+   objectGet(obj, "rebalanceSteps", sim.rebalanceSteps_, "100");
+   if (sim.rebalanceRate_ > 0 && sim.loopType_ != Simulate::omp)
+   {
+      if (getRank(0) == 0)
+         cout << "rebalanceRate is not supported by the parallelDiffusionReaction loop.  Not rebalancing." << endl;
+      sim.rebalanceRate_ = -1;
+   }
+   string costFile;
+   objectGet(obj, "reactionCostCalibrate", costFile, "");
+   if (!costFile.empty())
+   {
+      timestampBarrier("calibrating reaction cost", MPI_COMM_WORLD);
+      vector<string> reactionNames;
+      objectGet(obj, "reaction", reactionNames);
+      calibrateReactionCost(reactionNames, sim.dt_, costFile, MPI_COMM_WORLD);
+   }
+
    timestampBarrier("assigning cells to tasks", MPI_COMM_WORLD);
    string decompositionName;
    objectGet(obj, "decomposition", decompositionName, "decomposition");
@@ -195,11 +366,40 @@ void initializeSimulate(const string& name, Simulate& sim)
       sim.diffusionThreads_ = threadServer.getThreadTeam(diffusionCores);
       if (getRank(0) == 0)
          cout << "Diffusion Threads: " << sim.diffusionThreads_ << endl;
+      int progressCore;
+      objectGet(obj, "progressThread", progressCore, "-1");
+      int threadLevel;
+      MPI_Query_thread(&threadLevel);
+      if (progressCore >= 0 && threadLevel < MPI_THREAD_SERIALIZED)
+      {
+         if (getRank(0) == 0)
+            cout << "progressThread is not supported here (MPI thread level "
+                 << threadLevel << ").  Using the diffusion threads." << endl;
+         progressCore = -1;
+      }
+      if (progressCore >= 0)
+      {
+         sim.progressThreads_ = threadServer.getThreadTeam(vector<unsigned>(1, progressCore));
+         if (getRank(0) == 0)
+            cout << "Progress Thread: " << sim.progressThreads_ << endl;
+      }
       sim.reactionThreads_ = threadServer.getThreadTeam(vector<unsigned>());
       if (getRank(0) == 0)
          cout << "Reaction Threads: " << sim.reactionThreads_ << endl;
    }
    
+   initializeLocalObjects(sim, loadLevel.variantHint);
+}
+
+void initializeLocalObjects(Simulate& sim, string variantHint)
+{
+   int myRank;
+   MPI_Comm_rank(MPI_COMM_WORLD, &myRank);
+   OBJECT* obj = objectFind(sim.name_, "SIMULATE");
+   string nameTmp;
+   string decompositionName;
+   objectGet(obj, "decomposition", decompositionName, "decomposition");
+
    timestampBarrier("building reaction object", MPI_COMM_WORLD);
    vector<string> reactionNames;
    objectGet(obj, "reaction", reactionNames);
@@ -214,6 +414,20 @@ void initializeSimulate(const string& name, Simulate& sim)
       cellTypes[ii] = sim.anatomy_.cellType(ii);
    }
    sim.reaction_->create(sim.dt_, cellTypes, sim.reactionThreads_);
+   int multirate;
+   double multirateThreshold;
+   double multirateGateThreshold;
+   objectGet(obj, "reactionMultirate", multirate, "1");
+   objectGet(obj, "reactionMultirateThreshold", multirateThreshold, "0.1");
+   objectGet(obj, "reactionMultirateGateThreshold", multirateGateThreshold, "0.001");
+   if (multirate < 1 || (multirate > 1 && sim.reactionTileSize_ <= 0))
+   {
+      if (getRank(0) == 0)
+         cout << "reactionMultirate has to be at least one, and more than one "
+              << "needs the fused loop (reactionTileSize > 0)." << endl;
+      assert(false); // reachable only due to bad input
+   }
+   sim.reaction_->setMultirate(multirate, multirateThreshold, multirateGateThreshold);
    timestampBarrier("finished building reaction object", MPI_COMM_WORLD);
 
    sim.printIndex_ = -1;
@@ -248,7 +462,14 @@ void initializeSimulate(const string& name, Simulate& sim)
    objectGet(obj, "diffusion", nameTmp, "diffusion");
    sim.diffusion_ = diffusionFactory(nameTmp, sim.anatomy_, sim.diffusionThreads_,
                                      sim.reactionThreads_,
-                                     sim.loopType_,loadLevel.variantHint);
+                                     sim.loopType_, variantHint);
+   if (sim.diffusionSubsteps_ > 1 && !sim.diffusion_->supportsSubsteps())
+   {
+      if (getRank(0) == 0)
+         cout << "diffusionSubsteps > 1 is not supported by diffusion "
+              << nameTmp << ".  It needs the omp FGR diffusion." << endl;
+      assert(false); // reachable only due to bad input
+   }
    
    timestampBarrier("building stimulus object", MPI_COMM_WORLD);
    vector<string> names;
@@ -261,6 +482,12 @@ void initializeSimulate(const string& name, Simulate& sim)
       else
 	 delete stim;
    }
+   sim.deepHalo_ = 0;
+   if (sim.haloInterval_ > 1)
+   {
+      timestampBarrier("building deep halo", MPI_COMM_WORLD);
+      sim.deepHalo_ = new DeepHalo(sim, reactionNames, names);
+   }
 
    timestampBarrier("building sensor object", MPI_COMM_WORLD);
    names.clear();
@@ -5,6 +5,10 @@
 
 class Simulate;
 void initializeSimulate(const std::string& name, Simulate& sim);
+/** Builds the objects that depend on which cells are local: reaction,
+ *  halo, diffusion, stimulus, deep halo and sensors.  Called by
+ *  initializeSimulate and again when the cells are rebalanced. */
+void initializeLocalObjects(Simulate& sim, std::string variantHint);
 
 
 #endif
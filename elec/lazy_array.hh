@@ -390,7 +390,7 @@ class lazy_array
       {
           
          if (NUMSPACES == 1) {}
-#ifdef USE_CUDA
+#if NUMSPACES > 1
          else if (NUMSPACES == 2) {
             ExecutionSpace otherSpace;
             if (space == GPU) { otherSpace = CPU; }
@@ -14,51 +14,48 @@
 
 using namespace std;
 
-namespace
+void loadAndAssignDomains(const string& filename, int nDomainsPerTask,
+                          Simulate& sim, MPI_Comm comm)
 {
-   void loadAndAssignDomains(
-      const string& filename, Simulate& sim, MPI_Comm comm)
+   int nTasks;
+   MPI_Comm_size(comm, &nTasks);
+   
+   BucketOfBits* data = loadAndDistributeState(filename, sim.anatomy_);
+   unsigned gidIndex = data->getIndex("gid");
+   unsigned domainIndex = data->getIndex("domain");
+   assert(gidIndex != data->nFields());
+   assert(domainIndex != data->nFields());
+   
+   vector<AnatomyCell>& cells = sim.anatomy_.cellArray();
+   for (unsigned ii=0; ii<sim.anatomy_.size(); ++ii)
    {
-      int nTasks;
-      MPI_Comm_size(comm, &nTasks);
-      
-      BucketOfBits* data = loadAndDistributeState(filename, sim.anatomy_);
-      unsigned gidIndex = data->getIndex("gid");
-      unsigned domainIndex = data->getIndex("domain");
-      assert(gidIndex != data->nFields());
-      assert(domainIndex != data->nFields());
-      
-      vector<AnatomyCell>& cells = sim.anatomy_.cellArray();
-      for (unsigned ii=0; ii<sim.anatomy_.size(); ++ii)
-      {
-         BucketOfBits::Record rr = data->getRecord(ii);
-         Long64 gidTmp;
-         rr.getValue(gidIndex, gidTmp);
-         assert(gidTmp == sim.anatomy_.gid(ii));
-         rr.getValue(domainIndex, cells[ii].dest_);
-         assert(cells[ii].dest_ < nTasks); // need better error handling
-      }
-      sort(cells.begin(),cells.end(),AnatomyCell::destLessThan);
-      unsigned nLocal = cells.size();
-      vector<unsigned> dest(nLocal);
-      vector<unsigned> nRecv(nTasks, 0);
-      for (unsigned ii=0; ii<cells.size(); ++ii)
-      {
-         dest[ii] = cells[ii].dest_;
-         ++nRecv[dest[ii]];
-      }
-      vector<int> recvCnts(nTasks, 1);
-      int nFinal;
-      MPI_Reduce_scatter(&nRecv[0], &nFinal, &recvCnts[0], MPI_UNSIGNED, MPI_SUM, comm);
-      
-      unsigned capacity = max(vector<AnatomyCell>::size_type(nFinal), cells.size());
-      cells.resize(capacity);
-      assignArray((unsigned char*)&(cells[0]), &nLocal, cells.capacity(),
-                  sizeof(AnatomyCell), &(dest[0]), 0, comm);
-      cells.resize(nLocal);
-      assert(nFinal == nLocal);
-      delete data;
+      BucketOfBits::Record rr = data->getRecord(ii);
+      Long64 gidTmp;
+      rr.getValue(gidIndex, gidTmp);
+      assert(gidTmp == sim.anatomy_.gid(ii));
+      rr.getValue(domainIndex, cells[ii].dest_);
+      assert(cells[ii].dest_ < nTasks*nDomainsPerTask); // need better error handling
+   }
+   sort(cells.begin(),cells.end(),AnatomyCell::destLessThan);
+   unsigned nLocal = cells.size();
+   vector<unsigned> dest(nLocal);
+   vector<unsigned> nRecv(nTasks, 0);
+   for (unsigned ii=0; ii<cells.size(); ++ii)
+   {
+      dest[ii] = cells[ii].dest_/nDomainsPerTask;
+      ++nRecv[dest[ii]];
    }
+   vector<int> recvCnts(nTasks, 1);
+   int nFinal;
+   MPI_Reduce_scatter(&nRecv[0], &nFinal, &recvCnts[0], MPI_UNSIGNED, MPI_SUM, comm);
+   
+   unsigned capacity = max(vector<AnatomyCell>::size_type(nFinal), cells.size());
+   cells.resize(capacity);
+   assignArray((unsigned char*)&(cells[0]), &nLocal, cells.capacity(),
+               sizeof(AnatomyCell), &(dest[0]), 0, comm);
+   cells.resize(nLocal);
+   assert(nFinal == nLocal);
+   delete data;
 }
 
 class DomainData
@@ -131,7 +128,7 @@ int pioBalancer(const string& domainFile,
                 Simulate& sim,
                 MPI_Comm comm)
 {
-   loadAndAssignDomains(domainFile, sim, comm);
+   loadAndAssignDomains(domainFile, 1, sim, comm);
    int nD = loadAndDistributeDiffusionCores(pxyzFile, comm);
    return nD;
 }
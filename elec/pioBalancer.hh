@@ -6,6 +6,12 @@
 
 class Simulate;
 
+/** Reads the domain of each cell from domainFile and moves the cells
+ *  to the task of their domain, nDomainsPerTask consecutive domains per
+ *  task.  The domain is left in dest_.  Collective. */
+void loadAndAssignDomains(const std::string& domainFile, int nDomainsPerTask,
+                          Simulate& sim, MPI_Comm comm);
+
 int pioBalancer(const std::string& domainFile,
                 const std::string& pxyzFile,
                 Simulate& sim,
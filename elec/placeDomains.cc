@@ -0,0 +1,332 @@
+#include "placeDomains.hh"
+
+#include <vector>
+#include <map>
+#include <queue>
+#include <string>
+#include <cassert>
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+
+#include "object_cc.hh"
+#include "Simulate.hh"
+#include "Anatomy.hh"
+#include "AnatomyCell.hh"
+#include "GridRouter.hh"
+#include "CommTable.hh"
+#include "LoadLevel.hh"
+#include "mpiUtils.h"
+
+using namespace std;
+
+namespace
+{
+   /** nbr[d][e] is the number of halo items domains d and e exchange,
+    *  counting both directions. */
+   typedef vector<map<int, double> > Graph;
+
+   /** Lowest rank of comm in the same group as this rank after
+    *  splitting comm by splitType. */
+   int groupLeader(MPI_Comm comm, int splitType)
+   {
+      int myRank;
+      MPI_Comm_rank(comm, &myRank);
+      MPI_Comm group;
+      MPI_Comm_split_type(comm, splitType, myRank, MPI_INFO_NULL, &group);
+      if (group == MPI_COMM_NULL)
+         return myRank;
+      int leader;
+      MPI_Allreduce(&myRank, &leader, 1, MPI_INT, MPI_MIN, group);
+      MPI_Comm_free(&group);
+      return leader;
+   }
+
+   /** Puts each of domains into one of the groups, size[g] domains in
+    *  group g.  The groups are filled one at a time, each time taking
+    *  the domain with the most halo traffic to the domains already in
+    *  the group, or the first domain left when nothing is connected.
+    *  Returns the group of each element of domains. */
+   vector<int> fillGroups(const Graph& graph, const vector<int>& domains,
+                          const vector<int>& size)
+   {
+      map<int, int> position;
+      for (unsigned ii=0; ii<domains.size(); ++ii)
+         position[domains[ii]] = ii;
+
+      vector<int> group(domains.size(), -1);
+      vector<double> gain(domains.size(), 0.0);
+      unsigned first = 0;
+      for (unsigned gg=0; gg<size.size(); ++gg)
+      {
+         // (gain, -position) so that ties go to the lower position.
+         // Entries are stale once the domain is taken or its gain grows.
+         priority_queue<pair<double, int> > heap;
+         vector<int> touched;
+         for (int kk=0; kk<size[gg]; ++kk)
+         {
+            int pos = -1;
+            while (!heap.empty() && pos < 0)
+            {
+               pair<double, int> top = heap.top();
+               heap.pop();
+               int pp = -top.second;
+               if (group[pp] < 0 && top.first == gain[pp])
+                  pos = pp;
+            }
+            if (pos < 0)
+            {
+               while (group[first] >= 0)
+                  ++first;
+               pos = first;
+            }
+            group[pos] = gg;
+
+            const map<int, double>& nbr = graph[domains[pos]];
+            for (map<int, double>::const_iterator iter=nbr.begin(); iter!=nbr.end(); ++iter)
+            {
+               map<int, int>::const_iterator here = position.find(iter->first);
+               if (here == position.end() || group[here->second] >= 0)
+                  continue;
+               int qq = here->second;
+               if (gain[qq] == 0.0)
+                  touched.push_back(qq);
+               gain[qq] += iter->second;
+               heap.push(make_pair(gain[qq], -qq));
+            }
+         }
+         for (unsigned ii=0; ii<touched.size(); ++ii)
+            gain[touched[ii]] = 0.0;
+      }
+      return group;
+   }
+
+   /** Ranks that share a leader, in rank order, keyed by leader. */
+   map<int, vector<int> > groupsOf(const vector<int>& leader, const vector<int>& ranks)
+   {
+      map<int, vector<int> > groups;
+      for (unsigned ii=0; ii<ranks.size(); ++ii)
+         groups[leader[ranks[ii]]].push_back(ranks[ii]);
+      return groups;
+   }
+
+   /** Greedy two level placement: domains to nodes, then within each
+    *  node to NUMA domains.  Within a NUMA domain the domains keep
+    *  their order. */
+   vector<int> greedyPlacement(const Graph& graph,
+                               const vector<int>& node, const vector<int>& numa)
+   {
+      int nTasks = graph.size();
+      vector<int> newRank(nTasks);
+      vector<int> all(nTasks);
+      for (int ii=0; ii<nTasks; ++ii)
+         all[ii] = ii;
+
+      map<int, vector<int> > nodeRanks = groupsOf(node, all);
+      vector<int> nodeSize;
+      vector<vector<int> > nodeList;
+      for (map<int, vector<int> >::iterator iter=nodeRanks.begin(); iter!=nodeRanks.end(); ++iter)
+      {
+         nodeSize.push_back(iter->second.size());
+         nodeList.push_back(iter->second);
+      }
+      vector<int> nodeOfDomain = fillGroups(graph, all, nodeSize);
+
+      for (unsigned iNode=0; iNode<nodeList.size(); ++iNode)
+      {
+         vector<int> domains;
+         for (int ii=0; ii<nTasks; ++ii)
+            if (nodeOfDomain[ii] == int(iNode))
+               domains.push_back(ii);
+
+         map<int, vector<int> > numaRanks = groupsOf(numa, nodeList[iNode]);
+         vector<int> numaSize;
+         vector<vector<int> > numaList;
+         for (map<int, vector<int> >::iterator iter=numaRanks.begin(); iter!=numaRanks.end(); ++iter)
+         {
+            numaSize.push_back(iter->second.size());
+            numaList.push_back(iter->second);
+         }
+         vector<int> numaOfDomain = fillGroups(graph, domains, numaSize);
+
+         vector<unsigned> cursor(numaList.size(), 0);
+         for (unsigned ii=0; ii<domains.size(); ++ii)
+         {
+            int gg = numaOfDomain[ii];
+            newRank[domains[ii]] = numaList[gg][cursor[gg]++];
+         }
+      }
+      return newRank;
+   }
+
+   /** Fraction of the halo items that stay on a node when domain d runs
+    *  on rank place[d]. */
+   double onNodeFraction(const Graph& graph, const vector<int>& node,
+                        const vector<int>& place)
+   {
+      double total = 0.0;
+      double local = 0.0;
+      for (unsigned dd=0; dd<graph.size(); ++dd)
+         for (map<int, double>::const_iterator iter=graph[dd].begin(); iter!=graph[dd].end(); ++iter)
+         {
+            total += iter->second;
+            if (node[place[dd]] == node[place[iter->first]])
+               local += iter->second;
+         }
+      return (total > 0 ? local/total : 1.0);
+   }
+}
+
+LoadLevel placeDomains(Simulate& sim, OBJECT* obj, const LoadLevel& loadLevel,
+                       MPI_Comm comm)
+{
+   string method;
+   int ranksPerNode;
+   objectGet(obj, "placement", method, "none");
+   objectGet(obj, "placementRanksPerNode", ranksPerNode, "0");
+   if (method == "none")
+      return loadLevel;
+   if (method != "mpi" && method != "greedy")
+   {
+      if (getRank(0) == 0)
+         cout << "Unknown placement " << method << endl;
+      assert(false); // reachable only due to bad input
+   }
+
+   int nTasks, myRank;
+   MPI_Comm_size(comm, &nTasks);
+   MPI_Comm_rank(comm, &myRank);
+
+   // The halo this domain will send, routed the same way as in
+   // getRemoteCells.
+   Anatomy& anatomy = sim.anatomy_;
+   vector<Long64> gid(anatomy.size());
+   for (unsigned ii=0; ii<anatomy.size(); ++ii)
+      gid[ii] = anatomy.gid(ii);
+   GridRouter router(gid, sim.nx_, sim.ny_, sim.nz_, comm,
+                     max(sim.diffusionSubsteps_, sim.haloInterval_));
+   CommTable table(router.commTable());
+   vector<int> sendSize = table.msgSize();
+
+   int node;
+   int numa;
+   if (ranksPerNode > 0)
+   {
+      node = myRank - myRank%ranksPerNode;
+      numa = node;
+   }
+   else
+   {
+      node = groupLeader(comm, MPI_COMM_TYPE_SHARED);
+      numa = node;
+#ifdef OPEN_MPI
+      numa = groupLeader(comm, OMPI_COMM_TYPE_NUMA);
+#endif
+   }
+
+   // Everybody needs the whole domain graph to check the result.
+   vector<int> mine;
+   for (unsigned ii=0; ii<table._sendTask.size(); ++ii)
+   {
+      mine.push_back(table._sendTask[ii]);
+      mine.push_back(sendSize[ii]);
+   }
+   int nMine = mine.size();
+   vector<int> count(nTasks);
+   MPI_Allgather(&nMine, 1, MPI_INT, &count[0], 1, MPI_INT, comm);
+   vector<int> displ(nTasks+1, 0);
+   for (int ii=0; ii<nTasks; ++ii)
+      displ[ii+1] = displ[ii] + count[ii];
+   vector<int> edges(displ[nTasks]+1);
+   mine.push_back(-1); // so that &mine[0] is valid
+   MPI_Allgatherv(&mine[0], nMine, MPI_INT, &edges[0], &count[0], &displ[0], MPI_INT, comm);
+   Graph graph(nTasks);
+   for (int dd=0; dd<nTasks; ++dd)
+      for (int ii=displ[dd]; ii<displ[dd+1]; ii+=2)
+      {
+         graph[dd][edges[ii]] += edges[ii+1];
+         graph[edges[ii]][dd] += edges[ii+1];
+      }
+
+   vector<int> nodeOf(nTasks);
+   vector<int> numaOf(nTasks);
+   MPI_Allgather(&node, 1, MPI_INT, &nodeOf[0], 1, MPI_INT, comm);
+   MPI_Allgather(&numa, 1, MPI_INT, &numaOf[0], 1, MPI_INT, comm);
+
+   vector<int> newRank(nTasks);
+   if (method == "greedy")
+      newRank = greedyPlacement(graph, nodeOf, numaOf);
+   else
+   {
+      // one extra element so that &v[0] is valid without neighbors
+      vector<int> recvTask(table._recvTask);
+      vector<int> recvSize(recvTask.size());
+      for (unsigned ii=0; ii<recvTask.size(); ++ii)
+         recvSize[ii] = table._recvOffset[ii+1] - table._recvOffset[ii];
+      vector<int> sendTask(table._sendTask);
+      recvTask.push_back(-1);
+      recvSize.push_back(0);
+      sendTask.push_back(-1);
+      sendSize.push_back(0);
+      MPI_Comm graphComm;
+      MPI_Dist_graph_create_adjacent(comm,
+                                     recvTask.size()-1, &recvTask[0], &recvSize[0],
+                                     sendTask.size()-1, &sendTask[0], &sendSize[0],
+                                     MPI_INFO_NULL, 1, &graphComm);
+      // The rank a process gets in graphComm is the domain it should
+      // run, so domain d goes to the rank with placed[rank] == d.
+      int myPlace;
+      MPI_Comm_rank(graphComm, &myPlace);
+      MPI_Comm_free(&graphComm);
+      vector<int> placed(nTasks);
+      MPI_Allgather(&myPlace, 1, MPI_INT, &placed[0], 1, MPI_INT, comm);
+      for (int ii=0; ii<nTasks; ++ii)
+         newRank[placed[ii]] = ii;
+   }
+
+   vector<int> identity(nTasks);
+   for (int ii=0; ii<nTasks; ++ii)
+      identity[ii] = ii;
+   if (myRank == 0)
+      cout << "Domain placement " << method << ": halo on node "
+           << setprecision(3) << 100*onNodeFraction(graph, nodeOf, identity)
+           << "% -> " << 100*onNodeFraction(graph, nodeOf, newRank) << "%" << endl;
+
+   // Each rank hands its whole domain to newRank[myRank], in order.
+   vector<int> oldRank(nTasks);
+   for (int ii=0; ii<nTasks; ++ii)
+      oldRank[newRank[ii]] = ii;
+   int dest = newRank[myRank];
+   int source = oldRank[myRank];
+   if (dest == myRank)
+      return loadLevel;
+   vector<AnatomyCell>& cells = anatomy.cellArray();
+   int nSend = cells.size();
+   int nRecv;
+   MPI_Sendrecv(&nSend, 1, MPI_INT, dest, 0, &nRecv, 1, MPI_INT, source, 0,
+                comm, MPI_STATUS_IGNORE);
+   vector<AnatomyCell> recvCells(nRecv+1);
+   cells.push_back(AnatomyCell());
+   MPI_Sendrecv(&cells[0], nSend*sizeof(AnatomyCell), MPI_BYTE, dest, 1,
+                &recvCells[0], nRecv*sizeof(AnatomyCell), MPI_BYTE, source, 1,
+                comm, MPI_STATUS_IGNORE);
+   recvCells.pop_back();
+   cells.swap(recvCells);
+   for (unsigned ii=0; ii<cells.size(); ++ii)
+      cells[ii].dest_ = myRank;
+
+   // The balancers' hints describe the domain, so they move with it.
+   int sendHint[2] = {loadLevel.nDiffusionCoresHint, int(loadLevel.variantHint.size())};
+   int recvHint[2];
+   MPI_Sendrecv(sendHint, 2, MPI_INT, dest, 2, recvHint, 2, MPI_INT, source, 2,
+                comm, MPI_STATUS_IGNORE);
+   string sendVariant = loadLevel.variantHint + '\0';
+   vector<char> recvVariant(recvHint[1]+1);
+   MPI_Sendrecv(&sendVariant[0], sendHint[1], MPI_CHAR, dest, 3,
+                &recvVariant[0], recvHint[1], MPI_CHAR, source, 3,
+                comm, MPI_STATUS_IGNORE);
+   LoadLevel placed;
+   placed.nDiffusionCoresHint = recvHint[0];
+   placed.variantHint.assign(&recvVariant[0], recvHint[1]);
+   return placed;
+}
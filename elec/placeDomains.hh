@@ -0,0 +1,27 @@
+#ifndef PLACE_DOMAINS_HH
+#define PLACE_DOMAINS_HH
+
+#include <mpi.h>
+#include "object.h"
+
+class Simulate;
+struct LoadLevel;
+
+/** Moves the domains made by the load balancer between ranks so that
+ *  domains that exchange a lot of halo data share a node (and, with
+ *  Open MPI, a NUMA domain).  The halo traffic is weighted by the
+ *  message sizes of the CommTable the domains will use.  Must be
+ *  called by all ranks right after the cells are assigned to tasks.
+ *  Returns the loadLevel of the domain that moved to this rank.
+ *
+ *  DECOMPOSITION keywords:
+ *    placement = none | mpi | greedy (default none).  mpi asks
+ *      MPI_Dist_graph_create_adjacent to reorder the ranks, greedy
+ *      fills one node (then NUMA domain) at a time with the domains
+ *      most strongly connected to those already on it.
+ *    placementRanksPerNode (default 0) overrides the node size found
+ *      from MPI_COMM_TYPE_SHARED.  For testing on a single node. */
+LoadLevel placeDomains(Simulate& sim, OBJECT* obj, const LoadLevel& loadLevel,
+                       MPI_Comm comm);
+
+#endif
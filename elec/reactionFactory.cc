@@ -3,6 +3,7 @@
 #include <cassert>
 #include <cstdlib>
 #include <dlfcn.h>
+#include <unistd.h>
 #ifndef BGQ //FIXME!!!
 #include <unordered_map>
 #else
@@ -14,9 +15,11 @@
 #include "mpiUtils.h"
 #include "ThreadServer.hh"
 #include "Anatomy.hh"
+#include "fitCache.hh"
 #include "string.h"
 
 #include <iostream>
+#include <sstream>
 using namespace std;
 
 #ifndef BGQ
@@ -39,11 +42,17 @@ Reaction* reactionFactory(const string& name, double dt, const int numPoints,
    
    OBJECT* obj = objectFind(name, "REACTION");
    string method; objectGet(obj, "method", method, "undefined");
+   // reusing fits from earlier runs, see Interpolation::create
+   string fitCacheDir; objectGet(obj, "fitCacheDir", fitCacheDir, "");
+   if (!fitCacheDir.empty())
+      FitCache::open(fitCacheDir);
 
    MAP<string,reactionFactoryFunction>::iterator iter = g_factoryFromMethodName.find(method);
    if (iter != g_factoryFromMethodName.end())
    {
-      return iter->second(obj, dt, numPoints, group);
+      Reaction* reaction = iter->second(obj, dt, numPoints, group);
+      FitCache::close();
+      return reaction;
    }
    string filename = method;
    if (filename[0]!='/')
@@ -53,19 +62,11 @@ Reaction* reactionFactory(const string& name, double dt, const int numPoints,
    if (filetest(filename.c_str(),S_IFREG) == 0)
    {
       //try to load in the factory method
-      
-      void* handle = dlopen(filename.c_str(), RTLD_NOW|RTLD_LOCAL);
-      if (handle)
+      Reaction* reaction = reactionModuleFactory(filename, obj, dt, numPoints, group);
+      if (reaction)
       {
-         Reaction* (*factoryMethod)(OBJECT*,const double,const int,const ThreadTeam&) = reinterpret_cast<Reaction*(*)(OBJECT*,const double,const int,const ThreadTeam&)>(dlsym(handle,"factory"));
-         if (factoryMethod)
-         {
-            return factoryMethod(obj, dt, numPoints, group);
-         }
-      }
-      else
-      {
-         cerr << "Cant load dynamic module " << filename << ": " << dlerror() << endl;
+         FitCache::close();
+         return reaction;
       }
    }
    {
@@ -79,6 +80,125 @@ Reaction* reactionFactory(const string& name, double dt, const int numPoints,
    }
 }
 
+Reaction* reactionModuleFactory(const string& filename, OBJECT* obj,
+                                const double dt, const int numPoints,
+                                const ThreadTeam& group)
+{
+   // The reaction runs the code of the module, so it stays loaded.
+   void* handle;
+   string error;
+   Reaction* (*factoryMethod)(OBJECT*,const double,const int,const ThreadTeam&) = reinterpret_cast<Reaction*(*)(OBJECT*,const double,const int,const ThreadTeam&)>(reactionModuleSymbol(filename, "factory", handle, error));
+   if (!factoryMethod)
+   {
+      if (getRank(0) == 0)
+         cerr << error << endl;
+      return 0;
+   }
+   return factoryMethod(obj, dt, numPoints, group);
+}
+
+void* reactionModuleSymbol(const string& filename, const string& symbol,
+                           void*& handle, string& error)
+{
+   string path = filename;
+   if (filename.find('/') == string::npos)
+   {
+      char exe[1024];
+      ssize_t len = readlink("/proc/self/exe", exe, sizeof(exe)-1);
+      string exeDir = ".";
+      if (len > 0)
+      {
+         exe[len] = '\0';
+         exeDir = string(exe, strrchr(exe, '/') - exe);
+      }
+      path = exeDir + "/" + filename;
+      if (access(path.c_str(), R_OK) != 0)
+         path = exeDir + "/../lib/" + filename;
+   }
+   handle = dlopen(path.c_str(), RTLD_NOW|RTLD_LOCAL);
+   if (!handle)
+   {
+      error = "Cant load dynamic module " + path + ": " + dlerror();
+      return 0;
+   }
+   void* address = dlsym(handle, symbol.c_str());
+   if (!address)
+   {
+      error = "No symbol " + symbol + " in dynamic module " + path;
+      dlclose(handle);
+      handle = 0;
+   }
+   return address;
+}
+
+void reactionModuleClose(void* handle)
+{
+   if (handle)
+      dlclose(handle);
+}
+
+static bool cpuSupports(const string& isa)
+{
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+   if (isa == "x86_avx512f")
+      return __builtin_cpu_supports("avx512f") && __builtin_cpu_supports("fma");
+   if (isa == "x86_avx2")
+      return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+   return isa == "null";
+}
+
+string reactionSimdIsa(OBJECT* obj, const string& available)
+{
+   string isa; objectGet(obj, "simd", isa, "auto");
+   stringstream candidates(available);
+   string candidate;
+   while (isa == "auto" && candidates >> candidate)
+   {
+      if (cpuSupports(candidate))
+         isa = candidate;
+   }
+   if (isa == "auto")
+      isa = "null";
+   if (isa != "null" &&
+       (available.find(isa) == string::npos || !cpuSupports(isa)))
+   {
+      if (getRank(0) == 0)
+         cerr << "ERROR: simd = " << isa << " for reaction " << obj->name
+              << " is not built or not supported by this CPU" << endl;
+      assert(false); // reachable only due to bad input
+   }
+   return isa;
+}
+
+Reaction* reactionIsaFactory(const string& model, const string& available,
+                             reactionFactoryFunction builtin, OBJECT* obj,
+                             const double dt, const int numPoints,
+                             const ThreadTeam& group)
+{
+   string isa = reactionSimdIsa(obj, available);
+   if (isa != "null")
+   {
+      // The reaction runs the code of the module, so it stays loaded.
+      void* handle;
+      string error;
+      reactionFactoryFunction factory = reinterpret_cast<reactionFactoryFunction>(
+         reactionModuleSymbol(model + "_" + isa + ".so", "factory", handle, error));
+      if (factory)
+      {
+         if (getRank(0) == 0)
+            cout << "Reaction " << obj->name << " uses the simdops " << isa << " build" << endl;
+         return factory(obj, dt, numPoints, group);
+      }
+      if (getRank(0) == 0)
+         cout << "Reaction " << obj->name << " uses the builtin " << model
+              << " build.  " << error << endl;
+   }
+   else if (getRank(0) == 0)
+      cout << "Reaction " << obj->name << " uses the builtin " << model << " build" << endl;
+   return builtin(obj, dt, numPoints, group);
+}
+
 void registerReactionFactory(const string method, reactionFactoryFunction scanFunc)
 {
    g_factoryFromMethodName[method] = scanFunc;
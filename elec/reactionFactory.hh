@@ -16,11 +16,46 @@ void registerReactionFactory(const std::string method, reactionFactoryFunction s
 void registerBuiltinReactions();
 
 #ifdef DYNAMIC_REACTION
-#define REACTION_FACTORY(name) extern "C" Reaction* factory
+// default visibility so modules built with -fvisibility=hidden (such
+// as the per-ISA builds of the builtin reactions) still export it
+#define REACTION_FACTORY(name) extern "C" __attribute__((visibility("default"))) Reaction* factory
 #define FRIEND_FACTORY(name) friend Reaction* ::factory
 #else
 #define REACTION_FACTORY(name) Reaction* reactionFactoryFor##name
 #define FRIEND_FACTORY(name) friend Reaction* ::reactionFactoryFor##name
 #endif
 
+/** The simdops build of a reaction to use: the "simd" keyword of obj if
+ *  it is set, otherwise the widest ISA in available (a space separated
+ *  list such as "x86_avx512f x86_avx2") that this CPU supports.
+ *  Returns "null" for the default build. */
+std::string reactionSimdIsa(OBJECT* obj, const std::string& available);
+
+/** Makes a reaction of model with the build reactionSimdIsa picks from
+ *  available: the dynamic module model_isa.so, or builtin for the
+ *  default build or when the module can't be loaded.  Rank 0 prints
+ *  the build that is used. */
+Reaction* reactionIsaFactory(const std::string& model, const std::string& available,
+                             reactionFactoryFunction builtin, OBJECT* obj,
+                             const double dt, const int numPoints,
+                             const ThreadTeam& group);
+
+/** Makes a reaction with the factory of the dynamic module (built with
+ *  DYNAMIC_REACTION) in filename.  A filename without a / is looked up
+ *  in the directory of the executable and in its ../lib.  Returns 0,
+ *  and rank 0 prints why, when the module can't be loaded. */
+Reaction* reactionModuleFactory(const std::string& filename, OBJECT* obj,
+                                const double dt, const int numPoints,
+                                const ThreadTeam& group);
+
+/** The address of symbol in the dynamic module in filename, looked up
+ *  as by reactionModuleFactory, or 0 with the reason in error when the
+ *  module can't be loaded or lacks the symbol.  On success handle is
+ *  the module, which the caller closes with reactionModuleClose once
+ *  it no longer uses the symbol, otherwise it is 0. */
+void* reactionModuleSymbol(const std::string& filename,
+                           const std::string& symbol, void*& handle,
+                           std::string& error);
+void reactionModuleClose(void* handle);
+
 #endif
@@ -0,0 +1,138 @@
+#include "reactionJit.hh"
+
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <inttypes.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <mpi.h>
+#include "ioUtils.h"
+#include "reactionFactory.hh"
+
+using namespace std;
+
+#ifndef JIT_CXX
+#define JIT_CXX "c++"
+#endif
+
+namespace
+{
+   /** 64 bit FNV-1a.  Unlike std::hash it is the same for every build
+    *  so the cache survives recompiling cardioid. */
+   uint64_t fnv1a(const string& text)
+   {
+      uint64_t hash = 14695981039346656037ULL;
+      for (unsigned ii=0; ii<text.size(); ++ii)
+      {
+         hash ^= (unsigned char) text[ii];
+         hash *= 1099511628211ULL;
+      }
+      return hash;
+   }
+
+   /** The instruction set extensions of this CPU.  -march=native
+    *  compiles for them, so a kernel cached by a job on one kind of
+    *  node must not be loaded by a job on another. */
+   string hostIsa()
+   {
+      string isa;
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+      __builtin_cpu_init();
+#define HOST_ISA_FEATURE(feature) if (__builtin_cpu_supports(feature)) isa += " " feature;
+      HOST_ISA_FEATURE("sse4.2");
+      HOST_ISA_FEATURE("popcnt");
+      HOST_ISA_FEATURE("avx");
+      HOST_ISA_FEATURE("avx2");
+      HOST_ISA_FEATURE("fma");
+      HOST_ISA_FEATURE("bmi");
+      HOST_ISA_FEATURE("bmi2");
+      HOST_ISA_FEATURE("avx512f");
+      HOST_ISA_FEATURE("avx512cd");
+      HOST_ISA_FEATURE("avx512dq");
+      HOST_ISA_FEATURE("avx512bw");
+      HOST_ISA_FEATURE("avx512vl");
+      HOST_ISA_FEATURE("avx512ifma");
+      HOST_ISA_FEATURE("avx512vbmi");
+#undef HOST_ISA_FEATURE
+#endif
+      return isa;
+   }
+}
+
+namespace ReactionJit
+{
+
+string defaultCompiler()
+{
+   return string(JIT_CXX) + " -O3 -march=native -fPIC -shared";
+}
+
+void* loadKernel(const string& name, const string& source,
+                 const string& symbol, const string& cacheDir,
+                 const string& compiler, void*& handle)
+{
+   handle = 0;
+   int myRank;
+   MPI_Comm_rank(MPI_COMM_WORLD, &myRank);
+
+   // Rank 0 compiles for its own CPU, so every rank has to have the
+   // same one.
+   string isa = hostIsa();
+   uint64_t isaHash[2] = {fnv1a(isa), ~fnv1a(isa)};
+   MPI_Allreduce(MPI_IN_PLACE, isaHash, 2, MPI_UINT64_T, MPI_MAX, MPI_COMM_WORLD);
+   if (isaHash[0] != ~isaHash[1])
+   {
+      if (myRank == 0)
+         cerr << "ReactionJit: the tasks run on CPUs with different instruction"
+              << " sets.  Not compiling " << name << "." << endl;
+      return 0;
+   }
+
+   char hash[17];
+   sprintf(hash, "%016" PRIx64, fnv1a(compiler + "\n" + isa + "\n" + source));
+   string base = cacheDir + "/" + name + "_" + hash;
+   string soName = base + ".so";
+
+   int ok = 1;
+   if (myRank == 0 && access(soName.c_str(), R_OK) != 0)
+   {
+      DirTestCreate(cacheDir.c_str());
+      string srcName = base + ".cc";
+      ofstream srcFile(srcName.c_str());
+      srcFile << source;
+      srcFile.close();
+
+      // Compile to a private name and rename so that no other job
+      // sharing the cache can load a partially written object.
+      stringstream tmpName;
+      tmpName << base << ".tmp" << getpid() << ".so";
+      string command = compiler + " -o " + tmpName.str() + " " + srcName
+         + " > " + base + ".log 2>&1";
+      int rc = system(command.c_str());
+      if (rc == 0)
+         rc = rename(tmpName.str().c_str(), soName.c_str());
+      if (rc != 0)
+      {
+         cerr << "ReactionJit: failed to compile " << srcName
+              << ".  See " << base << ".log" << endl;
+         ok = 0;
+      }
+      else
+         cout << "ReactionJit: compiled " << soName << endl;
+   }
+   MPI_Bcast(&ok, 1, MPI_INT, 0, MPI_COMM_WORLD);
+   if (!ok)
+      return 0;
+
+   string error;
+   void* kernel = reactionModuleSymbol(soName, symbol, handle, error);
+   if (!kernel && myRank == 0)
+      cerr << "ReactionJit: " << error << endl;
+   return kernel;
+}
+
+}
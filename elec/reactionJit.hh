@@ -0,0 +1,29 @@
+#ifndef REACTION_JIT_HH
+#define REACTION_JIT_HH
+
+#include <string>
+
+/** Runtime compilation of generated reaction kernels on the CPU.  The
+ *  generated source is compiled by the system compiler into a shared
+ *  object that is cached on disk under a hash of the source, the
+ *  compile command and the instruction set extensions of the CPU (the
+ *  default command uses -march=native), then loaded by every rank
+ *  with reactionModuleSymbol, the loader of the dynamic reaction
+ *  modules.  Rank 0 does the compiling so the cache directory must be
+ *  visible to all ranks and the ranks must all run on the same kind of
+ *  CPU.
+ *
+ *  loadKernel must be called by all ranks.  It returns the address of
+ *  symbol or NULL if compiling or loading failed, in which case the
+ *  caller should fall back to its precompiled path.  handle is the
+ *  loaded object (0 on failure), which the caller passes to
+ *  reactionModuleClose when it is done with the kernel. */
+namespace ReactionJit
+{
+   std::string defaultCompiler();
+   void* loadKernel(const std::string& name, const std::string& source,
+                    const std::string& symbol, const std::string& cacheDir,
+                    const std::string& compiler, void*& handle);
+}
+
+#endif
@@ -0,0 +1,216 @@
+#include "rebalanceSimulate.hh"
+
+#include <vector>
+#include <map>
+#include <string>
+#include <iostream>
+#include <algorithm>
+#include <cstdio>
+#include <cassert>
+#include <mpi.h>
+
+#include "Simulate.hh"
+#include "Anatomy.hh"
+#include "AnatomyCell.hh"
+#include "Diffusion.hh"
+#include "Stimulus.hh"
+#include "Sensor.hh"
+#include "DeepHalo.hh"
+#include "ReactionManager.hh"
+#include "assignCellsToTasks.hh"
+#include "initializeSimulate.hh"
+#include "object_cc.hh"
+#include "mpiUtils.h"
+#include "PerformanceTimers.hh"
+
+using namespace std;
+
+namespace
+{
+   void deleteLocalObjects(Simulate& sim);
+   void exchangeState(const vector<AnatomyCell>& cells,
+                      const map<Long64, unsigned>& oldIndex,
+                      const vector<double>& oldState, unsigned recordSize,
+                      vector<double>& newState, MPI_Comm comm);
+}
+
+bool rebalanceSimulate(Simulate& sim, double busySeconds)
+{
+   MPI_Comm comm = MPI_COMM_WORLD;
+   int nTasks;
+   MPI_Comm_size(comm, &nTasks);
+
+   vector<double> taskSeconds(nTasks);
+   MPI_Allgather(&busySeconds, 1, MPI_DOUBLE, &taskSeconds[0], 1, MPI_DOUBLE, comm);
+   double maxSeconds = *max_element(taskSeconds.begin(), taskSeconds.end());
+   double aveSeconds = 0;
+   for (int ii=0; ii<nTasks; ++ii)
+      aveSeconds += taskSeconds[ii];
+   aveSeconds /= nTasks;
+   double imbalance = (aveSeconds > 0 ? maxSeconds/aveSeconds - 1 : 0);
+   if (getRank(0) == 0)
+      cout << "Loop " << sim.loop_ << ": compute time max/ave - 1 = " << imbalance << endl;
+   if (imbalance < sim.rebalanceThreshold_)
+      return false;
+
+   profileStart("Rebalance");
+   timestampBarrier("rebalancing cells", comm);
+   Anatomy& anatomy = sim.anatomy_;
+   vector<AnatomyCell>& cells = anatomy.cellArray();
+   unsigned nLocal = anatomy.nLocal();
+
+   // Vm and the same fields a checkpoint has.
+   vector<string> fieldNames;
+   vector<string> fieldUnits;
+   sim.reaction_->getCheckpointInfo(fieldNames, fieldUnits);
+   vector<int> handle = sim.reaction_->getVarHandle(fieldNames);
+   unsigned recordSize = 1 + handle.size();
+   vector<double> oldState(nLocal*recordSize);
+   map<Long64, unsigned> oldIndex;
+   {
+      ro_array_ptr<double> Vm = sim.vdata_.VmTransport_.useOn(CPU);
+      vector<double> value(handle.size());
+      for (unsigned ii=0; ii<nLocal; ++ii)
+      {
+         oldIndex[cells[ii].gid_] = ii;
+         oldState[ii*recordSize] = Vm[ii];
+         sim.reaction_->getValue(ii, handle, value);
+         copy(value.begin(), value.end(), oldState.begin()+ii*recordSize+1);
+      }
+   }
+
+   string decompositionName;
+   objectGet(objectFind(sim.name_, "SIMULATE"), "decomposition",
+             decompositionName, "decomposition");
+   cells.resize(nLocal);
+   anatomy.nRemote() = 0;
+   rebalanceCellsToTasks(sim, decompositionName, taskSeconds, sim.rebalanceSteps_, comm);
+   sort(cells.begin(), cells.end(), AnatomyCellGidSort());
+
+   vector<double> newState;
+   exchangeState(cells, oldIndex, oldState, recordSize, newState, comm);
+   {
+      int nCells = cells.size();
+      int minCells, maxCells;
+      MPI_Reduce(&nCells, &minCells, 1, MPI_INT, MPI_MIN, 0, comm);
+      MPI_Reduce(&nCells, &maxCells, 1, MPI_INT, MPI_MAX, 0, comm);
+      if (getRank(0) == 0)
+         cout << "Rebalanced cells per task min/max = "
+              << minCells << " " << maxCells << endl;
+   }
+
+   deleteLocalObjects(sim);
+   // The variant hints of the balancers are about their own domains.
+   initializeLocalObjects(sim, "");
+
+   nLocal = anatomy.nLocal();
+   sim.vdata_.setup(anatomy);
+   {
+      wo_array_ptr<double> Vm = sim.vdata_.VmTransport_.useOn(CPU);
+      for (unsigned ii=0; ii<nLocal; ++ii)
+      {
+         Vm[ii] = newState[ii*recordSize];
+         for (unsigned jj=0; jj<handle.size(); ++jj)
+            sim.reaction_->setValue(ii, handle[jj], newState[ii*recordSize+1+jj]);
+      }
+      for (unsigned ii=nLocal; ii<anatomy.size(); ++ii)
+         Vm[ii] = 0;
+   }
+   timestampBarrier("finished rebalancing cells", comm);
+   profileStop("Rebalance");
+   return true;
+}
+
+namespace
+{
+   void deleteLocalObjects(Simulate& sim)
+   {
+      for (unsigned ii=0; ii<sim.sensor_.size(); ++ii)
+         delete sim.sensor_[ii];
+      sim.sensor_.clear();
+      for (unsigned ii=0; ii<sim.stimulus_.size(); ++ii)
+         delete sim.stimulus_[ii];
+      sim.stimulus_.clear();
+      delete sim.deepHalo_;
+      delete sim.diffusion_;
+      delete sim.reaction_;
+      delete sim.commTable_;
+      sim.deepHalo_ = 0;
+      sim.diffusion_ = 0;
+      sim.reaction_ = 0;
+      sim.commTable_ = 0;
+      if (sim.printFile_)
+         fclose(sim.printFile_);
+      sim.printFile_ = 0;
+   }
+}
+
+namespace
+{
+   /** Each cell in cells remembers the task it came from in sortind_.
+    *  Asks those tasks for the records of the cells and returns them in
+    *  newState in the order of cells. */
+   void exchangeState(const vector<AnatomyCell>& cells,
+                      const map<Long64, unsigned>& oldIndex,
+                      const vector<double>& oldState, unsigned recordSize,
+                      vector<double>& newState, MPI_Comm comm)
+   {
+      int nTasks;
+      MPI_Comm_size(comm, &nTasks);
+
+      // Requests in the order of the tasks that own the records.
+      vector<int> nRequest(nTasks, 0);
+      for (unsigned ii=0; ii<cells.size(); ++ii)
+         ++nRequest[cells[ii].sortind_];
+      vector<int> requestOffset(nTasks+1, 0);
+      for (int ii=0; ii<nTasks; ++ii)
+         requestOffset[ii+1] = requestOffset[ii] + nRequest[ii];
+      vector<Long64> request(cells.size()+1);
+      vector<unsigned> position(cells.size());
+      {
+         vector<int> cursor(requestOffset.begin(), requestOffset.end()-1);
+         for (unsigned ii=0; ii<cells.size(); ++ii)
+         {
+            int here = cursor[cells[ii].sortind_]++;
+            request[here] = cells[ii].gid_;
+            position[here] = ii;
+         }
+      }
+
+      vector<int> nServe(nTasks);
+      MPI_Alltoall(&nRequest[0], 1, MPI_INT, &nServe[0], 1, MPI_INT, comm);
+      vector<int> serveOffset(nTasks+1, 0);
+      for (int ii=0; ii<nTasks; ++ii)
+         serveOffset[ii+1] = serveOffset[ii] + nServe[ii];
+      vector<Long64> serve(serveOffset[nTasks]+1);
+      MPI_Alltoallv(&request[0], &nRequest[0], &requestOffset[0], MPI_LONG_LONG,
+                    &serve[0], &nServe[0], &serveOffset[0], MPI_LONG_LONG, comm);
+
+      vector<double> reply(serveOffset[nTasks]*recordSize+1);
+      for (int ii=0; ii<serveOffset[nTasks]; ++ii)
+      {
+         map<Long64, unsigned>::const_iterator here = oldIndex.find(serve[ii]);
+         assert(here != oldIndex.end());
+         copy(oldState.begin() + here->second*recordSize,
+              oldState.begin() + (here->second+1)*recordSize,
+              reply.begin() + ii*recordSize);
+      }
+
+      for (int ii=0; ii<nTasks; ++ii)
+      {
+         nServe[ii] *= recordSize;
+         serveOffset[ii] *= recordSize;
+         nRequest[ii] *= recordSize;
+         requestOffset[ii] *= recordSize;
+      }
+      vector<double> received(cells.size()*recordSize+1);
+      MPI_Alltoallv(&reply[0], &nServe[0], &serveOffset[0], MPI_DOUBLE,
+                    &received[0], &nRequest[0], &requestOffset[0], MPI_DOUBLE, comm);
+
+      newState.resize(cells.size()*recordSize);
+      for (unsigned ii=0; ii<cells.size(); ++ii)
+         copy(received.begin() + ii*recordSize,
+              received.begin() + (ii+1)*recordSize,
+              newState.begin() + position[ii]*recordSize);
+   }
+}
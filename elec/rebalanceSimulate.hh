@@ -0,0 +1,16 @@
+#ifndef REBALANCE_SIMULATE_HH
+#define REBALANCE_SIMULATE_HH
+
+class Simulate;
+
+/** Compares busySeconds, the time this task spent computing since the
+ *  last call, across all tasks.  When the slowest task is more than
+ *  sim.rebalanceThreshold_ above the average the cells are rebalanced:
+ *  they move to their new tasks together with Vm and their reaction
+ *  state, and everything built from the old decomposition is rebuilt
+ *  with initializeLocalObjects.  Returns true when the cells moved, in
+ *  which case the caller has to rebuild what it built from sim too.
+ *  Collective over MPI_COMM_WORLD. */
+bool rebalanceSimulate(Simulate& sim, double busySeconds);
+
+#endif
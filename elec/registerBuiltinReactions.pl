@@ -6,11 +6,16 @@ use warnings;
 sub usage 
 {
    print <<"_HERE";
-$0: outfile.cc Model1.cc [Model2.cc ...]
+$0: outfile.cc [--isa=name ...] Model1.cc [Model2.cc ...]
 
 Scans the models for scan* functions, and includes them in a function
 to populate the reactionFactory
 
+Each --isa names an extra simdops build of every model, a dynamic
+module Model_isa.so.  The registered factory then picks a build at run
+time with reactionIsaFactory, falling back to the builtin one.  List
+the widest first.
+
 _HERE
 
    die(@_) if @_;
@@ -20,6 +25,13 @@ usage("Need at least 1 argument") if scalar(@ARGV) < 1;
 
 my $outfilename = shift @ARGV;
 
+my @isas;
+while (@ARGV && $ARGV[0] =~ m,^--isa=(\w+)$,)
+{
+   push @isas, $1;
+   shift @ARGV;
+}
+
 my @filenames = @ARGV;
 
 
@@ -46,7 +58,19 @@ _HERE
 
 foreach my $reaction (@reactions)
 {
-   print $outfile "REACTION_FACTORY($reaction)(OBJECT* obj, const double dt, const int numPoints, const ThreadTeam& group);\n"
+   print $outfile "REACTION_FACTORY($reaction)(OBJECT* obj, const double dt, const int numPoints, const ThreadTeam& group);\n";
+}
+
+if (@isas)
+{
+   print $outfile "\n";
+   foreach my $reaction (@reactions)
+   {
+      print $outfile "static Reaction* dispatchFor$reaction(OBJECT* obj, const double dt, const int numPoints, const ThreadTeam& group)\n";
+      print $outfile "{\n";
+      print $outfile qq|   return reactionIsaFactory("$reaction", "@isas", reactionFactoryFor$reaction, obj, dt, numPoints, group);\n|;
+      print $outfile "}\n";
+   }
 }
 
 print $outfile <<'_HERE';
@@ -57,7 +81,8 @@ _HERE
 
 foreach my $reaction (@reactions)
 {
-   print $outfile qq|   registerReactionFactory("$reaction", reactionFactoryFor$reaction);\n|;
+   my $factory = @isas ? "dispatchFor$reaction" : "reactionFactoryFor$reaction";
+   print $outfile qq|   registerReactionFactory("$reaction", $factory);\n|;
 }
 print $outfile <<'_HERE';
 }
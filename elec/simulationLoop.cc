@@ -23,7 +23,9 @@
 #include "fastBarrier.hh"
 #include "mpiUtils.h"
 #include "ReactionManager.hh"
+#include "DeepHalo.hh"
 #include "DeviceFor.hh"
+#include "rebalanceSimulate.hh"
 #include  "cudaNVTX.h"
 
 /*
@@ -75,10 +77,10 @@ void printData(const Simulate& sim)
       ro_array_ptr<double> dVmReaction = sim.vdata_.dVmReactionTransport_.useOn(CPU);
       ro_array_ptr<double> dVmDiffusion = sim.vdata_.dVmDiffusionTransport_.useOn(CPU);
       const unsigned* const blockIndex = sim.diffusion_->blockIndex();
+      const double* const dVdMatrix = sim.diffusion_->dVmBlock();
       double dVd = dVmDiffusion[pi];
-      if (blockIndex)
+      if (blockIndex && dVdMatrix)
       {
-         const double* const dVdMatrix = sim.diffusion_->dVmBlock();
          const double scale = sim.diffusion_->diffusionScale();
          const int index = blockIndex[pi];
          dVd += scale * dVdMatrix[index];
@@ -94,6 +96,17 @@ void printData(const Simulate& sim)
    }
    stopTimer(printDataTimer);
 }
+
+/** Prints the largest error of the halo codec over all tasks. */
+void reportCodecError(const Simulate& sim, double local)
+{
+   if (!sim.haloCodecValidate_)
+      return;
+   double global;
+   MPI_Reduce(&local, &global, 1, MPI_DOUBLE, MPI_MAX, 0, MPI_COMM_WORLD);
+   if (getRank(0) == 0)
+      cout << "Halo codec max |Vm error| = " << global << endl;
+}
 }
 
 void simulationProlog(Simulate& sim)
@@ -147,36 +160,75 @@ void loopIO(const Simulate& sim, int firstCall)
    stopTimer(loopIOTimer);
 }
 
-void simulationLoop(Simulate& sim)
+namespace
+{
+/** Runs the omp loop until maxLoop or until rebalanceSimulate moves the
+ *  cells, after which the halo exchange and everything else built here
+ *  belong to the old decomposition. */
+void simulationLoopSegment(Simulate& sim, double& codecError)
 {
    lazy_array<double> iStimTransport;
    iStimTransport.resize(sim.anatomy_.nLocal());
    
-   simulationProlog(sim);
-   HaloExchangeDevice<double> voltageExchange(sim.sendMap_, (sim.commTable_));
+   HaloExchangeDevice<double> voltageExchange(sim.sendMap_, (sim.commTable_),
+                                              sim.haloExchangeMode_, sim.haloCodec_);
+   if (sim.haloCodecValidate_)
+      voltageExchange.validateCodec();
 
    PotentialData& vdata = sim.vdata_;
 
+   bool inPlaceHalo = false;
+   if (sim.haloDatatypes_)
+   {
+      unsigned* blockIndex = sim.diffusion_->blockIndex();
+      if (blockIndex)
+         inPlaceHalo = voltageExchange.useDatatypes(vdata.VmTransport_.readonly(CPU).raw(),
+                                                    sim.diffusion_->VmBlock(),
+                                                    blockIndex + sim.anatomy_.nLocal());
+      if (getRank(0) == 0 && !inPlaceHalo)
+         cout << "haloPack = datatype is not supported here.  Using copy." << endl;
+   }
+   if (sim.haloDeviceBuffers_ && !voltageExchange.useDeviceBuffers())
+   {
+      if (getRank(0) == 0)
+         cout << "haloDeviceBuffers is not supported here.  Using host buffers." << endl;
+   }
+
 #if defined(SPI) && defined(TRACESPI)
    int myRank;
    MPI_Comm_rank(MPI_COMM_WORLD, &myRank);
    cout << "Rank[" << myRank << "]: numOfNeighborToSend=" << sim.commTable_->_sendTask.size() << " numOfNeighborToRecv=" << sim.commTable_->_recvTask.size() << " numOfBytesToSend=" << sim.commTable_->_sendOffset[sim.commTable_->_sendTask.size()] * sizeof (double) << " numOfBytesToRecv=" << sim.commTable_->_recvOffset[sim.commTable_->_recvTask.size()] * sizeof (double) << endl;
 #endif
 
-   printData(sim);
-   loopIO(sim, 1);
-   profileStart(simulationLoopTimer);
+   // With a deep halo the ghosts are computed here too and are only
+   // refreshed every deepHalo->interval() steps.
+   DeepHalo* deepHalo = sim.deepHalo_;
+   const int firstLoop = sim.loop_;
+   // Time spent computing, without waiting for the halo or doing IO.
+   double busySeconds = 0;
 
    while (sim.loop_ < sim.maxLoop_)
    {
+      double stepStart = MPI_Wtime();
+      double waitSeconds = 0;
       int nLocal = sim.anatomy_.nLocal();
+      bool refreshHalo = deepHalo && (sim.loop_-firstLoop) % deepHalo->interval() == 0;
 
       //startTimer(imbalanceTimer);
       //voltageExchange.barrier();
       //stopTimer(imbalanceTimer);
 
+      if (deepHalo)
+      {
+         if (refreshHalo)
+            deepHalo->startRefresh(vdata.VmTransport_);
+      }
+      else
       {
-         voltageExchange.fillSendBuffer(vdata.VmTransport_);
+         if (inPlaceHalo)
+            vdata.VmTransport_.readonly(CPU); // sent in place
+         else
+            voltageExchange.fillSendBuffer(vdata.VmTransport_);
          voltageExchange.startComm();
       }
 
@@ -191,45 +243,114 @@ void simulationLoop(Simulate& sim)
          {
             sim.stimulus_[ii]->stim(sim.time_, iStimTransport);
          }
+         if (deepHalo)
+            deepHalo->stim(sim.time_);
       }
       stopTimer(stimulusTimer);
 
       // REACTION
-      startTimer(reactionTimer);
+      if (sim.reactionTileSize_ <= 0)
       {
+         startTimer(reactionTimer);
          sim.reaction_->calc(sim.dt_, vdata.VmTransport_, iStimTransport, vdata.dVmReactionTransport_);
+         stopTimer(reactionTimer);
+      }
+      if (deepHalo)
+      {
+         if (refreshHalo)
+         {
+            double waitStart = MPI_Wtime();
+            deepHalo->finishRefresh(vdata.VmTransport_);
+            waitSeconds += MPI_Wtime() - waitStart;
+         }
+         startTimer(reactionTimer);
+         deepHalo->calcReaction(sim.dt_, vdata.VmTransport_);
+         stopTimer(reactionTimer);
       }
-      stopTimer(reactionTimer);
       // DIFFUSION
       startTimer(diffusionCalcTimer);
       {
          sim.diffusion_->updateLocalVoltage(vdata.VmTransport_);
-         voltageExchange.wait();
-         sim.diffusion_->updateRemoteVoltage(voltageExchange.getRecvBuf());
-         sim.diffusion_->calc(vdata.dVmDiffusionTransport_);
+         if (deepHalo)
+         {
+            ro_mgarray_ptr<double> Vm = vdata.VmTransport_;
+            sim.diffusion_->updateRemoteVoltage(Vm.slice(nLocal, Vm.size()));
+         }
+         else
+         {
+            // The interior needs no remote voltage, so it is computed
+            // while the halo is still on its way.
+            if (sim.diffusionSubsteps_ == 1)
+               sim.diffusion_->calcInterior(vdata.dVmDiffusionTransport_);
+            double waitStart = MPI_Wtime();
+            voltageExchange.wait();
+            waitSeconds += MPI_Wtime() - waitStart;
+            if (!inPlaceHalo)
+               sim.diffusion_->updateRemoteVoltage(voltageExchange.getRecvBuf());
+         }
+         if (sim.diffusionSubsteps_ > 1)
+            sim.diffusion_->calcSubsteps(sim.diffusionSubsteps_, sim.dt_, vdata.dVmDiffusionTransport_);
+         else if (deepHalo)
+            sim.diffusion_->calc(vdata.dVmDiffusionTransport_);
+         else
+            sim.diffusion_->calcBoundary(vdata.dVmDiffusionTransport_);
+         if (deepHalo)
+            deepHalo->calcDiffusion();
       }
       stopTimer(diffusionCalcTimer);
 
-      startTimer(integratorTimer);
-      if (sim.checkRange_.on)
+      if (sim.reactionTileSize_ > 0)
       {
-         sim.checkRanges(vdata.VmTransport_, vdata.dVmReactionTransport_, vdata.dVmDiffusionTransport_);
+         // Fused REACTION + INTEGRATOR.  The range check sees the
+         // updated Vm since dVmR isn't available until the tile is
+         // integrated.  Multirate tiles catch up before the reaction
+         // state is read after this step.
+         int nextLoop = sim.loop_ + 1;
+         bool catchUp = sim.checkIO(nextLoop) ||
+            (sim.rebalanceRate_ > 0 && nextLoop % sim.rebalanceRate_ == 0);
+         startTimer(reactionTimer);
+         sim.reaction_->calcAndIntegrate(sim.dt_, sim.reactionTileSize_,
+                                         vdata.VmTransport_, iStimTransport,
+                                         vdata.dVmDiffusionTransport_,
+                                         vdata.dVmReactionTransport_,
+                                         catchUp);
+         stopTimer(reactionTimer);
+         startTimer(integratorTimer);
+         if (sim.checkRange_.on)
+         {
+            sim.checkRanges(vdata.VmTransport_, vdata.dVmReactionTransport_, vdata.dVmDiffusionTransport_);
+         }
+         sim.time_ += sim.dt_;
+         ++sim.loop_;
+         stopTimer(integratorTimer);
       }
-      // no special BGQ integrator is this loop.  More bang for buck
-      // from OMP threading.
+      else
       {
-         rw_array_ptr<double> Vm = vdata.VmTransport_.readwrite(DEFAULT_COMPUTE_SPACE);
-         ro_array_ptr<double> dVmR = vdata.dVmReactionTransport_.readonly(DEFAULT_COMPUTE_SPACE);
-         ro_array_ptr<double> dVmD = vdata.dVmDiffusionTransport_.readonly(DEFAULT_COMPUTE_SPACE);
-         ro_array_ptr<double> iStim = iStimTransport.readonly(DEFAULT_COMPUTE_SPACE);
-         double dt = sim.dt_;
-         DEVICE_PARALLEL_FORALL(dVmR.size(), ii,
-                                Vm[ii] += dt*(dVmR[ii]+dVmD[ii]+iStim[ii]));
+         startTimer(integratorTimer);
+         if (sim.checkRange_.on)
+         {
+            sim.checkRanges(vdata.VmTransport_, vdata.dVmReactionTransport_, vdata.dVmDiffusionTransport_);
+         }
+         // no special BGQ integrator is this loop.  More bang for buck
+         // from OMP threading.
+         {
+            rw_array_ptr<double> Vm = vdata.VmTransport_.readwrite(DEFAULT_COMPUTE_SPACE);
+            ro_array_ptr<double> dVmR = vdata.dVmReactionTransport_.readonly(DEFAULT_COMPUTE_SPACE);
+            ro_array_ptr<double> dVmD = vdata.dVmDiffusionTransport_.readonly(DEFAULT_COMPUTE_SPACE);
+            ro_array_ptr<double> iStim = iStimTransport.readonly(DEFAULT_COMPUTE_SPACE);
+            double dt = sim.dt_;
+            DEVICE_PARALLEL_FORALL(dVmR.size(), ii,
+                                   Vm[ii] += dt*(dVmR[ii]+dVmD[ii]+iStim[ii]));
+         }
+         if (deepHalo)
+            deepHalo->integrate(sim.dt_, vdata.VmTransport_);
+
+         sim.time_ += sim.dt_;
+         ++sim.loop_;
+         stopTimer(integratorTimer);
       }
 
-      sim.time_ += sim.dt_;
-      ++sim.loop_;
-      stopTimer(integratorTimer);
+      busySeconds += MPI_Wtime() - stepStart - waitSeconds;
 
       if (sim.checkIO()) { sim.bufferReactionData(); }
 
@@ -238,8 +359,32 @@ void simulationLoop(Simulate& sim)
          printData(sim);
       }
       loopIO(sim, 0);
+
+      if (sim.rebalanceRate_ > 0 && sim.loop_ % sim.rebalanceRate_ == 0 &&
+          sim.loop_ < sim.maxLoop_)
+      {
+         if (rebalanceSimulate(sim, busySeconds))
+            break;
+         busySeconds = 0;
+      }
    }
+   codecError = max(codecError, voltageExchange.codecError());
+}
+}
+
+void simulationLoop(Simulate& sim)
+{
+   simulationProlog(sim);
+   printData(sim);
+   loopIO(sim, 1);
+   profileStart(simulationLoopTimer);
+
+   double codecError = 0;
+   while (sim.loop_ < sim.maxLoop_)
+      simulationLoopSegment(sim, codecError);
+
    profileStop(simulationLoopTimer);
+   reportCodecError(sim, codecError);
 }
 
 /** One stop shopping for all of the data that we would rather create
@@ -260,14 +405,18 @@ struct SimLoopData
 {
 
    SimLoopData(const Simulate& sim)
-      : voltageExchange(sim.sendMap_, (sim.commTable_))
+      : voltageExchange(sim.sendMap_, (sim.commTable_), sim.haloExchangeMode_, sim.haloCodec_)
    {
+      if (sim.haloCodecValidate_)
+         voltageExchange.validateCodec();
       stimIsNonZero = 1;
       diffMiscBarrier = L2_BarrierWithSync_InitShared();
       reactionBarrier = L2_BarrierWithSync_InitShared();
       diffusionBarrier = L2_BarrierWithSync_InitShared();
       reactionWaitOnNonGateBarrier = L2_BarrierWithSync_InitShared();
       timingBarrier = L2_BarrierWithSync_InitShared();
+      haloStartBarrier = L2_BarrierWithSync_InitShared();
+      haloDoneBarrier = L2_BarrierWithSync_InitShared();
 
 #ifdef PER_SQUAD_BARRIER
       {
@@ -331,6 +480,8 @@ struct SimLoopData
       free(diffusionBarrier);
       free(reactionBarrier);
       free(timingBarrier);
+      free(haloStartBarrier);
+      free(haloDoneBarrier);
    }
 
 
@@ -344,6 +495,11 @@ struct SimLoopData
    // to compare and understand timings.  This barrier can be removed
    // to slightly improve performance.
    L2_Barrier_t* timingBarrier;
+   // With a progress thread the first diffusion thread hands it the
+   // halo exchange through haloStartBarrier and waits for it on
+   // haloDoneBarrier.
+   L2_Barrier_t* haloStartBarrier;
+   L2_Barrier_t* haloDoneBarrier;
 
 #ifdef PER_SQUAD_BARRIER
    L2_Barrier_t **core_barrier;
@@ -371,6 +527,11 @@ void diffusionLoop(Simulate& sim,
    L2_BarrierWithSync_InitInThread(loopData.diffMiscBarrier, &diffMiscBarrierHandle);
    L2_BarrierWithSync_InitInThread(loopData.timingBarrier, &timingHandle);
    int nTotalThreads = sim.reactionThreads_.nThreads() + sim.diffusionThreads_.nThreads();
+   bool useProgressThread = (sim.progressThreads_.nThreads() > 0);
+   L2_BarrierHandle_t haloStartHandle;
+   L2_BarrierHandle_t haloDoneHandle;
+   L2_BarrierWithSync_InitInThread(loopData.haloStartBarrier, &haloStartHandle);
+   L2_BarrierWithSync_InitInThread(loopData.haloDoneBarrier, &haloDoneHandle);
 
    vector<int> zeroDiffusionOffset(nThreads + 1);
    {
@@ -415,7 +576,13 @@ void diffusionLoop(Simulate& sim,
          startTimer(haloTimer);
 
          startTimer(haloLaunchTimer);
-         loopData.voltageExchange.startComm();
+         if (useProgressThread)
+         {
+            L2_BarrierWithSync_Arrive(loopData.haloStartBarrier, &haloStartHandle, 1);
+            L2_BarrierWithSync_Reset(loopData.haloStartBarrier, &haloStartHandle, 1);
+         }
+         else
+            loopData.voltageExchange.startComm();
          stopTimer(haloLaunchTimer);
       }
 
@@ -466,7 +633,10 @@ void diffusionLoop(Simulate& sim,
       if (tid == 0)
       {
          startTimer(haloWaitTimer);
-         loopData.voltageExchange.wait();
+         if (useProgressThread)
+            L2_BarrierWithSync_WaitAndReset(loopData.haloDoneBarrier, &haloDoneHandle, 1);
+         else
+            loopData.voltageExchange.wait();
          stopTimer(haloWaitTimer);
 
          stopTimer(haloTimer);
@@ -522,6 +692,40 @@ void diffusionLoop(Simulate& sim,
    profileStop(diffusionLoopTimer);
 }
 
+/** Runs the halo exchange for the first diffusion thread, once per
+ *  time step.  Testing the requests in a loop, rather than blocking
+ *  in wait, keeps MPI progressing the messages while the diffusion
+ *  threads work on calc_overlap. */
+void progressLoop(Simulate& sim, SimLoopData& loopData)
+{
+   L2_BarrierHandle_t haloStartHandle;
+   L2_BarrierHandle_t haloDoneHandle;
+   L2_BarrierWithSync_InitInThread(loopData.haloStartBarrier, &haloStartHandle);
+   L2_BarrierWithSync_InitInThread(loopData.haloDoneBarrier, &haloDoneHandle);
+
+   uint64_t loopLocal = sim.loop_;
+   while (loopLocal < sim.maxLoop_)
+   {
+      L2_BarrierWithSync_WaitAndReset(loopData.haloStartBarrier, &haloStartHandle, 1);
+
+      startTimer(haloLaunchTimer);
+      loopData.voltageExchange.startComm();
+      stopTimer(haloLaunchTimer);
+
+      startTimer(haloProgressTimer);
+      while (!loopData.voltageExchange.test()) ;
+      stopTimer(haloProgressTimer);
+
+      startTimer(haloWaitTimer);
+      loopData.voltageExchange.wait();
+      stopTimer(haloWaitTimer);
+
+      L2_BarrierWithSync_Arrive(loopData.haloDoneBarrier, &haloDoneHandle, 1);
+      L2_BarrierWithSync_Reset(loopData.haloDoneBarrier, &haloDoneHandle, 1);
+      ++loopLocal;
+   }
+}
+
 void reactionLoop(Simulate& sim, SimLoopData& loopData, L2_BarrierHandle_t& reactionHandle, L2_BarrierHandle_t& diffusionHandle,
                   void (*integrate)(const int, const int, const double, double*, double*, unsigned*, double*, double*k, double*, double))
 {
@@ -749,6 +953,11 @@ void simulationLoopParallelDiffusionReaction(Simulate& sim)
       {
          reactionLoop(sim, loopData, reactionHandle, diffusionHandle, integrateLoop);
       }
+      if (sim.progressThreads_.nThreads() > 0 && sim.progressThreads_.teamRank() >= 0)
+      {
+         progressLoop(sim, loopData);
+      }
       profileStop(simulationLoopTimer);
    }
+   reportCodecError(sim, loopData.voltageExchange.codecError());
 }
@@ -0,0 +1,59 @@
+#!/usr/bin/env python
+
+def main():
+    import sys
+    import argparse
+    ap=argparse.ArgumentParser(description="Make a slab of BetterTT06 tissue with a layer of passive cells")
+    ap.add_argument("--nx", "-x",
+                    help="Size of the problem",
+                    type=int,
+                    default=16,
+                    )
+    ap.add_argument("--ny", "-y",
+                    help="Size of the problem",
+                    type=int,
+                    default=12,
+                    )
+    ap.add_argument("--nz", "-z",
+                    help="Size of the problem",
+                    type=int,
+                    default=12,
+                    )
+    ap.add_argument("--passive", "-p",
+                    help="Thickness of the passive layer at the high x end",
+                    type=int,
+                    default=4,
+                    )
+    
+    options = ap.parse_args()
+    nx=options.nx
+    ny=options.ny
+    nz=options.nz
+    passiveType = 0
+    tissueType = 102
+    
+    print("""anatomy FILEHEADER {
+  datatype = VARRECORDASCII;
+  nfiles = 1;
+  nrecords = %d;
+  nfields = 2;
+  field_names = gid cellType;
+  field_types = u u;
+  nx = %d; ny = %d; nz = %d;
+  field_units = 1 1;
+}
+""" % (nx*ny*nz,nx,ny,nz))
+
+    gid = 0
+    for iz in range(0,nz):
+        for iy in range(0,ny):
+            for ix in range(0,nx):
+                if ix >= nx-options.passive:
+                    cellType = passiveType
+                else:
+                    cellType = tissueType
+                print("%10d %3d" % (gid, cellType))
+                gid += 1
+
+if __name__=='__main__':
+    main()